@@ -1,8 +1,24 @@
 #include "common.h"
 #include "client.h"
+#include "session.h"
+#include "dispatcher.h"
 
 int run_client(cryptochan_config_t *config)
 {
-    fprintf(stderr, "client is not implemented yet.\n");
-    return EXIT_FAILURE;
+    cryptochan_dispatcher_workers_t workers;
+
+    // init workers
+    if (!dispatcher_workers_init(&workers, config, CSR_CLIENT)) {
+        fprintf(stderr, "Could not init dispatcher. Exiting.\n");
+        return EXIT_FAILURE;
+    }
+
+    // serve until stopped
+    bool result = dispatcher_workers_run(&workers);
+
+    // destroy workers
+    dispatcher_workers_destroy(&workers);
+
+    // all done
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,5 +1,6 @@
 #include "common.h"
 #include "max_scalar.h"
+#include "cpu_features.h"
 
 void assure_error_desc_empty(char **error_desc)
 {
@@ -51,134 +52,97 @@ void __xor_memory_region_simple(uint8_t *dptr, uint8_t *mask, size_t size)
     return;
 }
 
-#if (MAX_SCALAR_SIZE > 64)
-
-void __xor_memory_region_aligned_both(uint8_t *dptr, uint8_t *mask, size_t size)
-{
-    // unroll loop for 4 x max scalars
-    while (size >= sizeof(max_scalar_t) * 4) {
-        register max_scalar_t s0 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 0);
-        register max_scalar_t s1 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 1);
-        register max_scalar_t m0 = MAX_SCALAR_LOAD_ALIGNED(mask + sizeof(max_scalar_t) * 0);
-        register max_scalar_t m1 = MAX_SCALAR_LOAD_ALIGNED(mask + sizeof(max_scalar_t) * 1);
-
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 0, MAX_SCALAR_XOR(s0, m0));
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 1, MAX_SCALAR_XOR(s1, m1));
-
-        register max_scalar_t s2 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 2);
-        register max_scalar_t s3 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 3);
-        register max_scalar_t m2 = MAX_SCALAR_LOAD_ALIGNED(mask + sizeof(max_scalar_t) * 2);
-        register max_scalar_t m3 = MAX_SCALAR_LOAD_ALIGNED(mask + sizeof(max_scalar_t) * 3);
-
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 2, MAX_SCALAR_XOR(s2, m2));
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 3, MAX_SCALAR_XOR(s3, m3));
-
-        size -= sizeof(max_scalar_t) * 4;
-        dptr += sizeof(max_scalar_t) * 4;
-        mask += sizeof(max_scalar_t) * 4;
-    }
-
-    // process remaining max scalars
-    while (size >= sizeof(max_scalar_t)) {
-        register max_scalar_t s0 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 0);
-        register max_scalar_t m0 = MAX_SCALAR_LOAD_ALIGNED(mask + sizeof(max_scalar_t) * 0);
+//
+//  xor_memory_region kernels
+//
 
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 0, MAX_SCALAR_XOR(s0, m0));
+#if (MAX_SCALAR_SIZE > 64)
 
-        size -= sizeof(max_scalar_t);
-        dptr += sizeof(max_scalar_t);
-        mask += sizeof(max_scalar_t);
-    }
+// generic: the widest scalar enabled at compile time
+# define __XK_NAME(name)                name ## _generic
+# define __XK_TARGET
+# define __XK_SCALAR_T                  max_scalar_t
+# define __XK_LOAD(ptr)                 MAX_SCALAR_LOAD(ptr)
+# define __XK_LOAD_ALIGNED(ptr)         MAX_SCALAR_LOAD_ALIGNED(ptr)
+# define __XK_STORE_ALIGNED(ptr, val)   MAX_SCALAR_STORE_ALIGNED(ptr, val)
+# define __XK_XOR(a, b)                 MAX_SCALAR_XOR(a, b)
+# include "xor_memory_region.h"
 
-    // process remaining simply
-    if (size) {
-        __xor_memory_region_simple(dptr, mask, size);
-    }
+#else
 
-    return;
+void __xor_memory_region_generic(uint8_t *dptr, uint8_t *mask, size_t size)
+{
+    __xor_memory_region_simple(dptr, mask, size);
 }
 
-void __xor_memory_region_aligned_dptr(uint8_t *dptr, uint8_t *mask, size_t size)
-{
-    // unroll loop for 4 x max scalars
-    while (size >= sizeof(max_scalar_t) * 4) {
-        register max_scalar_t s0 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 0);
-        register max_scalar_t s1 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 1);
-        register max_scalar_t m0 = MAX_SCALAR_LOAD(mask + sizeof(max_scalar_t) * 0);
-        register max_scalar_t m1 = MAX_SCALAR_LOAD(mask + sizeof(max_scalar_t) * 1);
-
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 0, MAX_SCALAR_XOR(s0, m0));
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 1, MAX_SCALAR_XOR(s1, m1));
-
-        register max_scalar_t s2 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 2);
-        register max_scalar_t s3 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 3);
-        register max_scalar_t m2 = MAX_SCALAR_LOAD(mask + sizeof(max_scalar_t) * 2);
-        register max_scalar_t m3 = MAX_SCALAR_LOAD(mask + sizeof(max_scalar_t) * 3);
-
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 2, MAX_SCALAR_XOR(s2, m2));
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 3, MAX_SCALAR_XOR(s3, m3));
-
-        size -= sizeof(max_scalar_t) * 4;
-        dptr += sizeof(max_scalar_t) * 4;
-        mask += sizeof(max_scalar_t) * 4;
-    }
+#endif // (MAX_SCALAR_SIZE > 64)
 
-    // process remaining max scalars
-    while (size >= sizeof(max_scalar_t)) {
-        register max_scalar_t s0 = MAX_SCALAR_LOAD_ALIGNED(dptr + sizeof(max_scalar_t) * 0);
-        register max_scalar_t m0 = MAX_SCALAR_LOAD(mask + sizeof(max_scalar_t) * 0);
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 256)
 
-        MAX_SCALAR_STORE_ALIGNED(dptr + sizeof(max_scalar_t) * 0, MAX_SCALAR_XOR(s0, m0));
+// AVX2 (picked at runtime)
+# define __XK_NAME(name)                name ## _avx2
+# define __XK_TARGET                    SCALAR256_TARGET
+# define __XK_SCALAR_T                  scalar256_t
+# define __XK_LOAD(ptr)                 SCALAR256_LOAD(ptr)
+# define __XK_LOAD_ALIGNED(ptr)         SCALAR256_LOAD_ALIGNED(ptr)
+# define __XK_STORE_ALIGNED(ptr, val)   SCALAR256_STORE_ALIGNED(ptr, val)
+# define __XK_XOR(a, b)                 SCALAR256_XOR(a, b)
+# include "xor_memory_region.h"
 
-        size -= sizeof(max_scalar_t);
-        dptr += sizeof(max_scalar_t);
-        mask += sizeof(max_scalar_t);
-    }
+#endif // SCALAR_X86 && (MAX_SCALAR_SIZE < 256)
 
-    // process remaining simply
-    if (size) {
-        __xor_memory_region_simple(dptr, mask, size);
-    }
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 512)
 
-    return;
-}
-
-#endif // (MAX_SCALAR_SIZE > 64)
+// AVX-512 (picked at runtime)
+# define __XK_NAME(name)                name ## _avx512
+# define __XK_TARGET                    SCALAR512_TARGET
+# define __XK_SCALAR_T                  scalar512_t
+# define __XK_LOAD(ptr)                 SCALAR512_LOAD(ptr)
+# define __XK_LOAD_ALIGNED(ptr)         SCALAR512_LOAD_ALIGNED(ptr)
+# define __XK_STORE_ALIGNED(ptr, val)   SCALAR512_STORE_ALIGNED(ptr, val)
+# define __XK_XOR(a, b)                 SCALAR512_XOR(a, b)
+# include "xor_memory_region.h"
 
+#endif // SCALAR_X86 && (MAX_SCALAR_SIZE < 512)
 
-void xor_memory_region(uint8_t *dptr, uint8_t *mask, size_t size)
-{
-    size_t dptr_unaligned_tail = (size_t)dptr & (~MAX_SCALAR_ALIGN_MASK);
 
-    // do align (process) if there some portion of unaligned bytes
-    if (dptr_unaligned_tail) {
-        size_t count = MAX_SCALAR_BYTES - dptr_unaligned_tail;
+//
+//  xor_memory_region dispatch (kernel is picked once at startup)
+//
 
-        if (size <= count) {
-            __xor_memory_region_simple(dptr, mask, size);
+typedef void (*xor_memory_region_func_t)(uint8_t *dptr, uint8_t *mask, size_t size);
 
-            return;
-        }
+static xor_memory_region_func_t xor_memory_region_func = __xor_memory_region_generic;
+static const char *xor_memory_region_name = "generic";
 
-        __xor_memory_region_simple(dptr, mask, count);
+__attribute__((constructor))
+void __xor_memory_region_select(void)
+{
+    __attribute__((unused)) const cpu_features_t *features = cpu_features();
 
-        size -= count;
-        dptr += count;
-        mask += count;
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 512)
+    if (features->avx512f) {
+        xor_memory_region_func = __xor_memory_region_avx512;
+        xor_memory_region_name = "avx512";
+        return;
     }
+#endif
 
-#if (MAX_SCALAR_SIZE > 64)
-    size_t mask_unaligned_tail = (size_t)mask & (~MAX_SCALAR_ALIGN_MASK);
-
-    if (mask_unaligned_tail) {
-        __xor_memory_region_aligned_dptr(dptr, mask, size);
-    } else {
-        __xor_memory_region_aligned_both(dptr, mask, size);
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 256)
+    if (features->avx2) {
+        xor_memory_region_func = __xor_memory_region_avx2;
+        xor_memory_region_name = "avx2";
+        return;
     }
-#else
-    __xor_memory_region_simple(dptr, mask, size);
 #endif
+}
 
-    return;
+const char *xor_memory_region_kernel_name(void)
+{
+    return xor_memory_region_name;
 }
 
+void xor_memory_region(uint8_t *dptr, uint8_t *mask, size_t size)
+{
+    xor_memory_region_func(dptr, mask, size);
+}
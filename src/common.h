@@ -20,5 +20,6 @@
 
 extern void assure_error_desc_empty(char **error_desc);
 extern void xor_memory_region(uint8_t *dptr, uint8_t *mask, size_t size);
+extern const char *xor_memory_region_kernel_name(void);
 
 #endif // __COMMON_H
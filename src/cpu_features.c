@@ -0,0 +1,85 @@
+#include "common.h"
+#include "cpu_features.h"
+
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+static cpu_features_t detected_features;
+static pthread_once_t detected_once = PTHREAD_ONCE_INIT;
+
+void __cpu_features_detect(void)
+{
+    cpu_features_t *f = &detected_features;
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+
+    f->sse2 = __builtin_cpu_supports("sse2");
+    f->ssse3 = __builtin_cpu_supports("ssse3");
+    f->avx2 = __builtin_cpu_supports("avx2");
+    f->avx512f = __builtin_cpu_supports("avx512f");
+    f->aesni = __builtin_cpu_supports("aes") && f->sse2;
+#endif
+
+    // apply the cap (if any) given by environment
+    const char *cap = getenv(CPU_FEATURES_ENV_CAP);
+    if ((cap == NULL) || (*cap == '\0')) {
+        return;
+    }
+
+    if (!strcasecmp(cap, "avx2")) {
+        f->avx512f = false;
+    } else if (!strcasecmp(cap, "sse2")) {
+        f->avx512f = f->avx2 = false;
+    } else if (!strcasecmp(cap, "none")) {
+        memset(f, 0, sizeof(cpu_features_t));
+    } else if (strcasecmp(cap, "avx512")) {
+        fprintf(stderr, "WARN: unknown %s value: `%s' (ignored)\n", CPU_FEATURES_ENV_CAP, cap);
+    }
+}
+
+const cpu_features_t *cpu_features(void)
+{
+    pthread_once(&detected_once, __cpu_features_detect);
+    return &detected_features;
+}
+
+int cpu_numa_node(int cpu)
+{
+    char path[64];
+    struct dirent *entry;
+    int node = -1;
+
+    // the CPU directory links its node as `node<N>'
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR *dir = opendir(path);
+    if (!dir)
+        { return -1; }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strncmp(entry->d_name, "node", 4) == 0) && isdigit((unsigned char)entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return node;
+}
+
+bool cpu_numa_prefer_node(void *addr, size_t size, int node)
+{
+    unsigned long nodemask[4] = {0};
+    int bits = sizeof(nodemask[0]) * 8;
+
+    if ((node < 0) || (node >= (int)sizeof(nodemask) * 8))
+        { errno = EINVAL; return false; }
+
+    // no libnuma: the plain syscall (falls back to other nodes when this one is
+    // full), maxnode counts one more than the mask bits as libnuma passes it
+    nodemask[node / bits] = 1UL << (node % bits);
+    return syscall(SYS_mbind, addr, size, MPOL_PREFERRED, nodemask, sizeof(nodemask) * 8 + 1, 0) == 0;
+}
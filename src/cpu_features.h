@@ -0,0 +1,29 @@
+#ifndef __CPU_FEATURES_H
+#define __CPU_FEATURES_H
+
+#include "common.h"
+
+// the detected features may be capped via the CRYPTOCHAN_SIMD environment
+// variable: "avx512", "avx2", "sse2" or "none" (useful to test fallbacks)
+#ifndef CPU_FEATURES_ENV_CAP
+# define CPU_FEATURES_ENV_CAP "CRYPTOCHAN_SIMD"
+#endif
+
+typedef struct __cpu_features {
+    bool sse2;
+    bool ssse3;
+    bool avx2;
+    bool avx512f;
+    bool aesni;
+} cpu_features_t;
+
+extern const cpu_features_t *cpu_features(void);
+
+// NUMA node of the CPU (-1 = unknown, e.g. no sysfs)
+extern int cpu_numa_node(int cpu);
+
+// pages of the range not touched yet come from the node (if it has free
+// memory, the range must be page aligned); false when the kernel refuses
+extern bool cpu_numa_prefer_node(void *addr, size_t size, int node);
+
+#endif // __CPU_FEATURES_H
@@ -23,7 +23,8 @@ static char doc[] = "Simple custom crypto-channel like stunnel/socat,"
 static char args_doc[] = "MODE";
 static struct argp_option options[] = {
     { "config", 'C', "FILE", 0, "Path to the configuration file" },
-    { "prng", 'P', 0, 0, "Use PRNG instead of /dev/urandom" },
+    { "prng", 'P', 0, 0, "Ignored, kept for compatibility (keys always come from"
+        " the getrandom() seeded ChaCha20 generator)" },
     { 0 }
 };
 
@@ -37,7 +38,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
             break;
         }
         case 'P': {
-            set_use_prng(true);
+            // the fast filler PRNG is not for key material
             break;
         }
         case ARGP_KEY_ARG: {
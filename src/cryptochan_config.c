@@ -1,11 +1,19 @@
 #include "common.h"
 
 #include <libconfig.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "cryptochan_config.h"
 #include "ec_helper.h"
 
 
+// serializes publishing a new client set with taking a reference to the current
+// one (never taken on the handshake path)
+static pthread_mutex_t cryptochan_config_client_set_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 bool cryptochan_config_parse_sock_addr(
     config_setting_t *root_setting,
     const char *setting_name,
@@ -50,6 +58,127 @@ bool cryptochan_config_parse_sock_addr(
 }
 
 
+bool cryptochan_config_parse_workers(
+    config_setting_t *root_setting,
+    cryptochan_config_workers_t *cc_workers,
+    char **error_desc
+)
+{
+    __attribute__((unused)) int asp_res;
+    const char *str;
+    int pin = 0;
+
+    assure_error_desc_empty(error_desc);
+
+    // parse workers (optional, one event loop by default, 0 = one per CPU
+    // this process may run on)
+    cc_workers->count = 1;
+    if (!config_setting_lookup_int(root_setting, "workers", &(cc_workers->count))
+        && config_setting_lookup(root_setting, "workers")) {
+        asp_res = asprintf(error_desc, "invalid `workers' setting");
+        return false;
+    }
+    if (cc_workers->count == 0) {
+        cpu_set_t allowed;
+        long ncpus = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            ? CPU_COUNT(&allowed) : sysconf(_SC_NPROCESSORS_ONLN);
+        cc_workers->count = (ncpus > 0) ? (int)ncpus : 1;
+    }
+    if (cc_workers->count < 0) {
+        asp_res = asprintf(error_desc, "invalid `workers' setting: must not be negative");
+        return false;
+    }
+
+    // parse pin-workers (optional)
+    if (!config_setting_lookup_bool(root_setting, "pin-workers", &pin)
+        && config_setting_lookup(root_setting, "pin-workers")) {
+        asp_res = asprintf(error_desc, "invalid `pin-workers' setting");
+        return false;
+    }
+    cc_workers->pin = (pin != 0);
+
+    // parse splice-relay (optional)
+    pin = 0;
+    if (!config_setting_lookup_bool(root_setting, "splice-relay", &pin)
+        && config_setting_lookup(root_setting, "splice-relay")) {
+        asp_res = asprintf(error_desc, "invalid `splice-relay' setting");
+        return false;
+    }
+    cc_workers->splice = (pin != 0);
+
+    // parse huge-pages (optional, a bool as well: true is explicit)
+    cc_workers->huge_pages = CCHP_OFF;
+    pin = 0;
+    if (config_setting_lookup_string(root_setting, "huge-pages", &str)) {
+        if (strcmp(str, "transparent") == 0) {
+            cc_workers->huge_pages = CCHP_TRANSPARENT;
+        } else if (strcmp(str, "explicit") == 0) {
+            cc_workers->huge_pages = CCHP_EXPLICIT;
+        } else if (strcmp(str, "off") != 0) {
+            asp_res = asprintf(error_desc, "invalid `huge-pages' setting: "
+                "`%s' (expected `off', `transparent' or `explicit')", str);
+            return false;
+        }
+    } else if (config_setting_lookup_bool(root_setting, "huge-pages", &pin)) {
+        cc_workers->huge_pages = pin ? CCHP_EXPLICIT : CCHP_OFF;
+    } else if (config_setting_lookup(root_setting, "huge-pages")) {
+        asp_res = asprintf(error_desc, "invalid `huge-pages' setting");
+        return false;
+    }
+
+    // parse io-backend (optional)
+    cc_workers->io_backend = CCIB_EPOLL;
+    if (config_setting_lookup_string(root_setting, "io-backend", &str)) {
+        if (strcmp(str, "io_uring") == 0) {
+            cc_workers->io_backend = CCIB_IO_URING;
+        } else if (strcmp(str, "epoll") != 0) {
+            asp_res = asprintf(error_desc, "invalid `io-backend' setting: "
+                "`%s' (expected `epoll' or `io_uring')", str);
+            return false;
+        }
+    } else if (config_setting_lookup(root_setting, "io-backend")) {
+        asp_res = asprintf(error_desc, "invalid `io-backend' setting");
+        return false;
+    }
+
+    // all done
+    return true;
+}
+
+
+bool cryptochan_config_parse_cipher(
+    config_setting_t *root_setting,
+    cryptochan_config_cipher_t *cc_cipher,
+    char **error_desc
+)
+{
+    __attribute__((unused)) int asp_res;
+    const char *str;
+
+    assure_error_desc_empty(error_desc);
+
+    // parse cipher (optional)
+    *cc_cipher = CCC_AUTO;
+    if (config_setting_lookup_string(root_setting, "cipher", &str)) {
+        if (strcmp(str, "aes-256-ctr") == 0) {
+            *cc_cipher = CCC_AES_256_CTR;
+        } else if (strcmp(str, "chacha20") == 0) {
+            *cc_cipher = CCC_CHACHA20;
+        } else if (strcmp(str, "auto") != 0) {
+            asp_res = asprintf(error_desc, "invalid `cipher' setting: "
+                "`%s' (expected `auto', `aes-256-ctr' or `chacha20')", str);
+            return false;
+        }
+    } else if (config_setting_lookup(root_setting, "cipher")) {
+        asp_res = asprintf(error_desc, "invalid `cipher' setting");
+        return false;
+    }
+
+    // all done
+    return true;
+}
+
+
 bool cryptochan_config_parse_client(
     config_setting_t *setting,
     cryptochan_config_client_t *cc_client,
@@ -58,6 +187,7 @@ bool cryptochan_config_parse_client(
 {
     char *nest_error_desc = NULL;
     __attribute__((unused)) int asp_res;
+    const char *str;
 
     assure_error_desc_empty(error_desc);
 
@@ -65,6 +195,10 @@ bool cryptochan_config_parse_client(
             setting, "listen", &(cc_client->listen), &nest_error_desc)
         || !cryptochan_config_parse_sock_addr(
             setting, "target", &(cc_client->target), &nest_error_desc)
+        || !cryptochan_config_parse_workers(
+            setting, &(cc_client->workers), &nest_error_desc)
+        || !cryptochan_config_parse_cipher(
+            setting, &(cc_client->cipher), &nest_error_desc)
     ) {
         if (nest_error_desc != NULL) {
             asp_res = asprintf(error_desc, "bad `client' config: %s", nest_error_desc);
@@ -73,11 +207,380 @@ bool cryptochan_config_parse_client(
         return false;
     }
 
+    // parse server public key (mandatory)
+    if (!config_setting_lookup_string(setting, "server-public-key", &str)) {
+        asp_res = asprintf(error_desc, "bad `client' config: missing `server-public-key'");
+        return false;
+    }
+    if (!(cc_client->server_public_key = strdup(str))) {
+        perror("strdup");
+        return false;
+    }
+    if (!decode_b58_pubkey(
+            cc_client->server_public_key, &(cc_client->server_public_key_data),
+            &nest_error_desc)) {
+        asp_res = asprintf(error_desc, "bad `client' config: `server-public-key': %s",
+            nest_error_desc);
+        free(nest_error_desc);
+        return false;
+    }
+
     // all done
     return true;
 }
 
 
+bool cryptochan_config_parse_allowed_clients(
+    config_setting_t *setting,
+    cryptochan_config_client_set_t *set,
+    char **error_desc
+)
+{
+    __attribute__((unused)) int asp_res;
+    const char *name, *public_key;
+
+    assure_error_desc_empty(error_desc);
+
+    if (!config_setting_is_list(setting)) {
+        asp_res = asprintf(error_desc, "`clients' setting must be a list");
+        return false;
+    }
+
+    // one contiguous array (keys are decoded later, in parallel)
+    set->client_count = config_setting_length(setting);
+    if (!(set->clients = calloc(MAX(set->client_count, 1),
+            sizeof(cryptochan_config_server_allowed_client_t)))) {
+        perror("calloc");
+        return false;
+    }
+
+    for (int i = 0; i < set->client_count; ++i) {
+        config_setting_t *client_setting = config_setting_get_elem(setting, i);
+        cryptochan_config_server_allowed_client_t *client = &(set->clients[i]);
+
+        // parse name and public key (both mandatory)
+        if (!config_setting_lookup_string(client_setting, "name", &name)) {
+            asp_res = asprintf(error_desc, "`clients' entry #%d: missing `name'", i);
+            return false;
+        }
+        if (!config_setting_lookup_string(client_setting, "public-key", &public_key)) {
+            asp_res = asprintf(error_desc, "client `%s': missing `public-key'", name);
+            return false;
+        }
+
+        if (!(client->name = strdup(name)) || !(client->public_key = strdup(public_key))) {
+            perror("strdup");
+            return false;
+        }
+    }
+
+    // all done
+    return true;
+}
+
+
+bool cryptochan_config_static_fingerprint(
+    secp256k1_pubkey *public_key_data, uint8_t *private_key_data,
+    uint8_t *static_secret, uint8_t *fingerprint
+)
+{
+    if (!ecdh_shared_secret(public_key_data, private_key_data, static_secret)) {
+        return false;
+    }
+
+    tagged_hash(CRYPTOCHAN_CONFIG_FINGERPRINT_TAG, static_secret, EC_HASH_SIZE, fingerprint);
+
+    return true;
+}
+
+
+uint32_t __cryptochan_config_client_slot(
+    cryptochan_config_client_index_t *index, const uint8_t *fingerprint
+)
+{
+    uint32_t hash;
+
+    // fingerprints are hashes already, any 4 bytes are uniform
+    memcpy(&hash, fingerprint, sizeof(hash));
+
+    return hash & index->mask;
+}
+
+
+typedef struct __cryptochan_config_decode_job {
+    cryptochan_config_server_allowed_client_t *clients;
+    int first, last;                    // [first, last)
+    uint8_t *private_key_data;
+    int failed;                         // index of the first failed client, -1 = none
+    char *error_desc;
+} cryptochan_config_decode_job_t;
+
+void *__cryptochan_config_decode_clients(void *arg)
+{
+    __attribute__((unused)) int asp_res;
+    cryptochan_config_decode_job_t *job = arg;
+    char *nest_error_desc = NULL;
+
+    // base58 + secp256k1 validation + ECDH (the thread's own EC context)
+    for (int i = job->first; i < job->last; ++i) {
+        cryptochan_config_server_allowed_client_t *client = &(job->clients[i]);
+
+        if (!decode_b58_pubkey(client->public_key, &(client->public_key_data), &nest_error_desc)) {
+            asp_res = asprintf(&(job->error_desc), "client `%s': %s", client->name, nest_error_desc);
+            free(nest_error_desc);
+            job->failed = i;
+            break;
+        }
+
+        if (!cryptochan_config_static_fingerprint(&(client->public_key_data),
+                job->private_key_data, client->static_secret, client->fingerprint)) {
+            asp_res = asprintf(&(job->error_desc),
+                "client `%s': failed to compute static shared secret", client->name);
+            job->failed = i;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+bool cryptochan_config_decode_clients(
+    cryptochan_config_client_set_t *set,
+    uint8_t *private_key_data,
+    char **error_desc
+)
+{
+    int count = set->client_count;
+    int nthreads = 1, started = 0, failed = -1;
+    struct timespec start, end;
+
+    assure_error_desc_empty(error_desc);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // not worth a thread below a few hundred keys
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 1) {
+        nthreads = MIN((int)ncpus, (count + CRYPTOCHAN_CONFIG_DECODE_BATCH - 1)
+            / CRYPTOCHAN_CONFIG_DECODE_BATCH);
+        nthreads = MAX(nthreads, 1);
+    }
+
+    cryptochan_config_decode_job_t jobs[nthreads];
+    pthread_t threads[nthreads];
+
+    for (int t = 0; t < nthreads; ++t) {
+        jobs[t] = (cryptochan_config_decode_job_t) {
+            .clients = set->clients,
+            .first = (int)((int64_t)count * t / nthreads),
+            .last = (int)((int64_t)count * (t + 1) / nthreads),
+            .private_key_data = private_key_data,
+            .failed = -1,
+        };
+    }
+
+    // jobs 1.. in threads (fall back to the calling thread), job 0 here
+    for (started = 1; started < nthreads; ++started) {
+        int err = pthread_create(&threads[started], NULL,
+            __cryptochan_config_decode_clients, &jobs[started]);
+        if (err != 0) {
+            fprintf(stderr, "WARNING: config: could not start decode thread: %s\n",
+                strerror(err));
+            break;
+        }
+    }
+    for (int t = started; t < nthreads; ++t) {
+        __cryptochan_config_decode_clients(&jobs[t]);
+    }
+    __cryptochan_config_decode_clients(&jobs[0]);
+
+    for (int t = 1; t < started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // report the first error in config order
+    for (int t = 0; t < nthreads; ++t) {
+        if ((jobs[t].failed != -1) && (failed == -1)) {
+            failed = jobs[t].failed;
+            *error_desc = jobs[t].error_desc;
+        } else {
+            free(jobs[t].error_desc);
+        }
+    }
+    if (failed != -1) {
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (count > 0) {
+        fprintf(stderr, "config: %d allowed client key(s) loaded in %.3f s (%d thread(s))\n",
+            count, (double)(end.tv_sec - start.tv_sec)
+                + (double)(end.tv_nsec - start.tv_nsec) / 1e9,
+            nthreads);
+    }
+
+    // all done
+    return true;
+}
+
+
+bool cryptochan_config_build_client_index(
+    cryptochan_config_client_set_t *set,
+    char **error_desc
+)
+{
+    __attribute__((unused)) int asp_res;
+    cryptochan_config_client_index_t *index = &(set->index);
+    uint32_t size = 2;
+
+    assure_error_desc_empty(error_desc);
+
+    // power of 2, at least twice the client count (short probe sequences)
+    while (size < (uint32_t)set->client_count * 2) {
+        size <<= 1;
+    }
+
+    if (!(index->slots = calloc(size, sizeof(cryptochan_config_server_allowed_client_t*)))) {
+        perror("calloc");
+        return false;
+    }
+    index->mask = size - 1;
+
+    for (int i = 0; i < set->client_count; ++i) {
+        cryptochan_config_server_allowed_client_t *client = &(set->clients[i]);
+
+        uint32_t slot = __cryptochan_config_client_slot(index, client->fingerprint);
+        while (index->slots[slot] != NULL) {
+            if (memcmp(index->slots[slot]->fingerprint, client->fingerprint, EC_HASH_SIZE) == 0) {
+                asp_res = asprintf(error_desc, "client `%s': same public key as client `%s'",
+                    client->name, index->slots[slot]->name);
+                return false;
+            }
+            slot = (slot + 1) & index->mask;
+        }
+        index->slots[slot] = client;
+    }
+
+    // all done
+    return true;
+}
+
+
+cryptochan_config_server_allowed_client_t *cryptochan_config_find_client(
+    cryptochan_config_client_set_t *set, const uint8_t *fingerprint
+)
+{
+    cryptochan_config_client_index_t *index;
+    cryptochan_config_server_allowed_client_t *client;
+
+    if ((set == NULL) || (set->index.slots == NULL)) {
+        return NULL;
+    }
+    index = &(set->index);
+
+    // an empty slot ends the probe sequence
+    uint32_t slot = __cryptochan_config_client_slot(index, fingerprint);
+    while ((client = index->slots[slot]) != NULL) {
+        if (memcmp(client->fingerprint, fingerprint, EC_HASH_SIZE) == 0) {
+            return client;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+
+    return NULL;
+}
+
+
+void __cryptochan_config_client_set_free(cryptochan_config_client_set_t *set)
+{
+    for (int i = 0; i < set->client_count; ++i) {
+        free((void*)set->clients[i].name);
+        free((void*)set->clients[i].public_key);
+    }
+
+    // static secrets are secret
+    if (set->clients != NULL) {
+        explicit_bzero(set->clients,
+            (size_t)set->client_count * sizeof(cryptochan_config_server_allowed_client_t));
+    }
+
+    free(set->clients);
+    free(set->index.slots);
+    free(set);
+}
+
+
+bool cryptochan_config_load_client_set(
+    config_setting_t *server_setting,
+    uint8_t *private_key_data,
+    cryptochan_config_client_set_t **set_ptr,
+    char **error_desc
+)
+{
+    config_setting_t *clients_setting;
+    char *nest_error_desc = NULL;
+    __attribute__((unused)) int asp_res;
+    cryptochan_config_client_set_t *set;
+
+    assure_error_desc_empty(error_desc);
+
+    if (!(set = calloc(1, sizeof(cryptochan_config_client_set_t)))) {
+        perror("calloc");
+        return false;
+    }
+    atomic_init(&(set->refs), 1);
+
+    // allowed clients are optional (no client is allowed without them)
+    clients_setting = config_setting_lookup(server_setting, "clients");
+
+    if (((clients_setting != NULL)
+            && !cryptochan_config_parse_allowed_clients(clients_setting, set, &nest_error_desc))
+        || !cryptochan_config_decode_clients(set, private_key_data, &nest_error_desc)
+        || !cryptochan_config_build_client_index(set, &nest_error_desc)
+    ) {
+        if (nest_error_desc != NULL) {
+            asp_res = asprintf(error_desc, "bad `server' config: %s", nest_error_desc);
+            free(nest_error_desc);
+        }
+        __cryptochan_config_client_set_free(set);
+        return false;
+    }
+
+    *set_ptr = set;
+
+    // all done
+    return true;
+}
+
+
+cryptochan_config_client_set_t *cryptochan_config_client_set_acquire(
+    cryptochan_config_server_t *cc_server
+)
+{
+    pthread_mutex_lock(&cryptochan_config_client_set_lock);
+    cryptochan_config_client_set_t *set = atomic_load(&(cc_server->client_set));
+    if (set != NULL) {
+        atomic_fetch_add(&(set->refs), 1);
+    }
+    pthread_mutex_unlock(&cryptochan_config_client_set_lock);
+
+    return set;
+}
+
+void cryptochan_config_client_set_hold(cryptochan_config_client_set_t *set)
+{
+    atomic_fetch_add(&(set->refs), 1);
+}
+
+void cryptochan_config_client_set_release(cryptochan_config_client_set_t *set)
+{
+    if ((set != NULL) && (atomic_fetch_sub(&(set->refs), 1) == 1)) {
+        __cryptochan_config_client_set_free(set);
+    }
+}
+
+
 bool cryptochan_config_parse_server(
     config_setting_t *setting,
     cryptochan_config_server_t *cc_server,
@@ -86,6 +589,7 @@ bool cryptochan_config_parse_server(
 {
     char *nest_error_desc = NULL;
     __attribute__((unused)) int asp_res;
+    int revoke_on_reload;
 
     assure_error_desc_empty(error_desc);
 
@@ -93,13 +597,40 @@ bool cryptochan_config_parse_server(
             setting, "listen", &(cc_server->listen), &nest_error_desc)
         || !cryptochan_config_parse_sock_addr(
             setting, "target", &(cc_server->target), &nest_error_desc)
+        || !cryptochan_config_parse_workers(
+            setting, &(cc_server->workers), &nest_error_desc)
+        || !cryptochan_config_parse_cipher(
+            setting, &(cc_server->cipher), &nest_error_desc)
     ) {
         if (nest_error_desc != NULL) {
             asp_res = asprintf(error_desc, "bad `server' config: %s", nest_error_desc);
             free(nest_error_desc);
         }
+        return false;
     }
 
+    // parse ticket-lifetime (optional)
+    cc_server->ticket_lifetime = CRYPTOCHAN_CONFIG_DEFAULT_TICKET_LIFETIME;
+    if (!config_setting_lookup_int(setting, "ticket-lifetime", &(cc_server->ticket_lifetime))
+        && config_setting_lookup(setting, "ticket-lifetime")) {
+        asp_res = asprintf(error_desc, "bad `server' config: invalid `ticket-lifetime'");
+        return false;
+    }
+    if (cc_server->ticket_lifetime < 0) {
+        asp_res = asprintf(error_desc, "bad `server' config: `ticket-lifetime' must not be negative");
+        return false;
+    }
+
+    // parse revoke-on-reload (optional)
+    if (config_setting_lookup_bool(setting, "revoke-on-reload", &revoke_on_reload)) {
+        cc_server->revoke_on_reload = revoke_on_reload;
+    } else if (config_setting_lookup(setting, "revoke-on-reload")) {
+        asp_res = asprintf(error_desc, "bad `server' config: invalid `revoke-on-reload'");
+        return false;
+    }
+
+    // allowed clients are loaded separately (they need the private key, and reload)
+
     // all done
     return true;
 }
@@ -111,6 +642,7 @@ bool cryptochan_config_load(cryptochan_config_t *cc_config, const char *config_f
     char *error_desc = NULL;
     const char *str;
     secp256k1_pubkey orig_pubkey;
+    cryptochan_config_client_set_t *client_set;
 
     // config vars
     config_t config;
@@ -127,6 +659,12 @@ bool cryptochan_config_load(cryptochan_config_t *cc_config, const char *config_f
             break;
         }
 
+        // remember the path (reload)
+        if (!(cc_config->filepath = strdup(config_filepath))) {
+            perror("strdup");
+            break;
+        }
+
         // parse config setting: private-key (mandatory)
         if (!config_lookup_string(&config, "private-key", &str)) {
             fprintf(stderr, "Missing private-key setting in config file `%s'\n",
@@ -193,10 +731,15 @@ bool cryptochan_config_load(cryptochan_config_t *cc_config, const char *config_f
         if ((setting = config_lookup(&config, "server")) != NULL) {
             cc_config->server.present = true;
 
-            if (!cryptochan_config_parse_server(setting, &(cc_config->server), &error_desc)) {
-                fprintf(stderr, "Failed to load config file: %s\n", error_desc);
+            if (!cryptochan_config_parse_server(setting, &(cc_config->server), &error_desc)
+                || !cryptochan_config_load_client_set(setting, cc_config->private_key_data,
+                    &client_set, &error_desc)) {
+                if (error_desc != NULL) {
+                    fprintf(stderr, "Failed to load config file: %s\n", error_desc);
+                }
                 break;
             }
+            atomic_store(&(cc_config->server.client_set), client_set);
         }
 
         // all done
@@ -209,3 +752,68 @@ bool cryptochan_config_load(cryptochan_config_t *cc_config, const char *config_f
     config_destroy(&config);
     return result;
 }
+
+
+bool cryptochan_config_reload_clients(cryptochan_config_t *cc_config)
+{
+    bool result = false;
+    char *error_desc = NULL;
+    const char *str;
+    cryptochan_config_client_set_t *set, *old_set;
+
+    // config vars
+    config_t config;
+    config_setting_t *setting;
+
+    // init the config struct
+    config_init(&config);
+
+    for (;;) {
+        if (!config_read_file(&config, cc_config->filepath)) {
+            fprintf(stderr, "Error parsing config file `%s' at line %d: %s\n",
+                cc_config->filepath, config_error_line(&config), config_error_text(&config));
+            break;
+        }
+
+        // static secrets depend on the private key (a restart is needed to change it)
+        if (!config_lookup_string(&config, "private-key", &str)
+            || (strcmp(str, cc_config->private_key) != 0)) {
+            fprintf(stderr, "Config file `%s': private-key changed, restart to apply\n",
+                cc_config->filepath);
+            break;
+        }
+
+        if ((setting = config_lookup(&config, "server")) == NULL) {
+            fprintf(stderr, "Config file `%s': missing `server'\n", cc_config->filepath);
+            break;
+        }
+
+        // built off the hot path (new handshakes keep using the current set)
+        if (!cryptochan_config_load_client_set(
+                setting, cc_config->private_key_data, &set, &error_desc)) {
+            if (error_desc != NULL) {
+                fprintf(stderr, "Failed to reload config file: %s\n", error_desc);
+            }
+            break;
+        }
+
+        // publish, the old set lives on while referenced
+        pthread_mutex_lock(&cryptochan_config_client_set_lock);
+        old_set = atomic_exchange(&(cc_config->server.client_set), set);
+        pthread_mutex_unlock(&cryptochan_config_client_set_lock);
+
+        fprintf(stderr, "config: reloaded, %d allowed client(s) (were %d)\n",
+            set->client_count, (old_set != NULL) ? old_set->client_count : 0);
+
+        cryptochan_config_client_set_release(old_set);
+
+        // all done
+        result = true;
+        break;
+    }
+
+    /* finalize */
+    if (error_desc != NULL) free(error_desc);
+    config_destroy(&config);
+    return result;
+}
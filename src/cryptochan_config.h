@@ -4,15 +4,55 @@
 #include "common.h"
 #include <secp256k1.h>
 
+// tag of H(ECDH(static keys)), the client identifier sent in the client hello
+#define CRYPTOCHAN_CONFIG_FINGERPRINT_TAG "cryptochan/ecdh-fingerprint"
+
+#ifndef CRYPTOCHAN_CONFIG_DEFAULT_TICKET_LIFETIME
+# define CRYPTOCHAN_CONFIG_DEFAULT_TICKET_LIFETIME 3600
+#endif
+
+// allowed client keys per decode thread (at least) at load
+#ifndef CRYPTOCHAN_CONFIG_DECODE_BATCH
+# define CRYPTOCHAN_CONFIG_DECODE_BATCH 256
+#endif
+
 typedef struct __cryptochan_config_sock_addr {
     const char* host;
     int port;
 } cryptochan_config_sock_addr_t;
 
+typedef enum __cryptochan_config_io_backend {
+    CCIB_EPOLL = 0,
+    CCIB_IO_URING,                      // falls back to epoll when not supported
+} cryptochan_config_io_backend_t;
+
+// keystream cipher of the channel, negotiated in the hello
+typedef enum __cryptochan_config_cipher {
+    CCC_AUTO = 0,                       // AES-256-CTR with AES-NI, ChaCha20 otherwise
+    CCC_AES_256_CTR,
+    CCC_CHACHA20,
+} cryptochan_config_cipher_t;
+
+typedef enum __cryptochan_config_huge_pages {
+    CCHP_OFF = 0,
+    CCHP_TRANSPARENT,                   // madvise(MADV_HUGEPAGE) arenas and large buffers
+    CCHP_EXPLICIT,                      // session arenas on reserved hugepages (MAP_HUGETLB)
+} cryptochan_config_huge_pages_t;
+
+typedef struct __cryptochan_config_workers {
+    int count;                          // event loop threads (SO_REUSEPORT listeners)
+    bool pin;                           // pin worker N to the N-th allowed CPU (mod their count)
+    cryptochan_config_io_backend_t io_backend;
+    bool splice;                        // relay the plain side with splice() (epoll only)
+    cryptochan_config_huge_pages_t huge_pages;
+} cryptochan_config_workers_t;
+
 typedef struct __cryptochan_config_client {
     bool present;
     cryptochan_config_sock_addr_t listen;
     cryptochan_config_sock_addr_t target;
+    cryptochan_config_workers_t workers;
+    cryptochan_config_cipher_t cipher;
     const char *server_public_key;
     alignas(32) secp256k1_pubkey server_public_key_data;
 } cryptochan_config_client_t;
@@ -20,18 +60,39 @@ typedef struct __cryptochan_config_client {
 typedef struct __cryptochan_config_server_allowed_client {
     const char *name;
     const char *public_key;
-    struct __cryptochan_config_server_allowed_client *next;
     alignas(32) secp256k1_pubkey public_key_data;
+    uint8_t static_secret[32];          // ECDH(server private key, client public key)
+    uint8_t fingerprint[32];            // H(static_secret), the client index key
 } cryptochan_config_server_allowed_client_t;
 
+// open addressing (linear probing) by fingerprint, at most half full
+typedef struct __cryptochan_config_client_index {
+    cryptochan_config_server_allowed_client_t **slots;
+    uint32_t mask;                      // slot count - 1 (power of 2)
+} cryptochan_config_client_index_t;
+
+// immutable once published; replaced as a whole on reload (RCU-style: readers
+// keep a reference to the set they started with, the last one frees it)
+typedef struct __cryptochan_config_client_set {
+    cryptochan_config_server_allowed_client_t *clients;  // contiguous, config order
+    int client_count;
+    cryptochan_config_client_index_t index;
+    atomic_int refs;
+} cryptochan_config_client_set_t;
+
 typedef struct __cryptochan_config_server {
     bool present;
     cryptochan_config_sock_addr_t listen;
     cryptochan_config_sock_addr_t target;
-    cryptochan_config_server_allowed_client_t *clients;
+    cryptochan_config_workers_t workers;
+    cryptochan_config_cipher_t cipher;
+    int ticket_lifetime;                // seconds, 0 = no resumption tickets
+    bool revoke_on_reload;              // close live sessions of removed clients
+    cryptochan_config_client_set_t *_Atomic client_set;  // current (SIGHUP reloads)
 } cryptochan_config_server_t;
 
 typedef struct __cryptochan_config {
+    const char *filepath;
     const char *private_key;
     const char *public_key;
     cryptochan_config_client_t client;
@@ -42,4 +103,28 @@ typedef struct __cryptochan_config {
 
 extern bool cryptochan_config_load(cryptochan_config_t *cc_config, const char *config_filepath);
 
+extern bool cryptochan_config_static_fingerprint(
+    secp256k1_pubkey *public_key_data, uint8_t *private_key_data,
+    uint8_t *static_secret, uint8_t *fingerprint
+);
+// index set->clients by fingerprint (fails on clients with the same key)
+extern bool cryptochan_config_build_client_index(
+    cryptochan_config_client_set_t *set,
+    char **error_desc
+);
+extern cryptochan_config_server_allowed_client_t *cryptochan_config_find_client(
+    cryptochan_config_client_set_t *set, const uint8_t *fingerprint
+);
+
+// re-read the allowed clients from the config file and publish them as the
+// current set (the private key must be unchanged)
+extern bool cryptochan_config_reload_clients(cryptochan_config_t *cc_config);
+
+// acquire takes a reference to the current set, hold one more to a held set
+extern cryptochan_config_client_set_t *cryptochan_config_client_set_acquire(
+    cryptochan_config_server_t *cc_server
+);
+extern void cryptochan_config_client_set_hold(cryptochan_config_client_set_t *set);
+extern void cryptochan_config_client_set_release(cryptochan_config_client_set_t *set);
+
 #endif
@@ -1,7 +1,84 @@
 #include "common.h"
 #include "cyclic_buffer.h"
+#include "cpu_features.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+
+uint32_t cyclic_buffer_page_size(void)
+{
+    static uint32_t page_size = 0;
+
+    if (page_size == 0) {
+        long res = sysconf(_SC_PAGESIZE);
+        page_size = (res > 0) ? (uint32_t)res : 0x1000;
+    }
+
+    return page_size;
+}
+
+bool __cyclic_buffer_map_mirrored(cyclic_buffer_t *buf, bool keep_fd)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint8_t *base = MAP_FAILED;
+    bool result = false;
+    int fd;
+
+    // both halves must start on a page boundary
+    if ((page_size <= 0) || (buf->total_size % page_size) != 0) {
+        fprintf(stderr, "ERROR: cyclic_buffer_init: size %d is not a multiple of page size %ld\n",
+            buf->total_size, page_size);
+        return false;
+    }
+
+    if ((fd = memfd_create("cyclic_buffer", MFD_CLOEXEC)) == -1) {
+        perror("ERROR: cyclic_buffer_init: memfd_create");
+        return false;
+    }
+
+    for (;;) {
+        if (ftruncate(fd, buf->total_size) != 0)
+            { perror("ERROR: cyclic_buffer_init: ftruncate"); break; }
+
+        // reserve address space for both halves
+        base = mmap(NULL, (size_t)buf->total_size * 2, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            { perror("ERROR: cyclic_buffer_init: mmap"); break; }
+
+        // map the same file pages over both halves
+        if ((mmap(base, buf->total_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+            || (mmap(base + buf->total_size, buf->total_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+            { perror("ERROR: cyclic_buffer_init: mmap(MAP_FIXED)"); break; }
+
+        // all done
+        buf->data_ptr = base;
+        result = true;
+        break;
+    }
+
+    // the mappings keep the memory alive, fd is needed for splice() only
+    if (result && keep_fd) {
+        buf->memfd = fd;
+    } else {
+        close(fd);
+    }
+
+    if (!result && (base != MAP_FAILED)) {
+        munmap(base, (size_t)buf->total_size * 2);
+    }
+
+    return result;
+}
 
 bool cyclic_buffer_init(cyclic_buffer_t *buf, int chunks)
+{
+    return cyclic_buffer_init_with_flags(buf, chunks, 0);
+}
+
+bool cyclic_buffer_init_with_flags(cyclic_buffer_t *buf, int chunks, uint32_t flags)
 {
     memset(buf, 0, sizeof(cyclic_buffer_t));
 
@@ -10,6 +87,12 @@ bool cyclic_buffer_init(cyclic_buffer_t *buf, int chunks)
         return false;
     }
 
+    // these have their own init functions
+    if (flags & (CYCLIC_BUFFER_FLAG_EXTERNAL | CYCLIC_BUFFER_FLAG_ELASTIC)) {
+        fprintf(stderr, "ERROR: cyclic_buffer_init: unexpected flags = 0x%x\n", flags);
+        return false;
+    }
+
     buf->total_size = CYCLIC_BUFFER_CHUNK_SIZE * chunks;
 
     if (buf->total_size > CYCLIC_BUFFER_MAX_SIZE) {
@@ -18,55 +101,325 @@ bool cyclic_buffer_init(cyclic_buffer_t *buf, int chunks)
         return false;
     }
 
-    if (!(buf->data_ptr = malloc(buf->total_size))) {
+    if (flags & CYCLIC_BUFFER_FLAG_SPLICE) {
+        flags |= CYCLIC_BUFFER_FLAG_MIRRORED;
+    }
+
+    if (flags & CYCLIC_BUFFER_FLAG_MIRRORED) {
+        if (!__cyclic_buffer_map_mirrored(buf, flags & CYCLIC_BUFFER_FLAG_SPLICE)) {
+            return false;
+        }
+    } else if (!(buf->data_ptr = malloc(buf->total_size))) {
         perror("ERROR: cyclic_buffer_init: malloc");
         return false;
     }
 
+    buf->flags = flags;
+    buf->available_to_write = buf->total_size;
+
+    return true;
+}
+
+bool cyclic_buffer_init_elastic(cyclic_buffer_t *buf, int chunks, int max_chunks)
+{
+    memset(buf, 0, sizeof(cyclic_buffer_t));
+
+    if ((chunks <= 0) || (max_chunks < chunks)
+        || ((uint64_t)CYCLIC_BUFFER_CHUNK_SIZE * max_chunks > CYCLIC_BUFFER_MAX_SIZE)) {
+        fprintf(stderr, "ERROR: cyclic_buffer_init: invalid chunks = %d (max: %d)\n",
+            chunks, max_chunks);
+        return false;
+    }
+
+    buf->min_size = buf->total_size = CYCLIC_BUFFER_CHUNK_SIZE * chunks;
+    buf->max_size = CYCLIC_BUFFER_CHUNK_SIZE * max_chunks;
+
+    // no memory is committed until it is written
+    buf->data_ptr = mmap(NULL, buf->max_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buf->data_ptr == MAP_FAILED) {
+        perror("ERROR: cyclic_buffer_init: mmap");
+        buf->data_ptr = NULL;
+        return false;
+    }
+
+    buf->flags = CYCLIC_BUFFER_FLAG_ELASTIC;
     buf->available_to_write = buf->total_size;
+    buf->pages_released = true;             // no pages taken yet
+
+    return true;
+}
+
+bool cyclic_buffer_grow(cyclic_buffer_t *buf)
+{
+    if (!(buf->flags & CYCLIC_BUFFER_FLAG_ELASTIC) || (buf->total_size >= buf->max_size))
+        { return false; }
+
+    if (++(buf->full_hits) < CYCLIC_BUFFER_GROW_AFTER)
+        { return false; }
+
+    uint32_t size = MIN((uint64_t)buf->total_size * 2, buf->max_size);
+    uint32_t readable = atomic_load_explicit(&(buf->available_to_read), memory_order_acquire);
+    uint32_t used = buf->total_size
+        - atomic_load_explicit(&(buf->available_to_write), memory_order_acquire);
+
+    // wrapped data: its head goes right after the old end
+    if (buf->read_idx + used > buf->total_size) {
+        if (buf->write_idx > size - buf->total_size)
+            { return false; }
+        memcpy(buf->data_ptr + buf->total_size, buf->data_ptr, buf->write_idx);
+    }
+
+    buf->recode_idx = (buf->read_idx + readable) % size;
+    buf->write_idx = (buf->read_idx + used) % size;
+    atomic_fetch_add_explicit(&(buf->available_to_write), size - buf->total_size, memory_order_release);
+    buf->total_size = size;
+    buf->full_hits = 0;
+
+    return true;
+}
+
+bool cyclic_buffer_release_idle(cyclic_buffer_t *buf)
+{
+    if (!(buf->flags & CYCLIC_BUFFER_FLAG_ELASTIC))
+        { return false; }
+
+    bool empty = (atomic_load_explicit(&(buf->available_to_write), memory_order_acquire)
+        == buf->total_size);
+    bool written = (buf->written != buf->idle_mark);
+
+    buf->idle_mark = buf->written;
+
+    // written since the previous call (or not empty): check next time
+    if (written) {
+        buf->pages_released = false;
+        return false;
+    }
+    if (!empty || buf->pages_released)
+        { return false; }
+
+    madvise(buf->data_ptr, buf->max_size, MADV_DONTNEED);
+    cyclic_buffer_reset(buf);
+    buf->pages_released = true;
+    return true;
+}
+
+bool cyclic_buffer_init_with_memory(cyclic_buffer_t *buf, uint32_t size, uint8_t *mem)
+{
+    memset(buf, 0, sizeof(cyclic_buffer_t));
+
+    if ((size == 0) || (size > CYCLIC_BUFFER_MAX_SIZE)) {
+        fprintf(stderr, "ERROR: cyclic_buffer_init: invalid size = %u\n", size);
+        return false;
+    }
+
+    buf->data_ptr = mem;
+    buf->total_size = size;
+    buf->flags = CYCLIC_BUFFER_FLAG_EXTERNAL;
+    buf->available_to_write = buf->total_size;
+
+    return true;
+}
+
+void cyclic_buffer_place(cyclic_buffer_t *buf, int numa_node, bool transparent_huge_pages)
+{
+    size_t size;
+
+    if (buf->flags & CYCLIC_BUFFER_FLAG_ELASTIC) {
+        size = buf->max_size;
+    } else if (buf->flags & CYCLIC_BUFFER_FLAG_MIRRORED) {
+        size = (size_t)buf->total_size * 2;
+        transparent_huge_pages = false;
+    } else {
+        return;
+    }
+
+    if ((numa_node != -1) && !cpu_numa_prefer_node(buf->data_ptr, size, numa_node))
+        { perror("cyclic_buffer_place: mbind"); }
+
+    if (transparent_huge_pages && (size >= CYCLIC_BUFFER_HUGE_PAGE_SIZE)
+        && (madvise(buf->data_ptr, size, MADV_HUGEPAGE) == -1)) {
+        perror("cyclic_buffer_place: madvise(MADV_HUGEPAGE)");
+    }
+}
+
+void cyclic_buffer_reset(cyclic_buffer_t *buf)
+{
+    buf->read_idx = buf->write_idx = buf->recode_idx = 0;
+    buf->available_to_read = buf->available_to_recode = 0;
+
+    if (buf->flags & CYCLIC_BUFFER_FLAG_ELASTIC) {
+        if (buf->total_size > buf->min_size) {
+            madvise(buf->data_ptr + buf->min_size, buf->max_size - buf->min_size, MADV_DONTNEED);
+        }
+        buf->total_size = buf->min_size;
+        buf->full_hits = 0;
+    }
+
+    buf->available_to_write = buf->total_size;
+}
+
+bool cyclic_buffer_transfer(cyclic_buffer_t *dest, cyclic_buffer_t *src)
+{
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+    uint32_t readable = atomic_load_explicit(&(src->available_to_read), memory_order_acquire);
+    uint32_t recodable = atomic_load_explicit(&(src->available_to_recode), memory_order_acquire);
+    int iovcnt;
+
+    if ((uint64_t)readable + recodable > atomic_load_explicit(&(dest->available_to_write), memory_order_acquire)) {
+        fprintf(stderr, "ERROR: cyclic_buffer_transfer: %u bytes do not fit\n", readable + recodable);
+        return false;
+    }
+
+    // readable part is passed on as is
+    iovcnt = cyclic_buffer_read_reserve(src, iov, UINT32_MAX);
+    for (int i = 0; i < iovcnt; ++i) {
+        cyclic_buffer_write(dest, iov[i].iov_base, iov[i].iov_len);
+    }
+    cyclic_buffer_recode_none(dest);
+
+    // the rest waits for recode
+    iovcnt = cyclic_buffer_recode_reserve(src, iov, UINT32_MAX);
+    for (int i = 0; i < iovcnt; ++i) {
+        cyclic_buffer_write(dest, iov[i].iov_base, iov[i].iov_len);
+    }
 
     return true;
 }
 
 void cyclic_buffer_destroy(cyclic_buffer_t *buf)
 {
-    if (buf->data_ptr) { free(buf->data_ptr); }
+    if (buf->data_ptr && !(buf->flags & CYCLIC_BUFFER_FLAG_EXTERNAL)) {
+        if (buf->flags & CYCLIC_BUFFER_FLAG_ELASTIC) {
+            munmap(buf->data_ptr, buf->max_size);
+        } else if (buf->flags & CYCLIC_BUFFER_FLAG_MIRRORED) {
+            munmap(buf->data_ptr, (size_t)buf->total_size * 2);
+            if (buf->flags & CYCLIC_BUFFER_FLAG_SPLICE) {
+                close(buf->memfd);
+            }
+        } else {
+            free(buf->data_ptr);
+        }
+    }
 
     memset(buf, 0, sizeof(cyclic_buffer_t));
 }
 
-uint32_t cyclic_buffer_read(cyclic_buffer_t *buf, uint8_t *dest, uint32_t max)
+int __cyclic_buffer_region(cyclic_buffer_t *buf, uint32_t idx, uint32_t size, struct iovec *iov)
+{
+    uint32_t size_till_end = buf->total_size - idx;
+
+    iov[0].iov_base = buf->data_ptr + idx;
+
+    // split the region in two when it wraps around the end (unless mirrored)
+    if ((size > size_till_end) && !(buf->flags & CYCLIC_BUFFER_FLAG_MIRRORED)) {
+        iov[0].iov_len = size_till_end;
+        iov[1].iov_base = buf->data_ptr;
+        iov[1].iov_len = size - size_till_end;
+        return 2;
+    }
+
+    iov[0].iov_len = size;
+    return 1;
+}
+
+int cyclic_buffer_read_reserve(cyclic_buffer_t *buf, struct iovec *iov, uint32_t max)
 {
     // get readable size (synchronized)
     uint32_t available_to_read = atomic_load_explicit(
         &(buf->available_to_read), memory_order_acquire);
 
     // do nothing when buffer is empty
-    if (available_to_read == 0) { return 0; }
+    if ((available_to_read == 0) || (max == 0)) { return 0; }
+
+    // expose not more than requested (max size)
+    return __cyclic_buffer_region(buf, buf->read_idx, MIN(available_to_read, max), iov);
+}
 
-    // read not more than requested (max size)
-    uint32_t size = MIN(available_to_read, max);
+void cyclic_buffer_read_commit(cyclic_buffer_t *buf, uint32_t size)
+{
+    // advance (size must not exceed the previously reserved region)
+    buf->read_idx = (buf->read_idx + size) % buf->total_size;
+    atomic_fetch_add_explicit(&(buf->available_to_write), size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&(buf->available_to_read), size, memory_order_relaxed);
+}
+
+ssize_t cyclic_buffer_splice_read(cyclic_buffer_t *buf, int pipe_fd, uint32_t max)
+{
+    uint32_t page_mask = cyclic_buffer_page_size() - 1;
+
+    // get readable size (synchronized)
+    uint32_t available_to_read = atomic_load_explicit(
+        &(buf->available_to_read), memory_order_acquire);
+
+    // whole pages from a page aligned read position only (up to the end of the file)
+    uint32_t size = MIN(MIN(available_to_read, max), buf->total_size - buf->read_idx);
+    size &= ~page_mask;
+
+    if ((buf->read_idx & page_mask) || (size == 0))
+        { return 0; }
+
+    loff_t offset = buf->read_idx;
+    return splice(buf->memfd, &offset, pipe_fd, NULL, size, SPLICE_F_NONBLOCK);
+}
+
+void cyclic_buffer_splice_commit(cyclic_buffer_t *buf, uint32_t size)
+{
+    uint32_t size_till_end = buf->total_size - buf->read_idx;
+
+    // detach spliced pages: the writer must not touch pages still referenced by
+    // the pipe or socket (e.g. queued for retransmission), it faults in new ones
+    if (fallocate(buf->memfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            buf->read_idx, MIN(size, size_till_end)) != 0
+        || ((size > size_till_end) && fallocate(buf->memfd,
+            FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, size - size_till_end) != 0)) {
+        perror("ERROR: cyclic_buffer_splice_commit: fallocate");
+    }
+
+    cyclic_buffer_read_commit(buf, size);
+}
+
+int cyclic_buffer_write_reserve(cyclic_buffer_t *buf, struct iovec *iov, uint32_t max)
+{
+    // get writeable size (synchronized)
+    uint32_t available_to_write = atomic_load_explicit(
+        &(buf->available_to_write), memory_order_relaxed);
+
+    // do nothing when buffer is full
+    if ((available_to_write == 0) || (max == 0)) { return 0; }
+
+    // expose not more than requested (max size)
+    return __cyclic_buffer_region(buf, buf->write_idx, MIN(available_to_write, max), iov);
+}
+
+void cyclic_buffer_write_commit(cyclic_buffer_t *buf, uint32_t size)
+{
+    // advance (size must not exceed the previously reserved region)
+    buf->write_idx = (buf->write_idx + size) % buf->total_size;
+    buf->written += size;
+    atomic_fetch_add_explicit(&(buf->available_to_recode), size, memory_order_release);
+    atomic_fetch_sub_explicit(&(buf->available_to_write), size, memory_order_relaxed);
+}
+
+uint32_t cyclic_buffer_read(cyclic_buffer_t *buf, uint8_t *dest, uint32_t max)
+{
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+    uint32_t size = 0;
+
+    // get readable region(s), do nothing when buffer is empty
+    int iovcnt = cyclic_buffer_read_reserve(buf, iov, max);
+    if (iovcnt == 0) { return 0; }
 
     // do read
-    uint32_t next_read_idx = buf->read_idx + size;
-    if (next_read_idx > buf->total_size) {
-        uint32_t size_till_end = buf->total_size - buf->read_idx;
-        next_read_idx = size - size_till_end;
-        if (dest) {
-            memcpy(dest, buf->data_ptr + buf->read_idx, size_till_end);
-            memcpy(dest + size_till_end, buf->data_ptr, next_read_idx);
-        }
-    } else {
+    for (int i = 0; i < iovcnt; ++i) {
         if (dest) {
-            memcpy(dest, buf->data_ptr + buf->read_idx, size);
+            memcpy(dest + size, iov[i].iov_base, iov[i].iov_len);
         }
-        next_read_idx %= buf->total_size;
+        size += iov[i].iov_len;
     }
 
     // advance
-    buf->read_idx = next_read_idx;
-    atomic_fetch_add_explicit(&(buf->available_to_write), size, memory_order_relaxed);
-    atomic_fetch_sub_explicit(&(buf->available_to_read), size, memory_order_relaxed);
+    cyclic_buffer_read_commit(buf, size);
 
     // return size of read data
     return size;
@@ -74,36 +427,23 @@ uint32_t cyclic_buffer_read(cyclic_buffer_t *buf, uint8_t *dest, uint32_t max)
 
 uint32_t cyclic_buffer_write(cyclic_buffer_t *buf, uint8_t *src, uint32_t max)
 {
-    // get writeable size (synchronized)
-    uint32_t available_to_write = atomic_load_explicit(
-        &(buf->available_to_write), memory_order_relaxed);
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+    uint32_t size = 0;
 
-    // do nothing when buffer is full
-    if (available_to_write == 0) { return 0; }
-
-    // write not more than requested (max size)
-    uint32_t size = MIN(available_to_write, max);
+    // get writeable region(s), do nothing when buffer is full
+    int iovcnt = cyclic_buffer_write_reserve(buf, iov, max);
+    if (iovcnt == 0) { return 0; }
 
     // do write
-    uint32_t next_write_idx = buf->write_idx + size;
-    if (next_write_idx > buf->total_size) {
-        uint32_t size_till_end = buf->total_size - buf->write_idx;
-        next_write_idx = size - size_till_end;
-        if (src) {
-            memcpy(buf->data_ptr + buf->write_idx, src, size_till_end);
-            memcpy(buf->data_ptr, src + size_till_end, next_write_idx);
-        }
-    } else {
+    for (int i = 0; i < iovcnt; ++i) {
         if (src) {
-            memcpy(buf->data_ptr + buf->write_idx, src, size);
+            memcpy(iov[i].iov_base, src + size, iov[i].iov_len);
         }
-        next_write_idx %= buf->total_size;
+        size += iov[i].iov_len;
     }
 
     // advance
-    buf->write_idx = next_write_idx;
-    atomic_fetch_add_explicit(&(buf->available_to_recode), size, memory_order_release);
-    atomic_fetch_sub_explicit(&(buf->available_to_write), size, memory_order_relaxed);
+    cyclic_buffer_write_commit(buf, size);
 
     // return size of written data
     return size;
@@ -133,7 +473,7 @@ uint32_t cyclic_buffer_recode_xor(cyclic_buffer_t *buf, uint8_t *mask, uint32_t
 
     // do recode (XOR with given mask)
     uint32_t next_recode_idx = buf->recode_idx + size;
-    if (next_recode_idx > buf->total_size) {
+    if ((next_recode_idx > buf->total_size) && !(buf->flags & CYCLIC_BUFFER_FLAG_MIRRORED)) {
         uint32_t size_till_end = buf->total_size - buf->recode_idx;
         next_recode_idx = size - size_till_end;
         if (mask) {
@@ -177,7 +517,8 @@ uint32_t cyclic_buffer_recode_xor_buf(cyclic_buffer_t *buf, cyclic_buffer_t *mas
 
     // do recode (XOR with given mask)
     uint32_t next_mask_read_idx = mask_buf->read_idx + size;
-    if (next_mask_read_idx > mask_buf->total_size) {
+    if ((next_mask_read_idx > mask_buf->total_size)
+        && !(mask_buf->flags & CYCLIC_BUFFER_FLAG_MIRRORED)) {
         uint32_t size_till_end = mask_buf->total_size - mask_buf->read_idx;
         next_mask_read_idx = size - size_till_end;
         cyclic_buffer_recode_xor(buf, mask_buf->data_ptr + mask_buf->read_idx, size_till_end);
@@ -196,3 +537,46 @@ uint32_t cyclic_buffer_recode_xor_buf(cyclic_buffer_t *buf, cyclic_buffer_t *mas
     return size;
 }
 
+
+int cyclic_buffer_recode_reserve(cyclic_buffer_t *buf, struct iovec *iov, uint32_t max)
+{
+    // get recodeable size (synchronized)
+    uint32_t available_to_recode = atomic_load_explicit(
+        &(buf->available_to_recode), memory_order_acquire);
+
+    // do nothing when buffer has no data to be recoded
+    if ((available_to_recode == 0) || (max == 0)) { return 0; }
+
+    // expose not more than requested (max size)
+    return __cyclic_buffer_region(buf, buf->recode_idx, MIN(available_to_recode, max), iov);
+}
+
+void cyclic_buffer_recode_commit(cyclic_buffer_t *buf, uint32_t size)
+{
+    // advance (size must not exceed the previously reserved region)
+    buf->recode_idx = (buf->recode_idx + size) % buf->total_size;
+    atomic_fetch_add_explicit(&(buf->available_to_read), size, memory_order_release);
+    atomic_fetch_sub_explicit(&(buf->available_to_recode), size, memory_order_relaxed);
+}
+
+uint32_t cyclic_buffer_recode_keystream(cyclic_buffer_t *buf, keystream_t *ks, uint32_t max)
+{
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+    uint32_t size = 0;
+
+    // get recodeable region(s), do nothing when there is no data to be recoded
+    int iovcnt = cyclic_buffer_recode_reserve(buf, iov, max);
+
+    // do recode (generate keystream and XOR it in place, region by region)
+    for (int i = 0; i < iovcnt; ++i) {
+        ks->xor_func(ks, iov[i].iov_base, iov[i].iov_len);
+        size += iov[i].iov_len;
+    }
+
+    if (size > 0) {
+        cyclic_buffer_recode_commit(buf, size);
+    }
+
+    // return size of recoded data
+    return size;
+}
@@ -9,28 +9,122 @@
 # define CYCLIC_BUFFER_MAX_SIZE 0x40000000
 #endif
 
+// elastic rings double after this many writer hits on a full ring
+#ifndef CYCLIC_BUFFER_GROW_AFTER
+# define CYCLIC_BUFFER_GROW_AFTER 4
+#endif
+
+// transparent hugepages are asked for ranges of at least this size
+#ifndef CYCLIC_BUFFER_HUGE_PAGE_SIZE
+# define CYCLIC_BUFFER_HUGE_PAGE_SIZE 0x200000
+#endif
+
+#ifndef CYCLIC_BUFFER_IOV_MAX
+# define CYCLIC_BUFFER_IOV_MAX 2
+#endif
+
+// map the same pages twice back to back (any region is contiguous)
+#define CYCLIC_BUFFER_FLAG_MIRRORED 0x1
+
+// keep the backing memfd open to splice() whole pages out (implies MIRRORED)
+#define CYCLIC_BUFFER_FLAG_SPLICE 0x2
+
+// data memory is owned by the caller (cyclic_buffer_init_with_memory)
+#define CYCLIC_BUFFER_FLAG_EXTERNAL 0x4
+
+// address space for the max size is reserved, pages are taken on first touch
+// (cyclic_buffer_init_elastic)
+#define CYCLIC_BUFFER_FLAG_ELASTIC 0x8
+
 #if (CYCLIC_BUFFER_CHUNK_SIZE <= 0) || ((CYCLIC_BUFFER_CHUNK_SIZE & 0xFFF) != 0)
 # error "CYCLIC_BUFFER_CHUNK_SIZE is not a positive integer multiple of 4096 (4 KiB)"
 #endif
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "keystream.h"
+
 
 typedef struct __cyclic_buffer {
     uint8_t* data_ptr;
     uint32_t total_size;
+    uint32_t flags;
+    int memfd;                          // CYCLIC_BUFFER_FLAG_SPLICE only
     uint32_t read_idx;
     uint32_t write_idx;
     uint32_t recode_idx;
+    uint32_t min_size;                  // CYCLIC_BUFFER_FLAG_ELASTIC only
+    uint32_t max_size;
+    uint32_t full_hits;                 // writer found the ring full (since resized)
+    uint32_t written;                   // bytes written by the writer (wraps around)
+    uint32_t idle_mark;                 // written at the previous release_idle
+    bool pages_released;                // nothing written since (no pages taken)
     _Atomic uint32_t available_to_read;
     _Atomic uint32_t available_to_write;
     _Atomic uint32_t available_to_recode;
 } cyclic_buffer_t;
 
 extern bool cyclic_buffer_init(cyclic_buffer_t *buf, int chunks);
+extern bool cyclic_buffer_init_with_flags(cyclic_buffer_t *buf, int chunks, uint32_t flags);
 extern void cyclic_buffer_destroy(cyclic_buffer_t *buf);
+
+// over caller's memory (any size), destroy leaves it alone
+extern bool cyclic_buffer_init_with_memory(cyclic_buffer_t *buf, uint32_t size, uint8_t *mem);
+
+// empty again, memory (and mappings) kept for reuse (elastic: back to the
+// initial size, pages of the grown part given back)
+extern void cyclic_buffer_reset(cyclic_buffer_t *buf);
+
+// elastic: starts at chunks, grows up to max_chunks (not mirrored);
+// grow and release_idle move data, so nothing else may use the ring meanwhile
+// (reader, recoder, I/O in flight on reserved regions): the owner calls them
+// between its own accesses
+extern bool cyclic_buffer_init_elastic(cyclic_buffer_t *buf, int chunks, int max_chunks);
+
+// the writer found the ring full: doubles it after CYCLIC_BUFFER_GROW_AFTER
+// hits (true when it has grown, more is writable then)
+extern bool cyclic_buffer_grow(cyclic_buffer_t *buf);
+
+// called periodically: an empty ring not written since the previous call
+// goes back to its initial size and gives all pages back (true when it did)
+extern bool cyclic_buffer_release_idle(cyclic_buffer_t *buf);
+
+// before first use: pages of the ring's own mapping prefer the NUMA node
+// (-1 for any) and large elastic rings ask for transparent hugepages
+// (mirrored ones stay on normal pages for splice; malloc'd and caller's
+// memory is left alone)
+extern void cyclic_buffer_place(cyclic_buffer_t *buf, int numa_node, bool transparent_huge_pages);
+
+// copies the content of src (readable and to be recoded parts) to the empty
+// dest keeping the parts apart; src itself is left untouched
+extern bool cyclic_buffer_transfer(cyclic_buffer_t *dest, cyclic_buffer_t *src);
 extern uint32_t cyclic_buffer_read(cyclic_buffer_t *buf, uint8_t *dest, uint32_t max);
 extern uint32_t cyclic_buffer_write(cyclic_buffer_t *buf, uint8_t *src, uint32_t max);
+
+// zero-copy access: reserve exposes up to CYCLIC_BUFFER_IOV_MAX regions
+// (ready for readv/writev), commit advances by the actually consumed size
+extern int cyclic_buffer_read_reserve(cyclic_buffer_t *buf, struct iovec *iov, uint32_t max);
+extern void cyclic_buffer_read_commit(cyclic_buffer_t *buf, uint32_t size);
+extern int cyclic_buffer_write_reserve(cyclic_buffer_t *buf, struct iovec *iov, uint32_t max);
+extern void cyclic_buffer_write_commit(cyclic_buffer_t *buf, uint32_t size);
+
+// zero-copy out of the kernel: whole pages from the read position are spliced
+// into a pipe, the pipe (or socket) keeps referencing them, so they are punched
+// out of the memfd on commit and the writer gets fresh pages (size must be whole
+// pages, partial pages go through read_reserve/read_commit)
+extern ssize_t cyclic_buffer_splice_read(cyclic_buffer_t *buf, int pipe_fd, uint32_t max);
+extern void cyclic_buffer_splice_commit(cyclic_buffer_t *buf, uint32_t size);
+extern uint32_t cyclic_buffer_page_size(void);
+
 extern uint32_t cyclic_buffer_recode_none(cyclic_buffer_t *buf);
 extern uint32_t cyclic_buffer_recode_xor(cyclic_buffer_t *dest, uint8_t *mask, uint32_t max);
 extern uint32_t cyclic_buffer_recode_xor_buf(cyclic_buffer_t *buf, cyclic_buffer_t *mask_buf);
+extern uint32_t cyclic_buffer_recode_keystream(cyclic_buffer_t *buf, keystream_t *ks, uint32_t max);
+
+// in-place recode by the caller (e.g. batched across buffers): reserve exposes
+// the regions to be recoded, commit passes the recoded size on to the reader
+extern int cyclic_buffer_recode_reserve(cyclic_buffer_t *buf, struct iovec *iov, uint32_t max);
+extern void cyclic_buffer_recode_commit(cyclic_buffer_t *buf, uint32_t size);
 
 #endif // __CYCLIC_BUFFER_H
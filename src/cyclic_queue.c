@@ -19,7 +19,10 @@
     atomic_store_explicit(idx_ptr, val, memory_order_release)
 
 
-bool cyclic_queue_init(cyclic_queue_t *queue, uint32_t element_size, uint32_t initial_capacity)
+bool cyclic_queue_init(
+    cyclic_queue_t *queue, uint32_t element_size, uint32_t initial_capacity,
+    cyclic_queue_mode_t mode
+)
 {
     memset(queue, 0, sizeof(cyclic_queue_t));
 
@@ -27,6 +30,15 @@ bool cyclic_queue_init(cyclic_queue_t *queue, uint32_t element_size, uint32_t in
         initial_capacity = CYCLIC_QUEUE_MIN_CAPACITY;
     }
 
+    // bounded mode: round capacity up to a power of 2 (slot = pos & mask)
+    if (mode == CYCLIC_QUEUE_BOUNDED) {
+        uint32_t capacity = 1;
+        while ((capacity < initial_capacity) && (capacity <= CYCLIC_QUEUE_MAX_CAPACITY)) {
+            capacity <<= 1;
+        }
+        initial_capacity = capacity;
+    }
+
     if (initial_capacity > CYCLIC_QUEUE_MAX_CAPACITY) {
         fprintf(stderr, "ERROR: cyclic_queue_init: exceeded max capacity: %d (max: %d)\n",
             initial_capacity, CYCLIC_QUEUE_MAX_CAPACITY);
@@ -44,9 +56,26 @@ bool cyclic_queue_init(cyclic_queue_t *queue, uint32_t element_size, uint32_t in
         return false;
     }
 
+    if (mode == CYCLIC_QUEUE_BOUNDED) {
+        if (!(queue->seq_ptr = malloc(initial_capacity * sizeof(_Atomic uint32_t)))) {
+            perror("ERROR: cyclic_queue_init: malloc");
+            free(queue->data_ptr);
+            queue->data_ptr = NULL;
+            return false;
+        }
+
+        // slot i is free for the push at position i
+        for (uint32_t i = 0; i < initial_capacity; ++i) {
+            atomic_init(&(queue->seq_ptr[i]), i);
+        }
+    }
+
+    queue->mode = mode;
     queue->element_size = element_size;
     queue->capacity = initial_capacity;
-    queue->max_capacity = CYCLIC_QUEUE_MAX_CAPACITY;
+    queue->max_capacity = (mode == CYCLIC_QUEUE_BOUNDED)
+        ? initial_capacity
+        : CYCLIC_QUEUE_MAX_CAPACITY;
 
     return true;
 }
@@ -54,36 +83,215 @@ bool cyclic_queue_init(cyclic_queue_t *queue, uint32_t element_size, uint32_t in
 void cyclic_queue_destroy(cyclic_queue_t *queue)
 {
     if (queue->data_ptr) { free(queue->data_ptr); }
+    if (queue->seq_ptr) { free(queue->seq_ptr); }
 
     memset(queue, 0, sizeof(cyclic_queue_t));
 }
 
 
-bool cyclic_queue_push(cyclic_queue_t *queue, void *element)
+//
+//  bounded mode: lock-free MPMC with per-slot sequence numbers, positions
+//  are free-running counters (wrap at 2^32, capacity is a power of 2)
+//
+
+bool __cyclic_queue_push_bounded(cyclic_queue_t *queue, void *element)
+{
+    const uint32_t mask = queue->capacity - 1;
+    uint32_t pos = atomic_load_explicit(&(queue->push_idx), memory_order_relaxed);
+    uint32_t slot;
+
+    // claim the slot at push position
+    for (;;) {
+        slot = pos & mask;
+        uint32_t seq = atomic_load_explicit(&(queue->seq_ptr[slot]), memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+
+        if (diff == 0) {
+            // slot is free: try to advance push position
+            if (atomic_compare_exchange_weak_explicit(
+                    &(queue->push_idx), &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                { break; }
+        } else if (diff < 0) {
+            // slot still holds an element of the previous lap: queue is full
+            return false;
+        } else {
+            // another producer took this position, reload
+            pos = atomic_load_explicit(&(queue->push_idx), memory_order_relaxed);
+        }
+    }
+
+    // store element and publish it to consumers
+    memcpy((uint8_t*)queue->data_ptr + slot * queue->element_size, element, queue->element_size);
+    atomic_store_explicit(&(queue->seq_ptr[slot]), pos + 1, memory_order_release);
+
+    return true;
+}
+
+bool __cyclic_queue_take_bounded(cyclic_queue_t *queue, void *element)
+{
+    const uint32_t mask = queue->capacity - 1;
+    uint32_t pos = atomic_load_explicit(&(queue->take_idx), memory_order_relaxed);
+    uint32_t slot;
+
+    // claim the slot at take position
+    for (;;) {
+        slot = pos & mask;
+        uint32_t seq = atomic_load_explicit(&(queue->seq_ptr[slot]), memory_order_acquire);
+        int32_t diff = (int32_t)(seq - (pos + 1));
+
+        if (diff == 0) {
+            // slot is published: try to advance take position
+            if (atomic_compare_exchange_weak_explicit(
+                    &(queue->take_idx), &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                { break; }
+        } else if (diff < 0) {
+            // slot is not published yet: queue is empty
+            return false;
+        } else {
+            // another consumer took this position, reload
+            pos = atomic_load_explicit(&(queue->take_idx), memory_order_relaxed);
+        }
+    }
+
+    // load element and release the slot for the next lap
+    memcpy(element, (uint8_t*)queue->data_ptr + slot * queue->element_size, queue->element_size);
+    atomic_store_explicit(&(queue->seq_ptr[slot]), pos + queue->capacity, memory_order_release);
+
+    return true;
+}
+
+uint32_t __cyclic_queue_push_n_bounded(cyclic_queue_t *queue, void *elements, uint32_t count)
+{
+    const uint32_t elem_size = queue->element_size;
+    const uint32_t mask = queue->capacity - 1;
+    uint32_t pos = atomic_load_explicit(&(queue->push_idx), memory_order_relaxed);
+    uint32_t n;
+
+    // claim a run of free slots starting at push position
+    for (;;) {
+        int32_t diff = 0;
+
+        for (n = 0; n < count; ++n) {
+            uint32_t seq = atomic_load_explicit(
+                &(queue->seq_ptr[(pos + n) & mask]), memory_order_acquire);
+            if ((diff = (int32_t)(seq - (pos + n))) != 0)
+                { break; }
+        }
+
+        if (n == 0) {
+            // queue is full, or another producer took this position (reload)
+            if (diff < 0)
+                { return 0; }
+            pos = atomic_load_explicit(&(queue->push_idx), memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(
+                &(queue->push_idx), &pos, pos + n,
+                memory_order_relaxed, memory_order_relaxed))
+            { break; }
+    }
+
+    // store elements (up to two copies around the wrap)
+    uint32_t slot = pos & mask;
+    uint32_t size_till_end = MIN(n, queue->capacity - slot);
+    memcpy((uint8_t*)queue->data_ptr + slot * elem_size, elements, size_till_end * elem_size);
+    if (n > size_till_end) {
+        memcpy(queue->data_ptr, (uint8_t*)elements + size_till_end * elem_size,
+            (n - size_till_end) * elem_size);
+    }
+
+    // publish them to consumers
+    for (uint32_t i = 0; i < n; ++i) {
+        atomic_store_explicit(&(queue->seq_ptr[(pos + i) & mask]), pos + i + 1,
+            memory_order_release);
+    }
+
+    return n;
+}
+
+uint32_t __cyclic_queue_take_n_bounded(cyclic_queue_t *queue, void *elements, uint32_t max)
+{
+    const uint32_t elem_size = queue->element_size;
+    const uint32_t mask = queue->capacity - 1;
+    uint32_t pos = atomic_load_explicit(&(queue->take_idx), memory_order_relaxed);
+    uint32_t n;
+
+    // claim a run of published slots starting at take position
+    for (;;) {
+        int32_t diff = 0;
+
+        for (n = 0; n < max; ++n) {
+            uint32_t seq = atomic_load_explicit(
+                &(queue->seq_ptr[(pos + n) & mask]), memory_order_acquire);
+            if ((diff = (int32_t)(seq - (pos + n + 1))) != 0)
+                { break; }
+        }
+
+        if (n == 0) {
+            // queue is empty, or another consumer took this position (reload)
+            if (diff < 0)
+                { return 0; }
+            pos = atomic_load_explicit(&(queue->take_idx), memory_order_relaxed);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(
+                &(queue->take_idx), &pos, pos + n,
+                memory_order_relaxed, memory_order_relaxed))
+            { break; }
+    }
+
+    // load elements (up to two copies around the wrap)
+    uint32_t slot = pos & mask;
+    uint32_t size_till_end = MIN(n, queue->capacity - slot);
+    memcpy(elements, (uint8_t*)queue->data_ptr + slot * elem_size, size_till_end * elem_size);
+    if (n > size_till_end) {
+        memcpy((uint8_t*)elements + size_till_end * elem_size, queue->data_ptr,
+            (n - size_till_end) * elem_size);
+    }
+
+    // release the slots for the next lap
+    for (uint32_t i = 0; i < n; ++i) {
+        atomic_store_explicit(&(queue->seq_ptr[(pos + i) & mask]), pos + i + queue->capacity,
+            memory_order_release);
+    }
+
+    return n;
+}
+
+
+//
+//  growable mode: push/take sides are serialized by locking their idx vars
+//
+
+uint32_t __cyclic_queue_push_n_growable(cyclic_queue_t *queue, void *elements, uint32_t count)
 {
     const uint32_t elem_size = queue->element_size;
     uint32_t push_idx, take_idx = UINT32_MAX, size;
-    bool result = false;
+    uint32_t result = 0;
 
     // lock queue for push op
     __LOCK_IDX(&(queue->push_idx), &push_idx);
 
     do {
-        // check queue size (is queue full?)
+        // check queue size (is there enough room?)
         size = atomic_load_explicit(&(queue->size), memory_order_relaxed);
-        if (size == queue->capacity) {
+        if (queue->capacity - size < count) {
 
-            // queue is full! lock take op and recheck queue size
+            // not enough room! lock take op and recheck queue size
             __LOCK_IDX(&(queue->take_idx), &take_idx);
             size = atomic_load_explicit(&(queue->size), memory_order_acquire);
-            if (size == queue->capacity) {
-                uint32_t new_capacity = MIN(queue->capacity * 2, queue->max_capacity);
 
-                // is max capacity reached? do exit with unsuccess status
-                if (new_capacity == queue->capacity) {
-                    break;
-                }
+            // grow (double) capacity until all elements fit (or max is reached)
+            uint32_t new_capacity = queue->capacity;
+            while ((new_capacity - size < count) && (new_capacity < queue->max_capacity)) {
+                new_capacity = MIN(new_capacity * 2, queue->max_capacity);
+            }
 
+            if (new_capacity != queue->capacity) {
                 // do custom re-alloc (alloc new region to move data into)
                 void *new_data_ptr = malloc(elem_size * new_capacity);
                 if (!new_data_ptr) {
@@ -121,17 +329,29 @@ bool cyclic_queue_push(cyclic_queue_t *queue, void *element)
                 // update push idx: now it points to the end
                 push_idx = size; // will be set later on __UNLOCK_IDX
             }
+
+            // is queue still full (max capacity is reached)? do exit with unsuccess status
+            if (size == queue->capacity) {
+                break;
+            }
         }
 
-        // push next element
-        memcpy((uint8_t*)queue->data_ptr + push_idx * elem_size, element, elem_size);
-        push_idx = (push_idx + 1) % queue->capacity;
+        // push as many elements as fit (up to two copies around the wrap)
+        uint32_t n = MIN(count, queue->capacity - size);
+        uint32_t size_till_end = MIN(n, queue->capacity - push_idx);
+        memcpy((uint8_t*)queue->data_ptr + push_idx * elem_size, elements,
+            size_till_end * elem_size);
+        if (n > size_till_end) {
+            memcpy(queue->data_ptr, (uint8_t*)elements + size_till_end * elem_size,
+                (n - size_till_end) * elem_size);
+        }
+        push_idx = (push_idx + n) % queue->capacity;
 
         // update size
-        atomic_fetch_add_explicit(&(queue->size), 1, memory_order_release);
+        atomic_fetch_add_explicit(&(queue->size), n, memory_order_release);
 
         // all done
-        result = true;
+        result = n;
     } while (false);
 
     // unlock idx vars
@@ -140,43 +360,84 @@ bool cyclic_queue_push(cyclic_queue_t *queue, void *element)
     }
     __UNLOCK_IDX(&(queue->push_idx), push_idx);
 
-    // return result
+    // return count of pushed elements
     return result;
 }
 
-bool cyclic_queue_take(cyclic_queue_t *queue, void *element)
+uint32_t __cyclic_queue_take_n_growable(cyclic_queue_t *queue, void *elements, uint32_t max)
 {
     // check queue size (is queue empty?)
     if (!atomic_load_explicit(&(queue->size), memory_order_relaxed))
-        { return false; }
+        { return 0; }
 
     const uint32_t elem_size = queue->element_size;
-    uint32_t take_idx;
-    bool result = false;
+    uint32_t take_idx, size;
+    uint32_t result = 0;
 
     // lock queue for take op
     __LOCK_IDX(&(queue->take_idx), &take_idx);
 
     do {
         // recheck queue size (after lock is acquired)
-        if (!atomic_load_explicit(&(queue->size), memory_order_relaxed))
+        if (!(size = atomic_load_explicit(&(queue->size), memory_order_acquire)))
             { break; }
 
-        // take next element
-        memcpy(element, (uint8_t*)queue->data_ptr + take_idx * elem_size, elem_size);
-        take_idx = (take_idx + 1) % queue->capacity;
+        // take as many elements as available (up to two copies around the wrap)
+        uint32_t n = MIN(max, size);
+        uint32_t size_till_end = MIN(n, queue->capacity - take_idx);
+        memcpy(elements, (uint8_t*)queue->data_ptr + take_idx * elem_size,
+            size_till_end * elem_size);
+        if (n > size_till_end) {
+            memcpy((uint8_t*)elements + size_till_end * elem_size, queue->data_ptr,
+                (n - size_till_end) * elem_size);
+        }
+        take_idx = (take_idx + n) % queue->capacity;
 
         // update size
-        atomic_fetch_sub_explicit(&(queue->size), 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&(queue->size), n, memory_order_relaxed);
 
         // all done
-        result = true;
+        result = n;
     } while (false);
 
     // unlock queue for take op
     __UNLOCK_IDX(&(queue->take_idx), take_idx);
 
-    // return result
+    // return count of taken elements
     return result;
 }
 
+
+bool cyclic_queue_push(cyclic_queue_t *queue, void *element)
+{
+    return (queue->mode == CYCLIC_QUEUE_BOUNDED)
+        ? __cyclic_queue_push_bounded(queue, element)
+        : (__cyclic_queue_push_n_growable(queue, element, 1) == 1);
+}
+
+bool cyclic_queue_take(cyclic_queue_t *queue, void *element)
+{
+    return (queue->mode == CYCLIC_QUEUE_BOUNDED)
+        ? __cyclic_queue_take_bounded(queue, element)
+        : (__cyclic_queue_take_n_growable(queue, element, 1) == 1);
+}
+
+uint32_t cyclic_queue_push_n(cyclic_queue_t *queue, void *elements, uint32_t count)
+{
+    if (count == 0)
+        { return 0; }
+
+    return (queue->mode == CYCLIC_QUEUE_BOUNDED)
+        ? __cyclic_queue_push_n_bounded(queue, elements, count)
+        : __cyclic_queue_push_n_growable(queue, elements, count);
+}
+
+uint32_t cyclic_queue_take_n(cyclic_queue_t *queue, void *elements, uint32_t max)
+{
+    if (max == 0)
+        { return 0; }
+
+    return (queue->mode == CYCLIC_QUEUE_BOUNDED)
+        ? __cyclic_queue_take_n_bounded(queue, elements, max)
+        : __cyclic_queue_take_n_growable(queue, elements, max);
+}
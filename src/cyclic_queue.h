@@ -13,19 +13,35 @@
 # define CYCLIC_QUEUE_MAX_ELEMENT_SIZE 0x400
 #endif
 
+#ifndef CYCLIC_QUEUE_CACHE_LINE_SIZE
+# define CYCLIC_QUEUE_CACHE_LINE_SIZE 64
+#endif
+
+typedef enum __cyclic_queue_mode {
+    CYCLIC_QUEUE_GROWABLE = 0,          // spin-locked, grows up to max_capacity
+    CYCLIC_QUEUE_BOUNDED,               // lock-free MPMC, fixed (power of 2) capacity
+} cyclic_queue_mode_t;
+
 typedef struct __cyclic_queue {
     void *data_ptr;
+    _Atomic uint32_t *seq_ptr;          // per-slot sequence numbers (bounded mode only)
+    cyclic_queue_mode_t mode;
     uint32_t element_size;
     uint32_t capacity;
     uint32_t max_capacity;
-    _Atomic uint32_t size;
-    _Atomic uint32_t take_idx;
-    _Atomic uint32_t push_idx;
+    _Atomic uint32_t size;              // not maintained in bounded mode
+    alignas(CYCLIC_QUEUE_CACHE_LINE_SIZE) _Atomic uint32_t take_idx;
+    alignas(CYCLIC_QUEUE_CACHE_LINE_SIZE) _Atomic uint32_t push_idx;
 } cyclic_queue_t;
 
-extern bool cyclic_queue_init(cyclic_queue_t *queue, uint32_t element_size, uint32_t initial_capacity);
+extern bool cyclic_queue_init(
+    cyclic_queue_t *queue, uint32_t element_size, uint32_t initial_capacity,
+    cyclic_queue_mode_t mode
+);
 extern void cyclic_queue_destroy(cyclic_queue_t *queue);
 extern bool cyclic_queue_push(cyclic_queue_t *queue, void *element);
 extern bool cyclic_queue_take(cyclic_queue_t *queue, void *element);
+extern uint32_t cyclic_queue_push_n(cyclic_queue_t *queue, void *elements, uint32_t count);
+extern uint32_t cyclic_queue_take_n(cyclic_queue_t *queue, void *elements, uint32_t max);
 
 #endif // __CYCLIC_QUEUE_H
@@ -1,12 +1,37 @@
 #include "common.h"
+#include "cpu_features.h"
 #include "dispatcher.h"
+#include "dispatcher_uring.h"
+#include "ec_helper.h"
 #include "session.h"
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+
+typedef enum __dispatcher_io_result {
+    DIO_NONE = 0,
+    DIO_PROGRESS,
+    DIO_ERROR,
+} dispatcher_io_result_t;
+
+static atomic_bool dispatcher_stop_requested = false;
+
+// shared by all workers: never read, so it stays readable (level-triggered)
+// and wakes up every epoll_wait() once written
+static int dispatcher_stop_fd = -1;
+static pthread_once_t dispatcher_stop_fd_once = PTHREAD_ONCE_INIT;
+
+// reload requests (SIGHUP), served by the reloader thread
+static int dispatcher_reload_fd = -1;
 
 
 bool setnonblocking(int fd) {
@@ -18,8 +43,768 @@ bool setnonblocking(int fd) {
     return true;
 }
 
+bool setnodelay(int fd) {
+    int nodelay = 1; // TRUE
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == 0;
+}
+
+bool __dispatcher_resolve(
+    cryptochan_config_sock_addr_t *conf, bool passive, struct sockaddr_in *sa
+)
+{
+    struct addrinfo hints = {0}, *res;
+
+    // resolve config hostname (usually IP)
+    hints.ai_family = AF_INET; // IPv4
+    hints.ai_socktype = SOCK_STREAM; // TCP
+    hints.ai_flags = passive ? AI_PASSIVE : 0; // server or client
+
+    int err = getaddrinfo(conf->host, NULL, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "dispatcher: could not resolve host address `%s': %s.\n",
+            conf->host, gai_strerror(err));
+        return false;
+    }
+
+    memset(sa, 0, sizeof(struct sockaddr_in));
+    sa->sin_family = AF_INET; // IPv4
+    sa->sin_port = htons(conf->port);
+    sa->sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+
+    freeaddrinfo(res);
+
+    return true;
+}
+
+
+//
+//  connections
+//
+
+void __dispatcher_connection_close(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+)
+{
+    if (conn->closed)
+        { return; }
+
+#ifdef HAVE_LIBURING
+    // in-flight operations still use the fds, they are closed on release
+    if (cntx->uring) {
+        dispatcher_uring_cancel(cntx, conn);
+    } else
+#endif
+    {
+        // closing fds removes them from the epoll set
+        if (conn->peer.fd != -1) { close(conn->peer.fd); }
+        if (conn->app.fd != -1) { close(conn->app.fd); }
+        conn->peer.fd = conn->app.fd = -1;
+    }
+
+    if (conn->established) {
+        fprintf(stderr, "dispatcher: channel with %s closed\n",
+            session_peer_name(&(conn->session)));
+    }
+
+    // move from live list to the closed one (released after event batch)
+    if (conn->prev) { conn->prev->next = conn->next; }
+    else { cntx->connections = conn->next; }
+    if (conn->next) { conn->next->prev = conn->prev; }
+
+    conn->prev = NULL;
+    conn->next = cntx->closed_connections;
+    cntx->closed_connections = conn;
+    cntx->connections_count--;
+
+    conn->closed = true;
+}
+
+// true when connections (and their descriptors) were released
+bool __dispatcher_release_closed(cryptochan_dispatcher_context_t *cntx)
+{
+    dispatcher_connection_t **link = &(cntx->closed_connections);
+    bool released = false;
+
+    while (*link) {
+        dispatcher_connection_t *conn = *link;
+
+        // still referenced by in-flight operations (io_uring)
+        if (conn->inflight > 0) {
+            link = &(conn->next);
+            continue;
+        }
+
+        *link = conn->next;
+
+        if (conn->peer.fd != -1) { close(conn->peer.fd); }
+        if (conn->app.fd != -1) { close(conn->app.fd); }
+        if (conn->app.splice_pipe[0] != -1) {
+            close(conn->app.splice_pipe[0]);
+            close(conn->app.splice_pipe[1]);
+        }
+
+        session_destroy(&(conn->session));
+        session_pool_object_put(&(cntx->session_pool), conn);
+        released = true;
+    }
+
+    return released;
+}
+
+bool __dispatcher_watch(cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep)
+{
+    struct epoll_event ev = {0};
+
+    // edge-triggered: readiness flags are kept in the endpoint
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = ep;
+
+    if (epoll_ctl(cntx->epoll_fd, EPOLL_CTL_ADD, ep->fd, &ev) != 0) {
+        perror("dispatcher: epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+bool __dispatcher_connect_target(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+)
+{
+    // target is the app for server, the cryptochan server for client
+    dispatcher_endpoint_t *ep = (cntx->role == CSR_SERVER) ? &(conn->app) : &(conn->peer);
+
+#ifdef HAVE_LIBURING
+    if (cntx->uring) {
+        return dispatcher_uring_connect_target(cntx, conn, ep);
+    }
+#endif
+
+    ep->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ep->fd == -1) {
+        perror("dispatcher: socket");
+        return false;
+    }
+
+    setnodelay(ep->fd);
+
+    if (connect(ep->fd, (struct sockaddr*) &(cntx->target_addr),
+            sizeof(struct sockaddr_in)) == 0) {
+        // connected immediately (e.g. loopback)
+        ep->readable = ep->writable = true;
+        session_connected(&(conn->session));
+    } else if (errno == EINPROGRESS) {
+        // wait for EPOLLOUT
+        conn->connecting = true;
+    } else {
+        perror("dispatcher: connect");
+        return false;
+    }
+
+    return __dispatcher_watch(cntx, ep);
+}
+
+dispatcher_connection_t *__dispatcher_connection_new(
+    cryptochan_dispatcher_context_t *cntx, int fd
+)
+{
+    dispatcher_connection_t *conn = session_pool_object_get(&(cntx->session_pool));
+    if (!conn) {
+        close(fd);
+        return NULL;
+    }
+
+    if (!session_init(&(conn->session), cntx->role, cntx->config, cntx->client_set,
+            &(cntx->session_pool))) {
+        session_pool_object_put(&(cntx->session_pool), conn);
+        close(fd);
+        return NULL;
+    }
+    conn->session.recode_batch = &(cntx->recode_batch);
+
+    conn->peer.conn = conn->app.conn = conn;
+    conn->peer.fd = conn->app.fd = -1;
+    conn->peer.pending_bid = conn->app.pending_bid = -1;
+    conn->peer.splice_pipe[0] = conn->peer.splice_pipe[1] = -1;
+    conn->app.splice_pipe[0] = conn->app.splice_pipe[1] = -1;
+
+    // decoded data goes to the app through a pipe (falls back to copying)
+    if (cntx->splice && (pipe2(conn->app.splice_pipe, O_NONBLOCK | O_CLOEXEC) != 0)) {
+        perror("dispatcher: pipe2");
+        conn->app.splice_pipe[0] = conn->app.splice_pipe[1] = -1;
+    }
+    conn->session.splice_input = (conn->app.splice_pipe[0] != -1);
+
+    // accepted socket is the peer for server, the app for client
+    dispatcher_endpoint_t *ep = (cntx->role == CSR_SERVER) ? &(conn->peer) : &(conn->app);
+    ep->fd = fd;
+    ep->readable = ep->writable = true; // try I/O until EAGAIN
+
+    setnodelay(fd);
+
+    // link to the live list
+    conn->next = cntx->connections;
+    if (conn->next) { conn->next->prev = conn; }
+    cntx->connections = conn;
+    cntx->connections_count++;
+
+    return conn;
+}
+
+dispatcher_connection_t *__dispatcher_connection_open(
+    cryptochan_dispatcher_context_t *cntx, int fd
+)
+{
+    // takes ownership of fd (closed on failure)
+    dispatcher_connection_t *conn = __dispatcher_connection_new(cntx, fd);
+    if (!conn)
+        { return NULL; }
+
+    dispatcher_endpoint_t *ep = (cntx->role == CSR_SERVER) ? &(conn->peer) : &(conn->app);
+
+    if (!__dispatcher_watch(cntx, ep)) {
+        __dispatcher_connection_close(cntx, conn);
+        return NULL;
+    }
+
+    // client connects to server right away, server connects to app once channelling
+    if ((cntx->role == CSR_CLIENT) && !__dispatcher_connect_target(cntx, conn)) {
+        __dispatcher_connection_close(cntx, conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+
+//
+//  data pumping
+//
+
+dispatcher_io_result_t __dispatcher_recv(dispatcher_endpoint_t *ep, cyclic_buffer_t *buf)
+{
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+
+    if ((ep->fd == -1) || !ep->readable || ep->eof)
+        { return DIO_NONE; }
+
+    // nothing to do when buffer is full and cannot grow (readable flag is kept)
+    int iovcnt = cyclic_buffer_write_reserve(buf, iov, UINT32_MAX);
+    if ((iovcnt == 0) && cyclic_buffer_grow(buf)) {
+        iovcnt = cyclic_buffer_write_reserve(buf, iov, UINT32_MAX);
+    }
+    if (iovcnt == 0)
+        { return DIO_NONE; }
+
+    ssize_t n = readv(ep->fd, iov, iovcnt);
+    if (n > 0) {
+        cyclic_buffer_write_commit(buf, n);
+        return DIO_PROGRESS;
+    }
+
+    if (n == 0) {
+        ep->eof = true;
+        return DIO_PROGRESS;
+    }
+
+    switch (errno) {
+        case EAGAIN:
+#if (EAGAIN != EWOULDBLOCK)
+        case EWOULDBLOCK:
+#endif
+            ep->readable = false;
+            return DIO_NONE;
+        case EINTR:
+            return DIO_PROGRESS;
+        case ECONNRESET:
+            return DIO_ERROR;
+        default:
+            perror("dispatcher: readv");
+            return DIO_ERROR;
+    }
+}
+
+dispatcher_io_result_t __dispatcher_send(
+    dispatcher_endpoint_t *ep, cyclic_buffer_t *buf, uint32_t max
+)
+{
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+
+    if ((ep->fd == -1) || !ep->writable || ep->shut)
+        { return DIO_NONE; }
+
+    // nothing to do when buffer is empty
+    int iovcnt = cyclic_buffer_read_reserve(buf, iov, max);
+    if (iovcnt == 0)
+        { return DIO_NONE; }
+
+    ssize_t n = writev(ep->fd, iov, iovcnt);
+    if (n > 0) {
+        cyclic_buffer_read_commit(buf, n);
+        return DIO_PROGRESS;
+    }
+
+    switch (errno) {
+        case EAGAIN:
+#if (EAGAIN != EWOULDBLOCK)
+        case EWOULDBLOCK:
+#endif
+            ep->writable = false;
+            return DIO_NONE;
+        case EINTR:
+            return DIO_PROGRESS;
+        case EPIPE:
+        case ECONNRESET:
+            return DIO_ERROR;
+        default:
+            perror("dispatcher: writev");
+            return DIO_ERROR;
+    }
+}
+
+dispatcher_io_result_t __dispatcher_splice_send(dispatcher_endpoint_t *ep, cyclic_buffer_t *buf)
+{
+    uint32_t page_mask = cyclic_buffer_page_size() - 1;
+    ssize_t n;
+
+    if ((ep->fd == -1) || !ep->writable || ep->shut)
+        { return DIO_NONE; }
+
+    // pipe -> socket
+    if (ep->splice_in_pipe > 0) {
+        n = splice(ep->splice_pipe[0], NULL, ep->fd, NULL, ep->splice_in_pipe,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n > 0) {
+            ep->splice_in_pipe -= n;
+            ep->splice_sent += n;
+
+            // pages are given back to the ring as a whole only
+            if (ep->splice_sent & ~page_mask) {
+                cyclic_buffer_splice_commit(buf, ep->splice_sent & ~page_mask);
+                ep->splice_sent &= page_mask;
+            }
+            return DIO_PROGRESS;
+        }
+
+        switch (errno) {
+            case EAGAIN:
+                ep->writable = false;
+                return DIO_NONE;
+            case EINTR:
+                return DIO_PROGRESS;
+            case EPIPE:
+            case ECONNRESET:
+                return DIO_ERROR;
+            default:
+                perror("dispatcher: splice");
+                return DIO_ERROR;
+        }
+    }
+
+    // ring -> pipe (whole pages from a page aligned read position)
+    n = cyclic_buffer_splice_read(buf, ep->splice_pipe[1], UINT32_MAX);
+    if (n > 0) {
+        ep->splice_in_pipe = n;
+        return DIO_PROGRESS;
+    }
+    if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+        perror("dispatcher: splice");
+        return DIO_ERROR;
+    }
+
+    // partial page: copy it up to the page boundary (the rest may be spliced then)
+    uint32_t till_page_end = (page_mask + 1) - (buf->read_idx & page_mask);
+    return __dispatcher_send(ep, buf, till_page_end);
+}
+
+bool __dispatcher_buffer_drained(cyclic_buffer_t *buf)
+{
+    return !atomic_load_explicit(&(buf->available_to_recode), memory_order_relaxed)
+        && !atomic_load_explicit(&(buf->available_to_read), memory_order_relaxed);
+}
+
+bool __dispatcher_process(cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn)
+{
+    cryptochan_session_t *session = &(conn->session);
+
+    // handshake step or recode (decode input, encode output)
+    if (!session_process(session)) {
+        __dispatcher_connection_close(cntx, conn);
+        return false;
+    }
+
+    if (session_is_channelling(session) && !conn->established) {
+        conn->established = true;
+        fprintf(stderr, "dispatcher: channel with %s established\n",
+            session_peer_name(session));
+
+        // server connects to the app only for authenticated clients
+        if ((cntx->role == CSR_SERVER) && !__dispatcher_connect_target(cntx, conn)) {
+            __dispatcher_connection_close(cntx, conn);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void __dispatcher_half_close(cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn)
+{
+    cryptochan_session_t *session = &(conn->session);
+
+    // peer has gone before the channel is established
+    if (conn->peer.eof && !session_is_channelling(session)) {
+        __dispatcher_connection_close(cntx, conn);
+        return;
+    }
+
+    // propagate half-close once everything received is passed on
+    if (conn->peer.eof && !conn->app.shut && (conn->app.fd != -1) && !conn->connecting
+        && __dispatcher_buffer_drained(&(session->input_buffer))) {
+        shutdown(conn->app.fd, SHUT_WR);
+        conn->app.shut = true;
+    }
+    if (conn->app.eof && !conn->peer.shut
+        && __dispatcher_buffer_drained(&(session->output_buffer))) {
+        shutdown(conn->peer.fd, SHUT_WR);
+        conn->peer.shut = true;
+    }
+
+    // both directions are done
+    if (conn->peer.shut && conn->app.shut) {
+        __dispatcher_connection_close(cntx, conn);
+    }
+}
+
+void __dispatcher_pump(cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn)
+{
+    cryptochan_session_t *session = &(conn->session);
+    dispatcher_io_result_t res[4];
+    bool progress;
+
+    do {
+        // peer -> input buffer, app -> output buffer (plain data once channelling only)
+        res[0] = __dispatcher_recv(&(conn->peer), &(session->input_buffer));
+        res[1] = session_is_channelling(session)
+            ? __dispatcher_recv(&(conn->app), &(session->output_buffer))
+            : DIO_NONE;
+
+        if (!__dispatcher_process(cntx, conn))
+            { return; }
+
+        // input buffer -> app, output buffer -> peer
+        res[2] = (!session_is_channelling(session) || conn->connecting)
+            ? DIO_NONE
+            : (conn->app.splice_pipe[0] != -1)
+            ? __dispatcher_splice_send(&(conn->app), &(session->input_buffer))
+            : __dispatcher_send(&(conn->app), &(session->input_buffer), UINT32_MAX);
+        res[3] = conn->connecting && (cntx->role == CSR_CLIENT)
+            ? DIO_NONE
+            : __dispatcher_send(&(conn->peer), &(session->output_buffer), UINT32_MAX);
+
+        progress = false;
+        for (int i = 0; i < sizeof(res) / sizeof(res[0]); ++i) {
+            if (res[i] == DIO_ERROR) {
+                __dispatcher_connection_close(cntx, conn);
+                return;
+            }
+            progress |= (res[i] == DIO_PROGRESS);
+        }
+    } while (progress);
+
+    __dispatcher_half_close(cntx, conn);
+}
+
+void __dispatcher_recode_batch(cryptochan_dispatcher_context_t *cntx)
+{
+    cryptochan_session_t *recoded[SESSION_RECODE_BATCH_MAX];
+
+    // pumping may queue more recode (new data has arrived meanwhile)
+    while (cntx->recode_batch.count > 0) {
+        int n = session_recode_batch_run(&(cntx->recode_batch), recoded);
+
+        for (int i = 0; i < n; ++i) {
+            dispatcher_connection_t *conn = (dispatcher_connection_t*)
+                ((uint8_t*)recoded[i] - offsetof(dispatcher_connection_t, session));
+
+            if (conn->closed)
+                { continue; }
+
+#ifdef HAVE_LIBURING
+            if (cntx->uring) {
+                __dispatcher_uring_pump(cntx, conn);
+                continue;
+            }
+#endif
+            __dispatcher_pump(cntx, conn);
+        }
+    }
+}
+
+
+//
+//  event handling
+//
+
+void __dispatcher_accept(cryptochan_dispatcher_context_t *cntx)
+{
+    for (;;) {
+        int fd = accept4(cntx->listen_sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd == -1) {
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+                { continue; }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                cntx->accept_pending = false;
+                break;
+            }
+
+            // connections stay queued (EMFILE, ENFILE, ENOBUFS, ENOMEM): retried
+            // once descriptors are released, logged once per shortage
+            if (!cntx->accept_pending)
+                { perror("dispatcher: accept4"); }
+            cntx->accept_pending = true;
+            break;
+        }
+
+        dispatcher_connection_t *conn = __dispatcher_connection_open(cntx, fd);
+        if (!conn)
+            { continue; }
+
+        // nothing to send before the client hello (client may be connected already)
+        __dispatcher_pump(cntx, conn);
+    }
+}
+
+void __dispatcher_handle_event(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep, uint32_t events
+)
+{
+    dispatcher_connection_t *conn = ep->conn;
+
+    // connection may be closed by an earlier event of the same batch
+    if (conn->closed)
+        { return; }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        { ep->readable = true; }
+    if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        { ep->writable = true; }
+
+    // complete connect to target
+    if (conn->connecting) {
+        dispatcher_endpoint_t *target = (cntx->role == CSR_SERVER) ? &(conn->app) : &(conn->peer);
+
+        if (ep == target) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+
+            if (!ep->writable)
+                { return; }
+
+            if (getsockopt(ep->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+                { err = errno; }
+            if (err != 0) {
+                fprintf(stderr, "dispatcher: connect: %s\n", strerror(err));
+                __dispatcher_connection_close(cntx, conn);
+                return;
+            }
+
+            conn->connecting = false;
+            session_connected(&(conn->session));
+        }
+    }
+
+    __dispatcher_pump(cntx, conn);
+}
+
+void __dispatcher_stop_fd_init(void)
+{
+    dispatcher_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (dispatcher_stop_fd == -1) {
+        perror("dispatcher: eventfd");
+    }
+}
+
+void __dispatcher_on_signal(int signum)
+{
+    dispatcher_stop();
+}
+
+void __dispatcher_on_reload_signal(int signum)
+{
+    uint64_t one = 1;
+
+    if (dispatcher_reload_fd != -1) {
+        __attribute__((unused)) ssize_t res = write(dispatcher_reload_fd, &one, sizeof(one));
+    }
+}
+
+void __dispatcher_install_signals(void)
+{
+    struct sigaction sa = {0};
+
+    // broken connections are handled by EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    // stop gracefully (no SA_RESTART: interrupt epoll_wait)
+    sa.sa_handler = __dispatcher_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // reload allowed clients
+    sa.sa_handler = __dispatcher_on_reload_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, NULL);
+}
+
+void dispatcher_stop(void)
+{
+    uint64_t one = 1;
+
+    // async-signal-safe: atomic store and write()
+    atomic_store(&dispatcher_stop_requested, true);
+    if (dispatcher_stop_fd != -1) {
+        __attribute__((unused)) ssize_t res = write(dispatcher_stop_fd, &one, sizeof(one));
+    }
+}
+
+bool dispatcher_stopping(void)
+{
+    return atomic_load(&dispatcher_stop_requested);
+}
+
+void dispatcher_check_reload(cryptochan_dispatcher_context_t *cntx)
+{
+    cryptochan_config_server_t *server = &(cntx->config->server);
+    cryptochan_config_client_set_t *old_set = cntx->client_set;
+
+    // a worker holds its set, so an unchanged pointer means an unchanged set
+    if ((cntx->role != CSR_SERVER) || (atomic_load(&(server->client_set)) == old_set))
+        { return; }
+
+    cntx->client_set = cryptochan_config_client_set_acquire(server);
+
+    for (dispatcher_connection_t *conn = cntx->connections, *next; conn; conn = next) {
+        cryptochan_session_t *session = &(conn->session);
+        next = conn->next;
+
+        if (session->client_set == cntx->client_set)
+            { continue; }
+
+        // not identified yet: continue with the new set
+        if (session->client == NULL) {
+            cryptochan_config_client_set_hold(cntx->client_set);
+            cryptochan_config_client_set_release(session->client_set);
+            session->client_set = cntx->client_set;
+            continue;
+        }
+
+        // identified: the old set lives on with the session, unless revoked
+        if (server->revoke_on_reload
+            && !cryptochan_config_find_client(cntx->client_set, session->client->fingerprint)) {
+            fprintf(stderr, "dispatcher: client `%s' revoked, closing its session\n",
+                session->client->name);
+            __dispatcher_connection_close(cntx, conn);
+        }
+    }
+
+    cryptochan_config_client_set_release(old_set);
+}
+
+bool dispatcher_run(cryptochan_dispatcher_context_t *cntx)
+{
+    struct epoll_event events[DISPATCHER_MAX_EVENTS];
+    uint64_t count;
+
+#ifdef HAVE_LIBURING
+    if (cntx->uring) {
+        return dispatcher_uring_run(cntx);
+    }
+#endif
+
+    while (!atomic_load(&dispatcher_stop_requested)) {
+        // wakes up at least for the idle sweep (or the accept retry)
+        int n = epoll_wait(cntx->epoll_fd, events, DISPATCHER_MAX_EVENTS,
+            cntx->accept_pending ? DISPATCHER_ACCEPT_RETRY_MS : DISPATCHER_IDLE_INTERVAL * 1000);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                { continue; }
+            perror("dispatcher: epoll_wait");
+            return false;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == NULL) {
+                __dispatcher_accept(cntx);
+            } else if (events[i].data.ptr == &dispatcher_stop_fd) {
+                continue; // loop condition is checked after the batch
+            } else if (events[i].data.ptr == &(cntx->reload_fd)) {
+                // drain only, the set is checked after the batch
+                __attribute__((unused)) ssize_t res = read(cntx->reload_fd, &count, sizeof(count));
+            } else {
+                __dispatcher_handle_event(cntx, events[i].data.ptr, events[i].events);
+            }
+        }
+
+        __dispatcher_recode_batch(cntx);
+        dispatcher_check_reload(cntx);
+        dispatcher_release_idle(cntx);
+        __dispatcher_release_closed(cntx);
+
+        // queued connections are not reported again (edge-triggered)
+        if (cntx->accept_pending)
+            { __dispatcher_accept(cntx); }
+    }
+
+    return true;
+}
+
+
+void dispatcher_release_idle(cryptochan_dispatcher_context_t *cntx)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (now.tv_sec - cntx->idle_sweep < DISPATCHER_IDLE_INTERVAL)
+        { return; }
+    cntx->idle_sweep = now.tv_sec;
+
+    // rings of a connection are used by its worker only (this thread)
+    for (dispatcher_connection_t *conn = cntx->connections; conn; conn = conn->next) {
+        session_release_idle(&(conn->session));
+    }
+}
+
 void dispatcher_destroy_context(cryptochan_dispatcher_context_t *cntx)
 {
+    // close and release all connections (if any)
+    while (cntx->connections) {
+        __dispatcher_connection_close(cntx, cntx->connections);
+    }
+
+#ifdef HAVE_LIBURING
+    // release io_uring instance (drops in-flight operations)
+    if (cntx->uring)
+        { dispatcher_uring_destroy(cntx); }
+#endif
+
+    __dispatcher_release_closed(cntx);
+    session_pool_destroy(&(cntx->session_pool));
+
+    // drop the client set reference (if any)
+    cryptochan_config_client_set_release(cntx->client_set);
+
+    if (cntx->reload_fd > 0)
+        { close(cntx->reload_fd); }
+
+    // close epoll instance (if any)
+    if (cntx->epoll_fd > 0)
+        { close(cntx->epoll_fd); }
+
     // close listen socket (if any)
     if (cntx->listen_sockfd > 0)
         { close(cntx->listen_sockfd); }
@@ -35,38 +820,69 @@ void dispatcher_destroy_context(cryptochan_dispatcher_context_t *cntx)
 
 bool dispatcher_init(
     cryptochan_dispatcher_context_t *cntx,
-    cryptochan_config_sock_addr_t *bind_conf
+    cryptochan_config_t *config,
+    cryptochan_session_role_t role,
+    bool reuseport
 )
 {
-    struct addrinfo hints = {0}, *res;
     struct sockaddr_in *sa_ptr;
+    struct epoll_event ev = {0};
 
-    // resolve config listen hostname (usually IP)
-    hints.ai_family = AF_INET; // IPv4
-    hints.ai_socktype = SOCK_STREAM; // TCP
-    hints.ai_flags = AI_PASSIVE; // server
+    cryptochan_config_sock_addr_t *bind_conf = (role == CSR_SERVER)
+        ? &(config->server.listen) : &(config->client.listen);
+    cryptochan_config_sock_addr_t *target_conf = (role == CSR_SERVER)
+        ? &(config->server.target) : &(config->client.target);
+    cryptochan_config_workers_t *workers_conf = (role == CSR_SERVER)
+        ? &(config->server.workers) : &(config->client.workers);
 
-    int err = getaddrinfo(bind_conf->host, NULL, &hints, &res);
-    if (err != 0) {
-        fprintf(stderr, "dispatcher: could not resolve bind host address `%s': %s.\n",
-            bind_conf->host, gai_strerror(err));
+    // setup basic context
+    memset(cntx, 0, sizeof(cryptochan_dispatcher_context_t));
+    cntx->config = config;
+    cntx->role = role;
+    cntx->listen_sockfd = cntx->epoll_fd = cntx->reload_fd = -1;
+    cntx->cpu = -1;
+
+    // arenas are mapped on the first connection (by the worker thread); with
+    // hugepages the data rings are fixed ones carved from the arenas, elastic
+    // rings have their own (normal page) mappings
+    uint32_t pool_flags = (workers_conf->huge_pages == CCHP_EXPLICIT) ? SESSION_POOL_HUGE_PAGES
+        : (workers_conf->huge_pages == CCHP_TRANSPARENT) ? SESSION_POOL_TRANSPARENT_HUGE_PAGES
+        : 0;
+    session_pool_init(&(cntx->session_pool), sizeof(dispatcher_connection_t),
+        SESSION_BUFFER_CHUNKS, pool_flags ? SESSION_BUFFER_CHUNKS : SESSION_BUFFER_MAX_CHUNKS,
+        pool_flags);
+
+    // shared stop notification (once)
+    pthread_once(&dispatcher_stop_fd_once, __dispatcher_stop_fd_init);
+    if (dispatcher_stop_fd == -1) {
+        return false;
+    }
+    cntx->stop_fd = dispatcher_stop_fd;
+
+    // current allowed clients (server role)
+    if (role == CSR_SERVER) {
+        cntx->client_set = cryptochan_config_client_set_acquire(&(config->server));
+    }
+
+    // resolve target (once)
+    if (!__dispatcher_resolve(target_conf, false, &(cntx->target_addr))) {
+        dispatcher_destroy_context(cntx);
         return false;
     }
 
     sa_ptr = malloc(sizeof(struct sockaddr_in));
     if (!sa_ptr) {
         perror("dispatcher: malloc");
+        dispatcher_destroy_context(cntx);
         return false;
     }
 
     // configure server socket to bind
-    sa_ptr->sin_family = AF_INET; // IPv4
-    sa_ptr->sin_port = htons(bind_conf->port);
-    sa_ptr->sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
-
-    // setup basic context
-    memset(cntx, 0, sizeof(cryptochan_dispatcher_context_t));
     cntx->listen_socket_ptr = (struct sockaddr*) sa_ptr;
+    if (!__dispatcher_resolve(bind_conf, true, sa_ptr)) {
+        dispatcher_destroy_context(cntx);
+        return false;
+    }
 
     bool result = false;
 
@@ -75,7 +891,7 @@ bool dispatcher_init(
         int reuseaddr = 1; // TRUE
 
         // create socket
-        cntx->listen_sockfd = socket(sa_ptr->sin_family, SOCK_STREAM, 0);
+        cntx->listen_sockfd = socket(sa_ptr->sin_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
         if (cntx->listen_sockfd == -1)
             { perror("dispatcher: socket"); break; }
 
@@ -88,11 +904,63 @@ bool dispatcher_init(
                 SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) != 0)
             { perror("dispatcher: setsockopt(SO_REUSEADDR)"); break; }
 
+        // set reuseport sock opt (every worker binds the same address)
+        if (reuseport && setsockopt(cntx->listen_sockfd,
+                SOL_SOCKET, SO_REUSEPORT, &reuseaddr, sizeof(reuseaddr)) != 0)
+            { perror("dispatcher: setsockopt(SO_REUSEPORT)"); break; }
+
         // bind address
         if (bind(cntx->listen_sockfd, cntx->listen_socket_ptr,
                 sizeof(struct sockaddr_in)) != 0)
             { perror("dispatcher: bind"); break; }
 
+        // listen for connections
+        if (listen(cntx->listen_sockfd, SOMAXCONN) != 0)
+            { perror("dispatcher: listen"); break; }
+
+        // create epoll instance
+        cntx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (cntx->epoll_fd == -1)
+            { perror("dispatcher: epoll_create1"); break; }
+
+        // watch listen socket (data.ptr = NULL)
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(cntx->epoll_fd, EPOLL_CTL_ADD, cntx->listen_sockfd, &ev) != 0)
+            { perror("dispatcher: epoll_ctl"); break; }
+
+        // watch stop notification (level-triggered)
+        ev.events = EPOLLIN;
+        ev.data.ptr = &dispatcher_stop_fd;
+        if (epoll_ctl(cntx->epoll_fd, EPOLL_CTL_ADD, dispatcher_stop_fd, &ev) != 0)
+            { perror("dispatcher: epoll_ctl"); break; }
+
+        // watch own reload notification (server role)
+        if (role == CSR_SERVER) {
+            cntx->reload_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (cntx->reload_fd == -1)
+                { perror("dispatcher: eventfd"); break; }
+
+            ev.events = EPOLLIN;
+            ev.data.ptr = &(cntx->reload_fd);
+            if (epoll_ctl(cntx->epoll_fd, EPOLL_CTL_ADD, cntx->reload_fd, &ev) != 0)
+                { perror("dispatcher: epoll_ctl"); break; }
+        }
+
+        // switch to io_uring (if requested and supported, epoll stays as a fallback)
+        if (workers_conf->io_backend == CCIB_IO_URING) {
+#ifdef HAVE_LIBURING
+            if (!dispatcher_uring_init(cntx)) {
+                fprintf(stderr, "dispatcher: io_uring is not available, using epoll\n");
+            }
+#else
+            fprintf(stderr, "dispatcher: built without io_uring support, using epoll\n");
+#endif
+        }
+
+        // splice relay is done by the epoll backend only
+        cntx->splice = workers_conf->splice && !cntx->uring;
+
         // all done
         result = true;
         break;
@@ -106,3 +974,203 @@ bool dispatcher_init(
     // return result
     return result;
 }
+
+
+//
+//  workers
+//
+
+void *__dispatcher_worker_main(void *arg)
+{
+    cryptochan_dispatcher_context_t *cntx = arg;
+
+    // pin before any connection memory is touched (keeps it local)
+    if (cntx->cpu != -1) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cntx->cpu, &cpuset);
+
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (err != 0) {
+            fprintf(stderr, "dispatcher: worker %d: could not pin to CPU %d: %s\n",
+                cntx->worker_id, cntx->cpu, strerror(err));
+        }
+    }
+
+    // memory touched by the worker from now on prefers the node of its CPU
+    // (unpinned workers move around, first touch is left to decide for them)
+    int numa_node = (cntx->cpu != -1) ? cpu_numa_node(cntx->cpu) : -1;
+
+    session_pool_set_node(&(cntx->session_pool), numa_node);
+
+#ifdef HAVE_LIBURING
+    if (cntx->uring) {
+        dispatcher_uring_place(cntx, numa_node,
+            cntx->session_pool.flags & SESSION_POOL_TRANSPARENT_HUGE_PAGES);
+    }
+#endif
+
+    // the worker's own EC context, ready before the first handshake
+    ec_context();
+
+    cntx->result = dispatcher_run(cntx);
+
+    // a failed worker stops the others
+    if (!cntx->result) {
+        dispatcher_stop();
+    }
+
+    return NULL;
+}
+
+bool dispatcher_workers_init(
+    cryptochan_dispatcher_workers_t *workers,
+    cryptochan_config_t *config,
+    cryptochan_session_role_t role
+)
+{
+    cryptochan_config_workers_t *conf = (role == CSR_SERVER)
+        ? &(config->server.workers) : &(config->client.workers);
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE], ncpus = 0;
+
+    memset(workers, 0, sizeof(cryptochan_dispatcher_workers_t));
+
+    // workers are pinned to the CPUs this process may run on (taskset, cpusets,
+    // offline CPUs make them sparse), worker N to the N-th one
+    if (conf->pin) {
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed))
+                    { cpus[ncpus++] = cpu; }
+            }
+        } else {
+            perror("dispatcher: sched_getaffinity, workers are not pinned");
+        }
+    }
+
+    workers->contexts = calloc(conf->count, sizeof(cryptochan_dispatcher_context_t));
+    if (!workers->contexts) {
+        perror("dispatcher: calloc");
+        return false;
+    }
+
+    // bind all listening sockets up front (any bind error is reported at once)
+    for (int i = 0; i < conf->count; ++i) {
+        cryptochan_dispatcher_context_t *cntx = &(workers->contexts[i]);
+
+        if (!dispatcher_init(cntx, config, role, conf->count > 1)) {
+            dispatcher_workers_destroy(workers);
+            return false;
+        }
+
+        cntx->worker_id = i;
+        if (ncpus > 0) {
+            cntx->cpu = cpus[i % ncpus];
+        }
+
+        workers->count++;
+    }
+
+    return true;
+}
+
+void *__dispatcher_reloader_main(void *arg)
+{
+    cryptochan_dispatcher_workers_t *workers = arg;
+    uint64_t count, one = 1;
+    struct pollfd fds[2] = {
+        { .fd = dispatcher_stop_fd, .events = POLLIN },
+        { .fd = dispatcher_reload_fd, .events = POLLIN },
+    };
+
+    while (!dispatcher_stopping()) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                { continue; }
+            perror("dispatcher: reloader: poll");
+            break;
+        }
+
+        if (!(fds[1].revents & POLLIN))
+            { continue; }
+
+        __attribute__((unused)) ssize_t res = read(dispatcher_reload_fd, &count, sizeof(count));
+
+        // the workers keep serving the current set meanwhile
+        if (!cryptochan_config_reload_clients(workers->contexts[0].config))
+            { continue; }
+
+        // wake idle workers to switch (and revoke)
+        for (int i = 0; i < workers->count; ++i) {
+            res = write(workers->contexts[i].reload_fd, &one, sizeof(one));
+        }
+    }
+
+    return NULL;
+}
+
+bool dispatcher_workers_run(cryptochan_dispatcher_workers_t *workers)
+{
+    bool result = true;
+    bool reloader = false;
+    int started;
+
+    // reload requests (server role)
+    if ((workers->count > 0) && (workers->contexts[0].role == CSR_SERVER)) {
+        if (dispatcher_reload_fd == -1) {
+            dispatcher_reload_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        if ((dispatcher_reload_fd == -1)
+            || (pthread_create(&(workers->reloader), NULL, __dispatcher_reloader_main, workers) != 0)) {
+            fprintf(stderr, "dispatcher: could not start reloader, SIGHUP is ignored\n");
+        } else {
+            reloader = true;
+        }
+    }
+
+    __dispatcher_install_signals();
+
+    // worker 0 runs in the calling thread
+    for (started = 1; started < workers->count; ++started) {
+        cryptochan_dispatcher_context_t *cntx = &(workers->contexts[started]);
+
+        int err = pthread_create(&(cntx->thread), NULL, __dispatcher_worker_main, cntx);
+        if (err != 0) {
+            fprintf(stderr, "dispatcher: could not start worker %d: %s\n",
+                started, strerror(err));
+            dispatcher_stop();
+            result = false;
+            break;
+        }
+    }
+
+    __dispatcher_worker_main(&(workers->contexts[0]));
+
+    // wait for the rest
+    for (int i = 1; i < started; ++i) {
+        pthread_join(workers->contexts[i].thread, NULL);
+    }
+    for (int i = 0; i < started; ++i) {
+        result &= workers->contexts[i].result;
+    }
+
+    // the stop notification ends it too
+    if (reloader) {
+        pthread_join(workers->reloader, NULL);
+    }
+
+    return result;
+}
+
+void dispatcher_workers_destroy(cryptochan_dispatcher_workers_t *workers)
+{
+    for (int i = 0; i < workers->count; ++i) {
+        dispatcher_destroy_context(&(workers->contexts[i]));
+    }
+
+    if (workers->contexts)
+        { free(workers->contexts); }
+
+    memset(workers, 0, sizeof(cryptochan_dispatcher_workers_t));
+}
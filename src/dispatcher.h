@@ -2,21 +2,137 @@
 #define __DISPATCHER_H
 
 #include "cryptochan_config.h"
+#include "session.h"
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifndef DISPATCHER_MAX_EVENTS
+# define DISPATCHER_MAX_EVENTS 256
+#endif
+
+// milliseconds between accept retries while out of descriptors or memory
+// (epoll: the listen socket is edge-triggered, queued connections are not reported
+// again; io_uring: the multishot accept ends and would fail again right away)
+#ifndef DISPATCHER_ACCEPT_RETRY_MS
+# define DISPATCHER_ACCEPT_RETRY_MS 100
+#endif
+
+// seconds between sweeps of idle rings (grown ones shrink, pages go back)
+#ifndef DISPATCHER_IDLE_INTERVAL
+# define DISPATCHER_IDLE_INTERVAL 10
+#endif
+
+struct __dispatcher_connection;
+struct __dispatcher_uring;
+
+typedef struct __dispatcher_endpoint {
+    struct __dispatcher_connection *conn;
+    int fd;
+    bool readable;                      // edge-triggered: set on event, reset on EAGAIN
+    bool writable;
+    bool eof;                           // nothing more to read
+    bool shut;                          // write side is shut down
+    // splice relay (app endpoint only)
+    int splice_pipe[2];                 // -1 = copy relay
+    uint32_t splice_in_pipe;            // spliced from the ring, not taken by the socket yet
+    uint32_t splice_sent;               // taken by the socket, less than a page (not committed)
+    // io_uring backend only
+    bool recv_armed;                    // recv (buffer select) is in flight
+    int32_t pending_bid;                // received buffer not passed to the ring yet (-1 = none)
+    uint32_t pending_offset;
+    uint32_t pending_size;
+    uint32_t send_ops;                  // linked sends in flight
+    bool starved;                       // recv waits for a free provided buffer
+    struct __dispatcher_endpoint *next_starved;
+} dispatcher_endpoint_t;
+
+typedef struct __dispatcher_connection {
+    cryptochan_session_t session;
+    dispatcher_endpoint_t peer;         // encrypted side (cryptochan peer)
+    dispatcher_endpoint_t app;          // plain side (application)
+    bool connecting;                    // connect to target is in progress
+    bool established;
+    bool closed;
+    uint32_t inflight;                  // io_uring operations referencing the connection
+    struct __dispatcher_connection *prev;
+    struct __dispatcher_connection *next;
+} dispatcher_connection_t;
 
 typedef struct __cryptochan_dispatcher_context {
     struct sockaddr *listen_socket_ptr;
     int listen_sockfd;
-
+    int epoll_fd;
+    int stop_fd;
+    int reload_fd;                                  // wakes the worker on client set reload
+    struct __dispatcher_uring *uring;               // io_uring backend (NULL = epoll)
+    bool splice;                                    // splice relay to the plain side
+    cryptochan_config_t *config;
+    cryptochan_config_client_set_t *client_set;     // referenced (server role)
+    cryptochan_session_role_t role;
+    struct sockaddr_in target_addr;
+    dispatcher_connection_t *connections;           // live ones
+    dispatcher_connection_t *closed_connections;    // released after each event batch
+    cryptochan_session_recode_batch_t recode_batch; // AES recode, run after each event batch
+    session_pool_t session_pool;                    // connections and their rings
+    time_t idle_sweep;                              // last sweep of idle rings (monotonic)
+    uint32_t connections_count;
+    bool accept_pending;                            // accept failed (EMFILE, ...), retried
+    int worker_id;
+    int cpu;                                        // pinned CPU (-1 = not pinned)
+    pthread_t thread;
+    bool result;                                    // dispatcher_run() result
 } cryptochan_dispatcher_context_t;
 
+//
+//  Workers: each one owns a SO_REUSEPORT listening socket, an epoll instance
+//  and its connections (nothing is shared, the kernel spreads accepts)
+//
+
+typedef struct __cryptochan_dispatcher_workers {
+    cryptochan_dispatcher_context_t *contexts;
+    int count;
+    pthread_t reloader;                             // SIGHUP: reloads allowed clients
+} cryptochan_dispatcher_workers_t;
+
 
 extern bool dispatcher_init(
     cryptochan_dispatcher_context_t *cntx,
-    cryptochan_config_sock_addr_t *bind_conf
+    cryptochan_config_t *config,
+    cryptochan_session_role_t role,
+    bool reuseport
+);
+
+extern bool dispatcher_run(
+    cryptochan_dispatcher_context_t *cntx
 );
 
+extern void dispatcher_stop(void);
+extern bool dispatcher_stopping(void);
+
+// server: switch to the current client set after a reload (once per event batch)
+extern void dispatcher_check_reload(cryptochan_dispatcher_context_t *cntx);
+
+// once per DISPATCHER_IDLE_INTERVAL: idle rings of all connections shrink back
+extern void dispatcher_release_idle(cryptochan_dispatcher_context_t *cntx);
+
 extern void dispatcher_destroy_context(
     cryptochan_dispatcher_context_t *cntx
 );
 
+extern bool dispatcher_workers_init(
+    cryptochan_dispatcher_workers_t *workers,
+    cryptochan_config_t *config,
+    cryptochan_session_role_t role
+);
+
+extern bool dispatcher_workers_run(
+    cryptochan_dispatcher_workers_t *workers
+);
+
+extern void dispatcher_workers_destroy(
+    cryptochan_dispatcher_workers_t *workers
+);
+
 #endif // __DISPATCHER_H
@@ -0,0 +1,661 @@
+#include "common.h"
+#include "cpu_features.h"
+#include "dispatcher.h"
+#include "dispatcher_uring.h"
+#include "session.h"
+
+#ifdef HAVE_LIBURING
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+
+//
+//  user_data: endpoint pointer (NULL for accept/stop/cancel) | operation
+//
+
+typedef enum __dispatcher_uring_op {
+    DUO_ACCEPT = 1,
+    DUO_STOP,
+    DUO_CANCEL,
+    DUO_RECV,
+    DUO_SEND,
+    DUO_CONNECT,
+    DUO_RELOAD,
+} dispatcher_uring_op_t;
+
+#define __DUO_MASK                      0x7ULL
+
+static inline uint64_t __dispatcher_uring_data(dispatcher_endpoint_t *ep, dispatcher_uring_op_t op)
+{
+    return (uint64_t)(uintptr_t)ep | op;
+}
+
+
+struct io_uring_sqe *__dispatcher_uring_sqe(dispatcher_uring_t *u)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&(u->ring));
+
+    // submission queue is full: flush it and retry
+    if (!sqe) {
+        io_uring_submit(&(u->ring));
+        sqe = io_uring_get_sqe(&(u->ring));
+    }
+
+    return sqe;
+}
+
+cyclic_buffer_t *__dispatcher_uring_recv_buffer(dispatcher_endpoint_t *ep)
+{
+    dispatcher_connection_t *conn = ep->conn;
+
+    // peer -> input buffer, app -> output buffer
+    return (ep == &(conn->peer)) ? &(conn->session.input_buffer) : &(conn->session.output_buffer);
+}
+
+void __dispatcher_uring_arm_accept(cryptochan_dispatcher_context_t *cntx)
+{
+    struct io_uring_sqe *sqe = __dispatcher_uring_sqe(cntx->uring);
+
+    io_uring_prep_multishot_accept(sqe, cntx->listen_sockfd, NULL, NULL, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(NULL, DUO_ACCEPT));
+    cntx->uring->accept_armed = true;
+}
+
+// accept ended on a shortage: re-armed once descriptors are released, or after
+// DISPATCHER_ACCEPT_RETRY_MS (re-arming right away fails again at once)
+void __dispatcher_uring_retry_accept(cryptochan_dispatcher_context_t *cntx, bool released)
+{
+    dispatcher_uring_t *u = cntx->uring;
+    struct timespec now;
+
+    if (!cntx->accept_pending || u->accept_armed || dispatcher_stopping())
+        { return; }
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    int64_t elapsed_ms = (int64_t)(now.tv_sec - u->accept_failed.tv_sec) * 1000
+        + (now.tv_nsec - u->accept_failed.tv_nsec) / 1000000;
+
+    if (released || (elapsed_ms >= DISPATCHER_ACCEPT_RETRY_MS)) {
+        u->accept_failed = now;
+        __dispatcher_uring_arm_accept(cntx);
+    }
+}
+
+void __dispatcher_uring_arm_stop(cryptochan_dispatcher_context_t *cntx)
+{
+    struct io_uring_sqe *sqe = __dispatcher_uring_sqe(cntx->uring);
+
+    io_uring_prep_poll_add(sqe, cntx->stop_fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(NULL, DUO_STOP));
+}
+
+void __dispatcher_uring_arm_reload(cryptochan_dispatcher_context_t *cntx)
+{
+    struct io_uring_sqe *sqe = __dispatcher_uring_sqe(cntx->uring);
+
+    // one-shot: re-armed on completion
+    io_uring_prep_poll_add(sqe, cntx->reload_fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(NULL, DUO_RELOAD));
+}
+
+void __dispatcher_uring_drain_reload(cryptochan_dispatcher_context_t *cntx)
+{
+    uint64_t count;
+
+    __attribute__((unused)) ssize_t res = read(cntx->reload_fd, &count, sizeof(count));
+}
+
+
+//
+//  provided buffers
+//
+
+void __dispatcher_uring_recv(cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep);
+
+void __dispatcher_uring_recycle(cryptochan_dispatcher_context_t *cntx, int bid)
+{
+    dispatcher_uring_t *u = cntx->uring;
+
+    io_uring_buf_ring_add(u->buf_ring, u->buffers + (size_t)bid * DISPATCHER_URING_BUFFER_SIZE,
+        DISPATCHER_URING_BUFFER_SIZE, bid, io_uring_buf_ring_mask(DISPATCHER_URING_BUFFERS), 0);
+    io_uring_buf_ring_advance(u->buf_ring, 1);
+
+    // re-arm recv of starved endpoints
+    while (u->starved) {
+        dispatcher_endpoint_t *ep = u->starved;
+        u->starved = ep->next_starved;
+        ep->next_starved = NULL;
+        ep->starved = false;
+        ep->conn->inflight--;
+
+        if (!ep->conn->closed) {
+            __dispatcher_uring_recv(cntx, ep);
+        }
+    }
+}
+
+bool __dispatcher_uring_absorb(cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep)
+{
+    dispatcher_uring_t *u = cntx->uring;
+
+    if (ep->pending_bid == -1)
+        { return false; }
+
+    // copy as much of the received buffer as fits
+    uint8_t *data = u->buffers + (size_t)ep->pending_bid * DISPATCHER_URING_BUFFER_SIZE;
+    cyclic_buffer_t *buf = __dispatcher_uring_recv_buffer(ep);
+    uint32_t n = cyclic_buffer_write(buf, data + ep->pending_offset, ep->pending_size);
+
+    // full: grow unless a send from the ring is in flight (it would move under it)
+    dispatcher_endpoint_t *sender = (ep == &(ep->conn->peer)) ? &(ep->conn->app) : &(ep->conn->peer);
+    if ((n < ep->pending_size) && (sender->send_ops == 0) && cyclic_buffer_grow(buf)) {
+        n += cyclic_buffer_write(buf, data + ep->pending_offset + n, ep->pending_size - n);
+    }
+
+    ep->pending_offset += n;
+    ep->pending_size -= n;
+
+    // give the buffer back to the kernel once passed on completely
+    if (ep->pending_size == 0) {
+        int bid = ep->pending_bid;
+        ep->pending_bid = -1;
+        __dispatcher_uring_recycle(cntx, bid);
+    }
+
+    return (n > 0);
+}
+
+
+//
+//  operations
+//
+
+void __dispatcher_uring_recv(cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep)
+{
+    // one recv at a time: the next one is armed when the buffer is passed on (backpressure)
+    if ((ep->fd == -1) || ep->recv_armed || (ep->pending_bid != -1) || ep->eof || ep->starved)
+        { return; }
+
+    struct io_uring_sqe *sqe = __dispatcher_uring_sqe(cntx->uring);
+
+    io_uring_prep_recv(sqe, ep->fd, NULL, DISPATCHER_URING_BUFFER_SIZE, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT);
+    sqe->buf_group = DISPATCHER_URING_BGID;
+    io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(ep, DUO_RECV));
+
+    ep->recv_armed = true;
+    ep->conn->inflight++;
+}
+
+void __dispatcher_uring_send(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep, cyclic_buffer_t *buf
+)
+{
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+
+    // previous sends are committed on completion
+    if ((ep->fd == -1) || ep->send_ops || ep->shut)
+        { return; }
+
+    int iovcnt = cyclic_buffer_read_reserve(buf, iov, UINT32_MAX);
+
+    // one send per buffer region, linked to keep them ordered
+    for (int i = 0; i < iovcnt; ++i) {
+        struct io_uring_sqe *sqe = __dispatcher_uring_sqe(cntx->uring);
+
+        io_uring_prep_send(sqe, ep->fd, iov[i].iov_base, iov[i].iov_len,
+            MSG_WAITALL | MSG_NOSIGNAL);
+        if (i < iovcnt - 1) {
+            io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+        }
+        io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(ep, DUO_SEND));
+
+        ep->send_ops++;
+        ep->conn->inflight++;
+    }
+}
+
+bool dispatcher_uring_connect_target(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn,
+    dispatcher_endpoint_t *ep
+)
+{
+    // blocking socket: io_uring waits for readiness internally
+    ep->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ep->fd == -1) {
+        perror("dispatcher: socket");
+        return false;
+    }
+
+    setnodelay(ep->fd);
+
+    struct io_uring_sqe *sqe = __dispatcher_uring_sqe(cntx->uring);
+
+    io_uring_prep_connect(sqe, ep->fd, (struct sockaddr*) &(cntx->target_addr),
+        sizeof(struct sockaddr_in));
+    io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(ep, DUO_CONNECT));
+
+    conn->connecting = true;
+    conn->inflight++;
+
+    return true;
+}
+
+void __dispatcher_uring_cancel_endpoint(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep
+)
+{
+    dispatcher_uring_t *u = cntx->uring;
+
+    if (ep->fd == -1)
+        { return; }
+
+    // wake up blocked recv/send, cancel the rest (connect)
+    shutdown(ep->fd, SHUT_RDWR);
+
+    struct io_uring_sqe *sqe = __dispatcher_uring_sqe(u);
+    io_uring_prep_cancel_fd(sqe, ep->fd, IORING_ASYNC_CANCEL_ALL);
+    io_uring_sqe_set_data64(sqe, __dispatcher_uring_data(NULL, DUO_CANCEL));
+
+    // drop from starved list
+    for (dispatcher_endpoint_t **link = &(u->starved); ep->starved && *link;
+            link = &((*link)->next_starved)) {
+        if (*link == ep) {
+            *link = ep->next_starved;
+            ep->next_starved = NULL;
+            ep->starved = false;
+            ep->conn->inflight--;
+            break;
+        }
+    }
+
+    // give back the received buffer
+    if (ep->pending_bid != -1) {
+        int bid = ep->pending_bid;
+        ep->pending_bid = -1;
+        __dispatcher_uring_recycle(cntx, bid);
+    }
+}
+
+void dispatcher_uring_cancel(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+)
+{
+    // fds are closed on release (once no operation references them)
+    __dispatcher_uring_cancel_endpoint(cntx, &(conn->peer));
+    __dispatcher_uring_cancel_endpoint(cntx, &(conn->app));
+}
+
+
+//
+//  data pumping
+//
+
+void __dispatcher_uring_pump(cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn)
+{
+    cryptochan_session_t *session = &(conn->session);
+    bool progress;
+
+    do {
+        // received buffers -> input/output buffers (plain data once channelling only)
+        progress = __dispatcher_uring_absorb(cntx, &(conn->peer));
+        if (session_is_channelling(session)) {
+            progress |= __dispatcher_uring_absorb(cntx, &(conn->app));
+        }
+
+        if (!__dispatcher_process(cntx, conn))
+            { return; }
+    } while (progress);
+
+    // re-arm recv
+    __dispatcher_uring_recv(cntx, &(conn->peer));
+    if (session_is_channelling(session) && !conn->connecting) {
+        __dispatcher_uring_recv(cntx, &(conn->app));
+    }
+
+    // input buffer -> app, output buffer -> peer
+    if (session_is_channelling(session) && !conn->connecting) {
+        __dispatcher_uring_send(cntx, &(conn->app), &(session->input_buffer));
+    }
+    if (!conn->connecting || (cntx->role == CSR_SERVER)) {
+        __dispatcher_uring_send(cntx, &(conn->peer), &(session->output_buffer));
+    }
+
+    __dispatcher_half_close(cntx, conn);
+}
+
+
+//
+//  completions
+//
+
+void __dispatcher_uring_on_accept(cryptochan_dispatcher_context_t *cntx, struct io_uring_cqe *cqe)
+{
+    // connections stay queued (EMFILE, ENFILE, ENOBUFS, ENOMEM)
+    bool shortage = (cqe->res == -EMFILE) || (cqe->res == -ENFILE)
+        || (cqe->res == -ENOBUFS) || (cqe->res == -ENOMEM);
+
+    // multishot accept stops on errors: re-armed here, or by the run loop
+    // after a shortage
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        cntx->uring->accept_armed = false;
+        if (!shortage && !dispatcher_stopping())
+            { __dispatcher_uring_arm_accept(cntx); }
+    }
+
+    if (shortage) {
+        // logged once per shortage
+        if (!cntx->accept_pending)
+            { fprintf(stderr, "dispatcher: accept: %s\n", strerror(-cqe->res)); }
+        cntx->accept_pending = true;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &(cntx->uring->accept_failed));
+        return;
+    }
+
+    if (cqe->res < 0) {
+        if ((cqe->res != -EINTR) && (cqe->res != -ECONNABORTED) && (cqe->res != -ECANCELED)) {
+            fprintf(stderr, "dispatcher: accept: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    cntx->accept_pending = false;
+
+    setnodelay(cqe->res);
+
+    dispatcher_connection_t *conn = __dispatcher_connection_new(cntx, cqe->res);
+    if (!conn)
+        { return; }
+
+    // client connects to server right away, server connects to app once channelling
+    if ((cntx->role == CSR_CLIENT) && !dispatcher_uring_connect_target(cntx, conn, &(conn->peer))) {
+        __dispatcher_connection_close(cntx, conn);
+        return;
+    }
+
+    // nothing to send before the client hello (client may be connected already)
+    __dispatcher_uring_pump(cntx, conn);
+}
+
+void __dispatcher_uring_on_recv(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep, struct io_uring_cqe *cqe
+)
+{
+    dispatcher_connection_t *conn = ep->conn;
+
+    ep->recv_armed = false;
+    conn->inflight--;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (conn->closed || (cqe->res <= 0)) {
+            __dispatcher_uring_recycle(cntx, bid);
+        } else {
+            ep->pending_bid = bid;
+            ep->pending_offset = 0;
+            ep->pending_size = cqe->res;
+        }
+    }
+
+    if (conn->closed)
+        { return; }
+
+    if (cqe->res == 0) {
+        ep->eof = true;
+    } else if (cqe->res == -ENOBUFS) {
+        // all buffers are in use: wait for one to come back
+        ep->next_starved = cntx->uring->starved;
+        ep->starved = true;
+        cntx->uring->starved = ep;
+        conn->inflight++;
+        return;
+    } else if (cqe->res < 0) {
+        if (cqe->res != -ECONNRESET) {
+            fprintf(stderr, "dispatcher: recv: %s\n", strerror(-cqe->res));
+        }
+        __dispatcher_connection_close(cntx, conn);
+        return;
+    }
+
+    __dispatcher_uring_pump(cntx, conn);
+}
+
+void __dispatcher_uring_on_send(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep, struct io_uring_cqe *cqe
+)
+{
+    dispatcher_connection_t *conn = ep->conn;
+    cyclic_buffer_t *buf = (ep == &(conn->peer))
+        ? &(conn->session.output_buffer) : &(conn->session.input_buffer);
+
+    ep->send_ops--;
+    conn->inflight--;
+
+    if (conn->closed)
+        { return; }
+
+    if (cqe->res > 0) {
+        cyclic_buffer_read_commit(buf, cqe->res);
+    } else if (cqe->res != -ECANCELED) {
+        // (ECANCELED: the linked send after a short one, resent below)
+        if ((cqe->res != -EPIPE) && (cqe->res != -ECONNRESET)) {
+            fprintf(stderr, "dispatcher: send: %s\n", strerror(-cqe->res));
+        }
+        __dispatcher_connection_close(cntx, conn);
+        return;
+    }
+
+    // whole chain is done
+    if (ep->send_ops == 0) {
+        __dispatcher_uring_pump(cntx, conn);
+    }
+}
+
+void __dispatcher_uring_on_connect(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_endpoint_t *ep, struct io_uring_cqe *cqe
+)
+{
+    dispatcher_connection_t *conn = ep->conn;
+
+    conn->inflight--;
+
+    if (conn->closed)
+        { return; }
+
+    if (cqe->res < 0) {
+        fprintf(stderr, "dispatcher: connect: %s\n", strerror(-cqe->res));
+        __dispatcher_connection_close(cntx, conn);
+        return;
+    }
+
+    conn->connecting = false;
+    session_connected(&(conn->session));
+
+    __dispatcher_uring_pump(cntx, conn);
+}
+
+void __dispatcher_uring_complete(cryptochan_dispatcher_context_t *cntx, struct io_uring_cqe *cqe)
+{
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    dispatcher_endpoint_t *ep = (dispatcher_endpoint_t*)(uintptr_t)(data & ~__DUO_MASK);
+
+    switch ((dispatcher_uring_op_t)(data & __DUO_MASK)) {
+        case DUO_ACCEPT:
+            __dispatcher_uring_on_accept(cntx, cqe);
+            break;
+        case DUO_RECV:
+            __dispatcher_uring_on_recv(cntx, ep, cqe);
+            break;
+        case DUO_SEND:
+            __dispatcher_uring_on_send(cntx, ep, cqe);
+            break;
+        case DUO_CONNECT:
+            __dispatcher_uring_on_connect(cntx, ep, cqe);
+            break;
+        case DUO_RELOAD:
+            // drain only, the set is checked after the batch
+            __dispatcher_uring_drain_reload(cntx);
+            if (!dispatcher_stopping())
+                { __dispatcher_uring_arm_reload(cntx); }
+            break;
+        case DUO_STOP:
+        case DUO_CANCEL:
+        default:
+            break;
+    }
+}
+
+bool dispatcher_uring_run(cryptochan_dispatcher_context_t *cntx)
+{
+    dispatcher_uring_t *u = cntx->uring;
+    struct io_uring_cqe *cqes[DISPATCHER_MAX_EVENTS], *cqe;
+    struct __kernel_timespec timeout = { .tv_sec = DISPATCHER_IDLE_INTERVAL };
+    struct __kernel_timespec retry_timeout = {
+        .tv_sec = DISPATCHER_ACCEPT_RETRY_MS / 1000,
+        .tv_nsec = (DISPATCHER_ACCEPT_RETRY_MS % 1000) * 1000000L,
+    };
+
+    __dispatcher_uring_arm_accept(cntx);
+    __dispatcher_uring_arm_stop(cntx);
+    if (cntx->reload_fd != -1) {
+        __dispatcher_uring_arm_reload(cntx);
+    }
+
+    while (!dispatcher_stopping()) {
+        // submit everything queued and wait for at least one completion (one syscall),
+        // wakes up at least for the idle sweep (or the accept retry)
+        int err = io_uring_submit_and_wait_timeout(&(u->ring), &cqe, 1,
+            (cntx->accept_pending && !u->accept_armed) ? &retry_timeout : &timeout, NULL);
+        if ((err < 0) && (err != -ETIME)) {
+            if (err == -EINTR)
+                { continue; }
+            fprintf(stderr, "dispatcher: io_uring_submit_and_wait_timeout: %s\n", strerror(-err));
+            return false;
+        }
+
+        unsigned n = io_uring_peek_batch_cqe(&(u->ring), cqes, DISPATCHER_MAX_EVENTS);
+        for (unsigned i = 0; i < n; ++i) {
+            __dispatcher_uring_complete(cntx, cqes[i]);
+        }
+        io_uring_cq_advance(&(u->ring), n);
+
+        __dispatcher_recode_batch(cntx);
+        dispatcher_check_reload(cntx);
+        dispatcher_release_idle(cntx);
+        __dispatcher_uring_retry_accept(cntx, __dispatcher_release_closed(cntx));
+    }
+
+    return true;
+}
+
+
+void dispatcher_uring_destroy(cryptochan_dispatcher_context_t *cntx)
+{
+    dispatcher_uring_t *u = cntx->uring;
+
+    // tearing the ring down drops all in-flight operations
+    if (u->buf_ring) {
+        io_uring_free_buf_ring(&(u->ring), u->buf_ring, DISPATCHER_URING_BUFFERS,
+            DISPATCHER_URING_BGID);
+    }
+    if (u->ring.ring_fd > 0) {
+        io_uring_queue_exit(&(u->ring));
+    }
+    if (u->buffers) {
+        munmap(u->buffers, (size_t)DISPATCHER_URING_BUFFERS * DISPATCHER_URING_BUFFER_SIZE);
+    }
+
+    for (dispatcher_connection_t *conn = cntx->closed_connections; conn; conn = conn->next) {
+        conn->inflight = 0;
+    }
+
+    free(u);
+    cntx->uring = NULL;
+}
+
+void dispatcher_uring_place(
+    cryptochan_dispatcher_context_t *cntx, int numa_node, bool transparent_huge_pages
+)
+{
+    dispatcher_uring_t *u = cntx->uring;
+    size_t size = (size_t)DISPATCHER_URING_BUFFERS * DISPATCHER_URING_BUFFER_SIZE;
+
+    if ((numa_node != -1) && !cpu_numa_prefer_node(u->buffers, size, numa_node))
+        { perror("dispatcher: mbind"); }
+
+    if (transparent_huge_pages && (madvise(u->buffers, size, MADV_HUGEPAGE) == -1))
+        { perror("dispatcher: madvise(MADV_HUGEPAGE)"); }
+}
+
+bool dispatcher_uring_init(cryptochan_dispatcher_context_t *cntx)
+{
+    struct io_uring_params params = {0};
+    int flags, err;
+
+    dispatcher_uring_t *u = calloc(1, sizeof(dispatcher_uring_t));
+    if (!u) {
+        perror("dispatcher: calloc");
+        return false;
+    }
+
+    cntx->uring = u;
+
+    bool result = false;
+
+    for (;;) {
+        err = io_uring_queue_init_params(DISPATCHER_URING_ENTRIES, &(u->ring), &params);
+        if (err < 0) {
+            fprintf(stderr, "dispatcher: io_uring_queue_init: %s\n", strerror(-err));
+            u->ring.ring_fd = -1;
+            break;
+        }
+
+        // provided buffer rings (5.19+, multishot accept comes with the same kernel)
+        u->buf_ring = io_uring_setup_buf_ring(&(u->ring), DISPATCHER_URING_BUFFERS,
+            DISPATCHER_URING_BGID, 0, &err);
+        if (!u->buf_ring) {
+            fprintf(stderr, "dispatcher: io_uring_setup_buf_ring: %s\n", strerror(-err));
+            break;
+        }
+
+        u->buffers = mmap(NULL, (size_t)DISPATCHER_URING_BUFFERS * DISPATCHER_URING_BUFFER_SIZE,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (u->buffers == MAP_FAILED) {
+            u->buffers = NULL;
+            perror("dispatcher: mmap");
+            break;
+        }
+
+        for (int bid = 0; bid < DISPATCHER_URING_BUFFERS; ++bid) {
+            io_uring_buf_ring_add(u->buf_ring,
+                u->buffers + (size_t)bid * DISPATCHER_URING_BUFFER_SIZE,
+                DISPATCHER_URING_BUFFER_SIZE, bid,
+                io_uring_buf_ring_mask(DISPATCHER_URING_BUFFERS), bid);
+        }
+        io_uring_buf_ring_advance(u->buf_ring, DISPATCHER_URING_BUFFERS);
+
+        // io_uring waits for readiness itself, a nonblocking listen socket would fail accepts
+        if (((flags = fcntl(cntx->listen_sockfd, F_GETFL)) == -1)
+            || (fcntl(cntx->listen_sockfd, F_SETFL, flags & ~O_NONBLOCK) == -1)) {
+            perror("dispatcher: fcntl");
+            break;
+        }
+
+        // all done
+        result = true;
+        break;
+    }
+
+    // release everything on failure (epoll is used then)
+    if (!result) {
+        dispatcher_uring_destroy(cntx);
+    }
+
+    return result;
+}
+
+#endif // HAVE_LIBURING
@@ -0,0 +1,77 @@
+#ifndef __DISPATCHER_URING_H
+#define __DISPATCHER_URING_H
+
+#include "dispatcher.h"
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+
+#ifndef DISPATCHER_URING_ENTRIES
+# define DISPATCHER_URING_ENTRIES       4096
+#endif
+
+// provided buffers for recv (count must be a power of 2)
+#ifndef DISPATCHER_URING_BUFFERS
+# define DISPATCHER_URING_BUFFERS       1024
+#endif
+
+#ifndef DISPATCHER_URING_BUFFER_SIZE
+# define DISPATCHER_URING_BUFFER_SIZE   16384
+#endif
+
+#define DISPATCHER_URING_BGID           0
+
+typedef struct __dispatcher_uring {
+    struct io_uring ring;
+    struct io_uring_buf_ring *buf_ring;
+    uint8_t *buffers;                   // DISPATCHER_URING_BUFFERS * DISPATCHER_URING_BUFFER_SIZE
+    dispatcher_endpoint_t *starved;     // recv got ENOBUFS, re-armed once a buffer is back
+    bool accept_armed;                  // multishot accept in flight
+    struct timespec accept_failed;      // last accept shortage (EMFILE, ...), retried after
+                                        // DISPATCHER_ACCEPT_RETRY_MS (monotonic coarse)
+} dispatcher_uring_t;
+
+extern bool dispatcher_uring_init(cryptochan_dispatcher_context_t *cntx);
+extern bool dispatcher_uring_run(cryptochan_dispatcher_context_t *cntx);
+extern void dispatcher_uring_destroy(cryptochan_dispatcher_context_t *cntx);
+
+// recv buffers prefer the NUMA node (-1 for any), optionally on transparent hugepages
+// (by the worker thread, before the first recv touches them)
+extern void dispatcher_uring_place(
+    cryptochan_dispatcher_context_t *cntx, int numa_node, bool transparent_huge_pages
+);
+
+extern bool dispatcher_uring_connect_target(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn,
+    dispatcher_endpoint_t *ep
+);
+extern void dispatcher_uring_cancel(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+);
+
+// shared with dispatcher.c
+extern dispatcher_connection_t *__dispatcher_connection_new(
+    cryptochan_dispatcher_context_t *cntx, int fd
+);
+extern void __dispatcher_connection_close(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+);
+extern bool __dispatcher_release_closed(cryptochan_dispatcher_context_t *cntx);
+extern bool __dispatcher_process(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+);
+extern void __dispatcher_half_close(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+);
+extern void __dispatcher_recode_batch(cryptochan_dispatcher_context_t *cntx);
+extern bool setnodelay(int fd);
+
+// shared with dispatcher.c (pumps connections recoded by the batch)
+extern void __dispatcher_uring_pump(
+    cryptochan_dispatcher_context_t *cntx, dispatcher_connection_t *conn
+);
+
+#endif // HAVE_LIBURING
+
+#endif // __DISPATCHER_URING_H
@@ -1,6 +1,59 @@
 #include "ec_helper.h"
+#include "random.h"
 
 #include <libbase58.h>
+#include <pthread.h>
+#include <secp256k1_ecdh.h>
+
+
+//
+//  per-thread secp256k1 contexts
+//
+
+static _Thread_local secp256k1_context *ec_thread_context = NULL;
+static pthread_key_t ec_context_key;
+static pthread_once_t ec_context_key_once = PTHREAD_ONCE_INIT;
+
+void __ec_context_destroy(void *ctx)
+{
+    secp256k1_context_destroy((secp256k1_context*)ctx);
+}
+
+void __ec_context_key_init(void)
+{
+    // destroys the context when its thread exits
+    if (pthread_key_create(&ec_context_key, __ec_context_destroy) != 0) {
+        perror("ERROR: __ec_context_key_init: pthread_key_create");
+        abort();
+    }
+}
+
+secp256k1_context* ec_context(void)
+{
+    uint8_t seed[32];
+
+    if (ec_thread_context != NULL) {
+        return ec_thread_context;
+    }
+
+    pthread_once(&ec_context_key_once, __ec_context_key_init);
+
+    // blinded with a random seed (side channel protection of signing and keygen)
+    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    if ((ctx == NULL)
+        || (fill_random(seed, sizeof(seed)) != sizeof(seed))
+        || !secp256k1_context_randomize(ctx, seed)) {
+        fprintf(stderr, "PANIC: ec_context: failed to create a randomized secp256k1 context\n");
+        abort();
+    }
+    explicit_bzero(seed, sizeof(seed));
+
+    pthread_setspecific(ec_context_key, ctx);
+    ec_thread_context = ctx;
+
+    return ctx;
+}
+
 
 
 bool decode_b58_privkey(
@@ -46,8 +99,7 @@ bool decode_b58_privkey(
 
     /* Verify the decoded secp256k1 secret key */
 
-    // alloc a secp256k1 context object
-    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    secp256k1_context* ctx = ec_context();
     bool result = false;
 
     for (;;) {
@@ -71,9 +123,6 @@ bool decode_b58_privkey(
         break;
     }
 
-    // destroy the secp256k1 context object
-    secp256k1_context_destroy(ctx);
-
     // return result
     return result;
 }
@@ -124,8 +173,7 @@ bool decode_b58_pubkey(const char *encoded_key, secp256k1_pubkey *public_key_dat
 
     /* Deserialize the decoded public key data as secp256k1_pubkey */
 
-    // alloc a secp256k1 context object
-    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    secp256k1_context* ctx = ec_context();
     bool result = false;
 
     for (;;) {
@@ -140,9 +188,6 @@ bool decode_b58_pubkey(const char *encoded_key, secp256k1_pubkey *public_key_dat
         break;
     }
 
-    // destroy the secp256k1 context object
-    secp256k1_context_destroy(ctx);
-
     // return result
     return result;
 }
@@ -150,16 +195,12 @@ bool decode_b58_pubkey(const char *encoded_key, secp256k1_pubkey *public_key_dat
 
 bool privkey_to_pubkey(uint8_t *private_key_data, secp256k1_pubkey *public_key_data)
 {
-    // alloc a secp256k1 context object
-    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    secp256k1_context* ctx = ec_context();
 
     // verify private key and compare public keys
     bool result = secp256k1_ec_seckey_verify(ctx, private_key_data)
         && secp256k1_ec_pubkey_create(ctx, public_key_data, private_key_data);
 
-    // destroy the secp256k1 context object
-    secp256k1_context_destroy(ctx);
-
     // return result
     return result;
 }
@@ -174,6 +215,112 @@ bool check_pubkey_belongs_to_privkey(uint8_t *private_key_data, secp256k1_pubkey
 }
 
 
+bool generate_keypair(uint8_t *private_key_data, secp256k1_pubkey *public_key_data)
+{
+    // a random 32-byte string is a valid key with overwhelming probability
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        if (fill_random(private_key_data, EC_PRIVATE_KEY_SIZE) != EC_PRIVATE_KEY_SIZE) {
+            return false;
+        }
+        if (privkey_to_pubkey(private_key_data, public_key_data)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool pubkey_serialize(secp256k1_pubkey *public_key_data, uint8_t *output)
+{
+    size_t len = EC_PUBLIC_KEY_SIZE;
+
+    secp256k1_context* ctx = ec_context();
+
+    // serialize public key to compressed form
+    bool result = secp256k1_ec_pubkey_serialize(
+            ctx, output, &len, public_key_data, SECP256K1_EC_COMPRESSED)
+        && (len == EC_PUBLIC_KEY_SIZE);
+
+    // return result
+    return result;
+}
+
+
+bool pubkey_parse(const uint8_t *input, secp256k1_pubkey *public_key_data)
+{
+    // accept compressed form only (02 or 03 prefix for Y parity)
+    if ((input[0] != 0x02) && (input[0] != 0x03)) {
+        return false;
+    }
+
+    secp256k1_context* ctx = ec_context();
+
+    // parse public key
+    bool result = secp256k1_ec_pubkey_parse(ctx, public_key_data, input, EC_PUBLIC_KEY_SIZE);
+
+    // return result
+    return result;
+}
+
+
+bool ecdh_shared_secret(
+    secp256k1_pubkey *public_key_data, uint8_t *private_key_data, uint8_t *output
+)
+{
+    secp256k1_context* ctx = ec_context();
+
+    // compute sha256 of the shared point (default hash function)
+    bool result = secp256k1_ecdh(ctx, output, public_key_data, private_key_data, NULL, NULL);
+
+    // return result
+    return result;
+}
+
+
+bool ecdsa_sign_hash(uint8_t *private_key_data, const uint8_t *hash, uint8_t *signature)
+{
+    secp256k1_ecdsa_signature sig;
+
+    secp256k1_context* ctx = ec_context();
+
+    // sign (RFC6979 nonce) and serialize to compact form
+    bool result = secp256k1_ecdsa_sign(ctx, &sig, hash, private_key_data, NULL, NULL)
+        && secp256k1_ecdsa_signature_serialize_compact(ctx, signature, &sig);
+
+    // return result
+    return result;
+}
+
+
+bool ecdsa_verify_hash(
+    secp256k1_pubkey *public_key_data, const uint8_t *hash, const uint8_t *signature
+)
+{
+    secp256k1_ecdsa_signature sig;
+
+    secp256k1_context* ctx = ec_context();
+
+    // parse compact form and verify
+    bool result = secp256k1_ecdsa_signature_parse_compact(ctx, &sig, signature)
+        && secp256k1_ecdsa_verify(ctx, &sig, hash, public_key_data);
+
+    // return result
+    return result;
+}
+
+
+void tagged_hash(const char *tag, const uint8_t *msg, size_t msg_len, uint8_t *hash)
+{
+    // sha256(sha256(tag) || sha256(tag) || msg), no secret state involved
+    if (!secp256k1_tagged_sha256(secp256k1_context_static,
+            hash, (const uint8_t*)tag, strlen(tag), msg, msg_len)) {
+        fprintf(stderr, "PANIC: secp256k1_tagged_sha256 failed\n");
+        abort();
+    }
+}
+
+
 char* b58enc_data(uint8_t *data, size_t sz)
 {
     char buf[sz*2];
@@ -202,8 +349,7 @@ char* pubkey_to_b58enc_form(secp256k1_pubkey *public_key_data)
     uint8_t compressed_pubkey[33];
     size_t len = sizeof(compressed_pubkey);
 
-    // alloc a secp256k1 context object
-    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    secp256k1_context* ctx = ec_context();
 
     // serialize public key to compressed form
     if (secp256k1_ec_pubkey_serialize(
@@ -213,9 +359,6 @@ char* pubkey_to_b58enc_form(secp256k1_pubkey *public_key_data)
         result = b58enc_data(compressed_pubkey, 33);
     }
 
-    // destroy the secp256k1 context object
-    secp256k1_context_destroy(ctx);
-
     // return result
     return result;
 }
@@ -5,6 +5,15 @@
 
 #include <secp256k1.h>
 
+#define EC_PRIVATE_KEY_SIZE         32
+#define EC_PUBLIC_KEY_SIZE          33      // compressed form
+#define EC_SIGNATURE_SIZE           64      // compact form
+#define EC_HASH_SIZE                32
+
+// long-lived randomized context of the calling thread (no locking, created on
+// first use, destroyed at thread exit)
+extern secp256k1_context* ec_context(void);
+
 extern bool decode_b58_privkey(
     const char *encoded_key, uint8_t *private_key_data,
     secp256k1_pubkey *public_key_data, char **error_desc
@@ -19,6 +28,19 @@ extern bool check_pubkey_belongs_to_privkey(
 extern bool privkey_to_pubkey(
     uint8_t *private_key_data, secp256k1_pubkey *public_key_data
 );
+extern bool generate_keypair(
+    uint8_t *private_key_data, secp256k1_pubkey *public_key_data
+);
+extern bool pubkey_serialize(secp256k1_pubkey *public_key_data, uint8_t *output);
+extern bool pubkey_parse(const uint8_t *input, secp256k1_pubkey *public_key_data);
+extern bool ecdh_shared_secret(
+    secp256k1_pubkey *public_key_data, uint8_t *private_key_data, uint8_t *output
+);
+extern bool ecdsa_sign_hash(uint8_t *private_key_data, const uint8_t *hash, uint8_t *signature);
+extern bool ecdsa_verify_hash(
+    secp256k1_pubkey *public_key_data, const uint8_t *hash, const uint8_t *signature
+);
+extern void tagged_hash(const char *tag, const uint8_t *msg, size_t msg_len, uint8_t *hash);
 extern char* privkey_to_b58enc_form(uint8_t *private_key_data);
 extern char* pubkey_to_b58enc_form(secp256k1_pubkey *public_key_data);
 
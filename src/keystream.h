@@ -0,0 +1,17 @@
+#ifndef __KEYSTREAM_H
+#define __KEYSTREAM_H
+
+#include "common.h"
+
+// keystream engine: generates the next `size' bytes of its stream and xors
+// them into `dptr' in the same pass (no intermediate mask buffer); engines
+// embed keystream_t as their first member and keep their own position
+typedef struct __keystream keystream_t;
+
+typedef void (*keystream_xor_func_t)(keystream_t *ks, uint8_t *dptr, size_t size);
+
+struct __keystream {
+    keystream_xor_func_t xor_func;
+};
+
+#endif // __KEYSTREAM_H
@@ -0,0 +1,561 @@
+#include "common.h"
+#include "keystream_aes.h"
+#include "cpu_features.h"
+#include "max_scalar.h"
+
+
+//
+//  key schedule (shared: AES-NI takes the same encryption round keys)
+//
+
+static const uint8_t keystream_aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+void __keystream_aes_expand_key(keystream_aes_t *ks, const uint8_t *key, size_t key_size)
+{
+    int nk = (int)(key_size / 4);
+    int words = (ks->rounds + 1) * 4;
+    uint8_t *w = ks->round_keys;
+    uint8_t rcon = 0x01;
+
+    memcpy(w, key, key_size);
+
+    for (int i = nk; i < words; ++i) {
+        uint8_t t[4];
+        memcpy(t, w + (i - 1) * 4, 4);
+
+        if (i % nk == 0) {
+            // RotWord, SubWord, Rcon
+            uint8_t t0 = t[0];
+            t[0] = keystream_aes_sbox[t[1]] ^ rcon;
+            t[1] = keystream_aes_sbox[t[2]];
+            t[2] = keystream_aes_sbox[t[3]];
+            t[3] = keystream_aes_sbox[t0];
+            rcon = (uint8_t)((rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0));
+        } else if ((nk > 6) && (i % nk == 4)) {
+            for (int j = 0; j < 4; ++j) {
+                t[j] = keystream_aes_sbox[t[j]];
+            }
+        }
+
+        for (int j = 0; j < 4; ++j) {
+            w[i * 4 + j] = w[(i - nk) * 4 + j] ^ t[j];
+        }
+    }
+}
+
+void __keystream_aes_counter_block(keystream_aes_t *ks, uint64_t counter, uint8_t *block)
+{
+    uint64_t low = 0;
+
+    // iv[0..8] as is, iv[8..16] + counter (big endian)
+    for (int i = 8; i < 16; ++i) {
+        low = (low << 8) | ks->iv[i];
+    }
+    low += counter;
+
+    memcpy(block, ks->iv, 8);
+    for (int i = 15; i >= 8; --i) {
+        block[i] = (uint8_t)low;
+        low >>= 8;
+    }
+}
+
+
+//
+//  portable engine (table-free apart from the S-box; slow, for CPUs without AES-NI)
+//
+
+static inline uint8_t __keystream_aes_xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+void __keystream_aes_encrypt_block_portable(keystream_aes_t *ks, uint8_t *s)
+{
+    const uint8_t *rk = ks->round_keys;
+    uint8_t t[16];
+
+    for (int i = 0; i < 16; ++i) {
+        s[i] ^= rk[i];
+    }
+
+    for (int round = 1; round <= ks->rounds; ++round) {
+        // SubBytes + ShiftRows (column-major state)
+        for (int c = 0; c < 4; ++c) {
+            for (int r = 0; r < 4; ++r) {
+                t[c * 4 + r] = keystream_aes_sbox[s[((c + r) % 4) * 4 + r]];
+            }
+        }
+
+        // MixColumns (not in the last round)
+        if (round != ks->rounds) {
+            for (int c = 0; c < 4; ++c) {
+                uint8_t *col = t + c * 4;
+                uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+                col[0] ^= all ^ __keystream_aes_xtime(a0 ^ a1);
+                col[1] ^= all ^ __keystream_aes_xtime(a1 ^ a2);
+                col[2] ^= all ^ __keystream_aes_xtime(a2 ^ a3);
+                col[3] ^= all ^ __keystream_aes_xtime(a3 ^ a0);
+            }
+        }
+
+        // AddRoundKey
+        for (int i = 0; i < 16; ++i) {
+            s[i] = t[i] ^ rk[round * 16 + i];
+        }
+    }
+}
+
+void __keystream_aes_fill_portable(keystream_aes_t *ks, uint8_t *out, int blocks)
+{
+    for (int i = 0; i < blocks; ++i) {
+        __keystream_aes_counter_block(ks, ks->counter++, out + i * KEYSTREAM_AES_BLOCK_SIZE);
+        __keystream_aes_encrypt_block_portable(ks, out + i * KEYSTREAM_AES_BLOCK_SIZE);
+    }
+}
+
+
+//
+//  AES-NI engine (8 independent blocks in flight hide the aesenc latency)
+//
+
+#if defined(SCALAR_X86)
+
+# define __KEYSTREAM_AES_NI_TARGET      __attribute__((target("aes,sse2")))
+
+__KEYSTREAM_AES_NI_TARGET
+static inline __m128i __keystream_aes_ni_counter(uint64_t iv_high, uint64_t low)
+{
+    // memory order: iv_high (as loaded) || be64(low)
+    return _mm_set_epi64x((long long)__builtin_bswap64(low), (long long)iv_high);
+}
+
+__KEYSTREAM_AES_NI_TARGET
+void __keystream_aes_xor_blocks_ni(keystream_aes_t *ks, uint8_t *dptr, size_t groups, uint8_t *out)
+{
+    __m128i rk[KEYSTREAM_AES_MAX_ROUNDS + 1];
+    uint64_t iv_high, iv_low = 0;
+    int rounds = ks->rounds;
+
+    for (int i = 0; i <= rounds; ++i) {
+        rk[i] = _mm_load_si128((__m128i*)(ks->round_keys + i * 16));
+    }
+
+    memcpy(&iv_high, ks->iv, 8);
+    for (int i = 8; i < 16; ++i) {
+        iv_low = (iv_low << 8) | ks->iv[i];
+    }
+
+    // xor into dptr (out == NULL) or store the keystream into out (one group)
+    for (; groups > 0; --groups) {
+        uint64_t low = iv_low + ks->counter;
+        __m128i b0 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 0), rk[0]);
+        __m128i b1 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 1), rk[0]);
+        __m128i b2 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 2), rk[0]);
+        __m128i b3 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 3), rk[0]);
+        __m128i b4 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 4), rk[0]);
+        __m128i b5 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 5), rk[0]);
+        __m128i b6 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 6), rk[0]);
+        __m128i b7 = _mm_xor_si128(__keystream_aes_ni_counter(iv_high, low + 7), rk[0]);
+        ks->counter += KEYSTREAM_AES_INTERLEAVE;
+
+        for (int r = 1; r < rounds; ++r) {
+            b0 = _mm_aesenc_si128(b0, rk[r]);
+            b1 = _mm_aesenc_si128(b1, rk[r]);
+            b2 = _mm_aesenc_si128(b2, rk[r]);
+            b3 = _mm_aesenc_si128(b3, rk[r]);
+            b4 = _mm_aesenc_si128(b4, rk[r]);
+            b5 = _mm_aesenc_si128(b5, rk[r]);
+            b6 = _mm_aesenc_si128(b6, rk[r]);
+            b7 = _mm_aesenc_si128(b7, rk[r]);
+        }
+
+        b0 = _mm_aesenclast_si128(b0, rk[rounds]);
+        b1 = _mm_aesenclast_si128(b1, rk[rounds]);
+        b2 = _mm_aesenclast_si128(b2, rk[rounds]);
+        b3 = _mm_aesenclast_si128(b3, rk[rounds]);
+        b4 = _mm_aesenclast_si128(b4, rk[rounds]);
+        b5 = _mm_aesenclast_si128(b5, rk[rounds]);
+        b6 = _mm_aesenclast_si128(b6, rk[rounds]);
+        b7 = _mm_aesenclast_si128(b7, rk[rounds]);
+
+        if (out != NULL) {
+            _mm_store_si128((__m128i*)(out + 16 * 0), b0);
+            _mm_store_si128((__m128i*)(out + 16 * 1), b1);
+            _mm_store_si128((__m128i*)(out + 16 * 2), b2);
+            _mm_store_si128((__m128i*)(out + 16 * 3), b3);
+            _mm_store_si128((__m128i*)(out + 16 * 4), b4);
+            _mm_store_si128((__m128i*)(out + 16 * 5), b5);
+            _mm_store_si128((__m128i*)(out + 16 * 6), b6);
+            _mm_store_si128((__m128i*)(out + 16 * 7), b7);
+            continue;
+        }
+
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 0), _mm_xor_si128(b0, _mm_loadu_si128((__m128i*)(dptr + 16 * 0))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 1), _mm_xor_si128(b1, _mm_loadu_si128((__m128i*)(dptr + 16 * 1))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 2), _mm_xor_si128(b2, _mm_loadu_si128((__m128i*)(dptr + 16 * 2))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 3), _mm_xor_si128(b3, _mm_loadu_si128((__m128i*)(dptr + 16 * 3))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 4), _mm_xor_si128(b4, _mm_loadu_si128((__m128i*)(dptr + 16 * 4))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 5), _mm_xor_si128(b5, _mm_loadu_si128((__m128i*)(dptr + 16 * 5))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 6), _mm_xor_si128(b6, _mm_loadu_si128((__m128i*)(dptr + 16 * 6))));
+        _mm_storeu_si128((__m128i*)(dptr + 16 * 7), _mm_xor_si128(b7, _mm_loadu_si128((__m128i*)(dptr + 16 * 7))));
+        dptr += KEYSTREAM_AES_INTERLEAVE * KEYSTREAM_AES_BLOCK_SIZE;
+    }
+}
+
+//
+//  AES-NI multi-buffer engine (one block of KEYSTREAM_AES_MULTI_LANES different
+//  streams per step, a lane takes the next job once its own is done)
+//
+
+_Static_assert(KEYSTREAM_AES_MULTI_LANES == 8, "the multi-buffer round loop spells out 8 lanes");
+
+typedef struct __keystream_aes_lane {
+    keystream_aes_job_t *job;           // NULL = idle
+    const uint8_t *round_keys;          // of any busy lane when idle (dummy blocks)
+    uint64_t iv_high;                   // as loaded
+    uint64_t iv_low;                    // host order
+} keystream_aes_lane_t;
+
+void __keystream_aes_lane_assign(keystream_aes_lane_t *lane, keystream_aes_job_t *job)
+{
+    lane->job = job;
+    lane->round_keys = job->ks->round_keys;
+    memcpy(&(lane->iv_high), job->ks->iv, 8);
+    lane->iv_low = 0;
+    for (int i = 8; i < 16; ++i) {
+        lane->iv_low = (lane->iv_low << 8) | job->ks->iv[i];
+    }
+}
+
+__KEYSTREAM_AES_NI_TARGET
+static inline __m128i __keystream_aes_lane_counter(keystream_aes_lane_t *lane)
+{
+    uint64_t counter = lane->job ? lane->job->ks->counter : 0;
+    return __keystream_aes_ni_counter(lane->iv_high, lane->iv_low + counter);
+}
+
+// xor one keystream block into the lane's job, done with the job when it ends
+__KEYSTREAM_AES_NI_TARGET
+static inline void __keystream_aes_lane_xor(keystream_aes_lane_t *lane, __m128i block)
+{
+    keystream_aes_job_t *job = lane->job;
+
+    if (job == NULL) {
+        return;
+    }
+
+    job->ks->counter++;
+
+    if (job->size < KEYSTREAM_AES_BLOCK_SIZE) {
+        // partial block: the unused keystream stays at the end of the buffer
+        keystream_aes_t *ks = job->ks;
+        uint8_t *rest = ks->block + ks->block_size - KEYSTREAM_AES_BLOCK_SIZE;
+
+        _mm_store_si128((__m128i*)rest, block);
+        for (size_t i = 0; i < job->size; ++i) {
+            job->dptr[i] ^= rest[i];
+        }
+        ks->block_used = ks->block_size - KEYSTREAM_AES_BLOCK_SIZE + job->size;
+
+        job->dptr += job->size;
+        job->size = 0;
+        lane->job = NULL;
+        return;
+    }
+
+    _mm_storeu_si128((__m128i*)job->dptr,
+        _mm_xor_si128(block, _mm_loadu_si128((__m128i*)job->dptr)));
+    job->dptr += KEYSTREAM_AES_BLOCK_SIZE;
+    job->size -= KEYSTREAM_AES_BLOCK_SIZE;
+
+    if (job->size == 0) {
+        lane->job = NULL;
+    }
+}
+
+// the 8 lanes spelled out (blocks, keys, counters and data pointers stay in registers)
+#define __KEYSTREAM_AES_MB_EACH(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+
+// one block of every busy lane (ends jobs, a final partial block included)
+__KEYSTREAM_AES_NI_TARGET
+void __keystream_aes_xor_multi_step_ni(keystream_aes_lane_t *lanes, int rounds)
+{
+#define __MB_START(l) \
+    const uint8_t *rk##l = lanes[l].round_keys; \
+    __m128i b##l = _mm_xor_si128(__keystream_aes_lane_counter(&(lanes[l])), \
+        _mm_load_si128((__m128i*)rk##l));
+#define __MB_ROUND(l) \
+    b##l = _mm_aesenc_si128(b##l, _mm_load_si128((__m128i*)(rk##l + r)));
+#define __MB_FINISH(l) \
+    __keystream_aes_lane_xor(&(lanes[l]), \
+        _mm_aesenclast_si128(b##l, _mm_load_si128((__m128i*)(rk##l + rounds * 16))));
+
+    __KEYSTREAM_AES_MB_EACH(__MB_START)
+    for (int r = 16; r < rounds * 16; r += 16) {
+        __KEYSTREAM_AES_MB_EACH(__MB_ROUND)
+    }
+    __KEYSTREAM_AES_MB_EACH(__MB_FINISH)
+
+#undef __MB_START
+#undef __MB_ROUND
+#undef __MB_FINISH
+}
+
+// `steps' whole blocks of every busy lane (each has that many at least)
+__KEYSTREAM_AES_NI_TARGET
+void __keystream_aes_xor_multi_steps_ni(keystream_aes_lane_t *lanes, int rounds, size_t steps)
+{
+    alignas(16) uint8_t scratch[KEYSTREAM_AES_BLOCK_SIZE];
+
+    // idle lanes encrypt dummy blocks into scratch
+#define __MB_LOAD(l) \
+    keystream_aes_job_t *job##l = lanes[l].job; \
+    const uint8_t *rk##l = lanes[l].round_keys; \
+    uint8_t *d##l = job##l ? job##l->dptr : scratch; \
+    size_t stride##l = job##l ? KEYSTREAM_AES_BLOCK_SIZE : 0; \
+    uint64_t high##l = lanes[l].iv_high; \
+    uint64_t low##l = lanes[l].iv_low + (job##l ? job##l->ks->counter : 0);
+#define __MB_START(l) \
+    __m128i b##l = _mm_xor_si128(__keystream_aes_ni_counter(high##l, low##l++), \
+        _mm_load_si128((__m128i*)rk##l));
+#define __MB_ROUND(l) \
+    b##l = _mm_aesenc_si128(b##l, _mm_load_si128((__m128i*)(rk##l + r)));
+#define __MB_XOR(l) \
+    b##l = _mm_aesenclast_si128(b##l, _mm_load_si128((__m128i*)(rk##l + rounds * 16))); \
+    _mm_storeu_si128((__m128i*)d##l, _mm_xor_si128(b##l, _mm_loadu_si128((__m128i*)d##l))); \
+    d##l += stride##l;
+#define __MB_STORE(l) \
+    if (job##l != NULL) { \
+        job##l->dptr = d##l; \
+        job##l->size -= steps * KEYSTREAM_AES_BLOCK_SIZE; \
+        job##l->ks->counter += steps; \
+        if (job##l->size == 0) { lanes[l].job = NULL; } \
+    }
+
+    __KEYSTREAM_AES_MB_EACH(__MB_LOAD)
+
+    for (size_t step = 0; step < steps; ++step) {
+        __KEYSTREAM_AES_MB_EACH(__MB_START)
+        for (int r = 16; r < rounds * 16; r += 16) {
+            __KEYSTREAM_AES_MB_EACH(__MB_ROUND)
+        }
+        __KEYSTREAM_AES_MB_EACH(__MB_XOR)
+    }
+
+    __KEYSTREAM_AES_MB_EACH(__MB_STORE)
+
+#undef __MB_LOAD
+#undef __MB_START
+#undef __MB_ROUND
+#undef __MB_XOR
+#undef __MB_STORE
+}
+
+// the jobs with the given round count (their buffered keystream is used up),
+// jobs (dptr, size) and their streams are advanced past what was done; the
+// rest of a final partial block is buffered as the stream's keystream
+__KEYSTREAM_AES_NI_TARGET
+void __keystream_aes_xor_multi_ni(keystream_aes_job_t *jobs, int count, int rounds)
+{
+    keystream_aes_lane_t lanes[KEYSTREAM_AES_MULTI_LANES];
+    int next = 0;
+
+    memset(lanes, 0, sizeof(lanes));
+
+    for (;;) {
+        const uint8_t *any_round_keys = NULL;
+        size_t steps = SIZE_MAX;
+        int active = 0;
+
+        // idle lanes take the next jobs
+        for (int l = 0; l < KEYSTREAM_AES_MULTI_LANES; ++l) {
+            while ((lanes[l].job == NULL) && (next < count)) {
+                keystream_aes_job_t *job = &(jobs[next++]);
+
+                if ((job->ks->rounds == rounds) && (job->size > 0)
+                    && (job->size < KEYSTREAM_AES_MULTI_MAX_SPAN)) {
+                    __keystream_aes_lane_assign(&(lanes[l]), job);
+                }
+            }
+
+            if (lanes[l].job != NULL) {
+                any_round_keys = lanes[l].round_keys;
+                steps = MIN(steps, (lanes[l].job->size + KEYSTREAM_AES_BLOCK_SIZE - 1)
+                    / KEYSTREAM_AES_BLOCK_SIZE);
+                ++active;
+            }
+        }
+
+        // a few streams left: their own 8-block interleave does better
+        if ((active == 0) || ((next == count) && (active < KEYSTREAM_AES_MULTI_LANES / 2))) {
+            return;
+        }
+
+        for (int l = 0; l < KEYSTREAM_AES_MULTI_LANES; ++l) {
+            if (lanes[l].job == NULL) {
+                lanes[l].round_keys = any_round_keys;
+            }
+        }
+
+        // until the shortest job ends: whole blocks of all lanes, then one step
+        // that may take a partial block (and ends at least one job)
+        if (steps > 1) {
+            __keystream_aes_xor_multi_steps_ni(lanes, rounds, steps - 1);
+        }
+        __keystream_aes_xor_multi_step_ni(lanes, rounds);
+    }
+}
+
+#endif // SCALAR_X86
+
+
+//
+//  keystream_t interface
+//
+
+static bool keystream_aes_use_ni = false;
+static const char *keystream_aes_name = "portable";
+
+__attribute__((constructor))
+void __keystream_aes_select(void)
+{
+#if defined(SCALAR_X86)
+    if (cpu_features()->aesni) {
+        keystream_aes_use_ni = true;
+        keystream_aes_name = "aes-ni";
+    }
+#endif
+}
+
+const char *keystream_aes_engine_name(void)
+{
+    return keystream_aes_name;
+}
+
+void __keystream_aes_refill(keystream_aes_t *ks)
+{
+#if defined(SCALAR_X86)
+    if (keystream_aes_use_ni) {
+        __keystream_aes_xor_blocks_ni(ks, NULL, 1, ks->block);
+        ks->block_used = 0;
+        return;
+    }
+#endif
+
+    __keystream_aes_fill_portable(ks, ks->block, KEYSTREAM_AES_INTERLEAVE);
+    ks->block_used = 0;
+}
+
+void __keystream_aes_xor(keystream_t *base, uint8_t *dptr, size_t size)
+{
+    keystream_aes_t *ks = (keystream_aes_t*)base;
+    const size_t group_size = KEYSTREAM_AES_INTERLEAVE * KEYSTREAM_AES_BLOCK_SIZE;
+
+    // the rest of the buffered keystream first
+    if (ks->block_used < ks->block_size) {
+        size_t n = MIN(size, ks->block_size - ks->block_used);
+        xor_memory_region(dptr, ks->block + ks->block_used, n);
+        ks->block_used += n;
+        dptr += n;
+        size -= n;
+    }
+
+#if defined(SCALAR_X86)
+    // whole groups straight into the data (no intermediate buffer)
+    if (keystream_aes_use_ni && (size >= group_size)) {
+        size_t groups = size / group_size;
+        __keystream_aes_xor_blocks_ni(ks, dptr, groups, NULL);
+        dptr += groups * group_size;
+        size -= groups * group_size;
+    }
+#endif
+
+    while (size > 0) {
+        __keystream_aes_refill(ks);
+
+        size_t n = MIN(size, ks->block_size);
+        xor_memory_region(dptr, ks->block, n);
+        ks->block_used = n;
+        dptr += n;
+        size -= n;
+    }
+}
+
+bool keystream_aes_init(
+    keystream_aes_t *ks, const uint8_t *key, size_t key_size, const uint8_t *iv
+)
+{
+    memset(ks, 0, sizeof(keystream_aes_t));
+
+    if ((key_size != 16) && (key_size != 32)) {
+        fprintf(stderr, "ERROR: keystream_aes_init: unsupported key size: %zu\n", key_size);
+        return false;
+    }
+
+    ks->base.xor_func = __keystream_aes_xor;
+    ks->rounds = (key_size == 16) ? 10 : 14;
+    __keystream_aes_expand_key(ks, key, key_size);
+    memcpy(ks->iv, iv, KEYSTREAM_AES_IV_SIZE);
+
+    ks->block_size = KEYSTREAM_AES_INTERLEAVE * KEYSTREAM_AES_BLOCK_SIZE;
+    ks->block_used = ks->block_size; // no block generated yet
+
+    return true;
+}
+
+void keystream_aes_destroy(keystream_aes_t *ks)
+{
+    // wipe key material
+    explicit_bzero(ks, sizeof(keystream_aes_t));
+}
+
+void keystream_aes_xor_multi(keystream_aes_job_t *jobs, int count)
+{
+    // the rest of the buffered keystream first (whole blocks are aligned then)
+    for (int i = 0; i < count; ++i) {
+        keystream_aes_t *ks = jobs[i].ks;
+
+        if ((ks->block_used < ks->block_size) && (jobs[i].size > 0)) {
+            size_t n = MIN(jobs[i].size, ks->block_size - ks->block_used);
+            __keystream_aes_xor(&(ks->base), jobs[i].dptr, n);
+            jobs[i].dptr += n;
+            jobs[i].size -= n;
+        }
+    }
+
+#if defined(SCALAR_X86)
+    if (keystream_aes_use_ni) {
+        __keystream_aes_xor_multi_ni(jobs, count, 14);
+        __keystream_aes_xor_multi_ni(jobs, count, 10);
+    }
+#endif
+
+    // what is left: long spans, the last few streams (or everything, portable)
+    for (int i = 0; i < count; ++i) {
+        if (jobs[i].size > 0) {
+            __keystream_aes_xor(&(jobs[i].ks->base), jobs[i].dptr, jobs[i].size);
+            jobs[i].dptr += jobs[i].size;
+            jobs[i].size = 0;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __KEYSTREAM_AES_H
+#define __KEYSTREAM_AES_H
+
+#include "keystream.h"
+
+#define KEYSTREAM_AES_BLOCK_SIZE        16
+#define KEYSTREAM_AES_IV_SIZE           16
+#define KEYSTREAM_AES_MAX_ROUNDS        14
+
+// blocks encrypted per pass (AES-NI pipelines independent blocks)
+#define KEYSTREAM_AES_INTERLEAVE        8
+
+// AES-128/256-CTR: block[i] = AES(key, iv + i), the low 64 bits of the
+// counter block are a big-endian counter (NIST SP 800-38A layout)
+typedef struct __keystream_aes {
+    keystream_t base;
+    alignas(16) uint8_t round_keys[(KEYSTREAM_AES_MAX_ROUNDS + 1) * KEYSTREAM_AES_BLOCK_SIZE];
+    int rounds;                         // 10 (AES-128) or 14 (AES-256)
+    uint8_t iv[KEYSTREAM_AES_IV_SIZE];
+    uint64_t counter;                   // next block
+    alignas(16) uint8_t block[KEYSTREAM_AES_INTERLEAVE * KEYSTREAM_AES_BLOCK_SIZE];
+    uint32_t block_used;                // of the buffered keystream in block
+    uint32_t block_size;
+} keystream_aes_t;
+
+// one stream's part of a multi-buffer pass
+typedef struct __keystream_aes_job {
+    keystream_aes_t *ks;
+    uint8_t *dptr;
+    size_t size;
+} keystream_aes_job_t;
+
+// streams in flight in a multi-buffer pass (one block of each per step)
+#define KEYSTREAM_AES_MULTI_LANES       8
+
+// longer spans go through their stream's own 8-block interleave (faster alone)
+#ifndef KEYSTREAM_AES_MULTI_MAX_SPAN
+# define KEYSTREAM_AES_MULTI_MAX_SPAN   256
+#endif
+
+// key_size is 16 or 32 bytes; AES-NI is used when the CPU has it
+extern bool keystream_aes_init(
+    keystream_aes_t *ks, const uint8_t *key, size_t key_size, const uint8_t *iv
+);
+extern void keystream_aes_destroy(keystream_aes_t *ks);
+
+// xor many (small) spans of different streams in one pass: with AES-NI the
+// blocks of up to KEYSTREAM_AES_MULTI_LANES streams are interleaved, so short
+// spans still keep the pipeline full; the result is the same as calling
+// xor_func per job (at most one job per stream)
+extern void keystream_aes_xor_multi(keystream_aes_job_t *jobs, int count);
+
+// "aes-ni" or "portable" (the one keystream_aes_init picks)
+extern const char *keystream_aes_engine_name(void);
+
+#endif // __KEYSTREAM_AES_H
@@ -0,0 +1,162 @@
+#include "common.h"
+#include "keystream_chacha20.h"
+#include "cpu_features.h"
+#include "max_scalar.h"
+
+
+//
+//  kernels: one instantiation of keystream_chacha20_kernel.h per vector width
+//
+
+// portable: one block per call, plain 32-bit arithmetic
+#define __CK_NAME(name)                 name ## _portable
+#define __CK_TARGET
+#define __CK_SCALAR_T                   uint32_t
+#define __CK_LOAD_ALIGNED(ptr)          (*(uint32_t*)(ptr))
+#define __CK_STORE_ALIGNED(ptr, val)    (*(uint32_t*)(ptr) = (val))
+#define __CK_XOR(a, b)                  ((a) ^ (b))
+#define __CK_ADD32(a, b)                ((a) + (b))
+#define __CK_ROTL32(a, n)               (((a) << (n)) | ((a) >> (32 - (n))))
+#define __CK_SET1_32(v)                 (v)
+#include "keystream_chacha20_kernel.h"
+
+#if defined(SCALAR_X86)
+
+// SSE2: 4 blocks
+# define __CK_NAME(name)                name ## _sse2
+# define __CK_TARGET                    SCALAR128_TARGET
+# define __CK_SCALAR_T                  scalar128_t
+# define __CK_LOAD_ALIGNED(ptr)         SCALAR128_LOAD_ALIGNED(ptr)
+# define __CK_STORE_ALIGNED(ptr, val)   SCALAR128_STORE_ALIGNED(ptr, val)
+# define __CK_XOR(a, b)                 SCALAR128_XOR(a, b)
+# define __CK_ADD32(a, b)               SCALAR128_ADD32(a, b)
+# define __CK_ROTL32(a, n)              SCALAR128_ROTL32(a, n)
+# define __CK_SET1_32(v)                SCALAR128_SET1_32(v)
+# include "keystream_chacha20_kernel.h"
+
+// AVX2: 8 blocks
+# define __CK_NAME(name)                name ## _avx2
+# define __CK_TARGET                    SCALAR256_TARGET
+# define __CK_SCALAR_T                  scalar256_t
+# define __CK_LOAD_ALIGNED(ptr)         SCALAR256_LOAD_ALIGNED(ptr)
+# define __CK_STORE_ALIGNED(ptr, val)   SCALAR256_STORE_ALIGNED(ptr, val)
+# define __CK_XOR(a, b)                 SCALAR256_XOR(a, b)
+# define __CK_ADD32(a, b)               SCALAR256_ADD32(a, b)
+# define __CK_ROTL32(a, n)              SCALAR256_ROTL32(a, n)
+# define __CK_SET1_32(v)                SCALAR256_SET1_32(v)
+# define __CK_ROTL32_16(a)              SCALAR256_ROTL32_16(a)
+# define __CK_ROTL32_8(a)               SCALAR256_ROTL32_8(a)
+# include "keystream_chacha20_kernel.h"
+
+// AVX-512: 16 blocks (native 32-bit rotate)
+# define __CK_NAME(name)                name ## _avx512
+# define __CK_TARGET                    SCALAR512_TARGET
+# define __CK_SCALAR_T                  scalar512_t
+# define __CK_LOAD_ALIGNED(ptr)         SCALAR512_LOAD_ALIGNED(ptr)
+# define __CK_STORE_ALIGNED(ptr, val)   SCALAR512_STORE_ALIGNED(ptr, val)
+# define __CK_XOR(a, b)                 SCALAR512_XOR(a, b)
+# define __CK_ADD32(a, b)               SCALAR512_ADD32(a, b)
+# define __CK_ROTL32(a, n)              SCALAR512_ROTL32(a, n)
+# define __CK_SET1_32(v)                SCALAR512_SET1_32(v)
+# include "keystream_chacha20_kernel.h"
+
+#endif // SCALAR_X86
+
+
+//
+//  keystream_t interface
+//
+
+typedef void (*keystream_chacha20_blocks_func_t)(const uint32_t *input, uint8_t *out);
+
+static keystream_chacha20_blocks_func_t keystream_chacha20_blocks = __keystream_chacha20_blocks_portable;
+static uint32_t keystream_chacha20_lanes = 1;
+static const char *keystream_chacha20_name = "portable";
+
+__attribute__((constructor))
+void __keystream_chacha20_select(void)
+{
+#if defined(SCALAR_X86)
+    const cpu_features_t *features = cpu_features();
+
+    if (features->avx512f) {
+        keystream_chacha20_blocks = __keystream_chacha20_blocks_avx512;
+        keystream_chacha20_lanes = 16;
+        keystream_chacha20_name = "avx512";
+    } else if (features->avx2) {
+        keystream_chacha20_blocks = __keystream_chacha20_blocks_avx2;
+        keystream_chacha20_lanes = 8;
+        keystream_chacha20_name = "avx2";
+    } else if (features->sse2) {
+        keystream_chacha20_blocks = __keystream_chacha20_blocks_sse2;
+        keystream_chacha20_lanes = 4;
+        keystream_chacha20_name = "sse2";
+    }
+#endif
+}
+
+const char *keystream_chacha20_engine_name(void)
+{
+    return keystream_chacha20_name;
+}
+
+void __keystream_chacha20_refill(keystream_chacha20_t *ks)
+{
+    uint64_t counter = (uint64_t)ks->input[12] | ((uint64_t)ks->input[13] << 32);
+
+    keystream_chacha20_blocks(ks->input, ks->block);
+
+    counter += keystream_chacha20_lanes;
+    ks->input[12] = (uint32_t)counter;
+    ks->input[13] = (uint32_t)(counter >> 32);
+    ks->block_used = 0;
+}
+
+void __keystream_chacha20_xor(keystream_t *base, uint8_t *dptr, size_t size)
+{
+    keystream_chacha20_t *ks = (keystream_chacha20_t*)base;
+
+    // the rest of the buffered keystream first
+    if (ks->block_used < ks->block_size) {
+        size_t n = MIN(size, ks->block_size - ks->block_used);
+        xor_memory_region(dptr, ks->block + ks->block_used, n);
+        ks->block_used += n;
+        dptr += n;
+        size -= n;
+    }
+
+    // one kernel pass per group (L1-hot between generation and xor)
+    while (size > 0) {
+        __keystream_chacha20_refill(ks);
+
+        size_t n = MIN(size, ks->block_size);
+        xor_memory_region(dptr, ks->block, n);
+        ks->block_used = n;
+        dptr += n;
+        size -= n;
+    }
+}
+
+void keystream_chacha20_init(keystream_chacha20_t *ks, const uint8_t *key, const uint8_t *nonce)
+{
+    memset(ks, 0, sizeof(keystream_chacha20_t));
+
+    ks->base.xor_func = __keystream_chacha20_xor;
+
+    // "expand 32-byte k", key, counter = 0, nonce (little-endian words)
+    ks->input[0] = 0x61707865;
+    ks->input[1] = 0x3320646e;
+    ks->input[2] = 0x79622d32;
+    ks->input[3] = 0x6b206574;
+    memcpy(ks->input + 4, key, KEYSTREAM_CHACHA20_KEY_SIZE);
+    memcpy(ks->input + 14, nonce, KEYSTREAM_CHACHA20_NONCE_SIZE);
+
+    ks->block_size = keystream_chacha20_lanes * KEYSTREAM_CHACHA20_BLOCK_SIZE;
+    ks->block_used = ks->block_size; // no block generated yet
+}
+
+void keystream_chacha20_destroy(keystream_chacha20_t *ks)
+{
+    // wipe key material
+    explicit_bzero(ks, sizeof(keystream_chacha20_t));
+}
@@ -0,0 +1,30 @@
+#ifndef __KEYSTREAM_CHACHA20_H
+#define __KEYSTREAM_CHACHA20_H
+
+#include "keystream.h"
+
+#define KEYSTREAM_CHACHA20_KEY_SIZE     32
+#define KEYSTREAM_CHACHA20_NONCE_SIZE   8
+#define KEYSTREAM_CHACHA20_BLOCK_SIZE   64
+
+// blocks generated per pass by the widest kernel (AVX-512: one block per lane)
+#define KEYSTREAM_CHACHA20_MAX_LANES    16
+
+// ChaCha20 (original layout): 64-bit little-endian block counter in words 12-13,
+// 64-bit nonce in words 14-15, block[i] = ChaCha20(key, nonce, i)
+typedef struct __keystream_chacha20 {
+    keystream_t base;
+    uint32_t input[16];                 // words 12-13: next block
+    alignas(16) uint8_t block[KEYSTREAM_CHACHA20_MAX_LANES * KEYSTREAM_CHACHA20_BLOCK_SIZE];
+    uint32_t block_used;                // of the buffered keystream in block
+    uint32_t block_size;
+} keystream_chacha20_t;
+
+// SSE2/AVX2/AVX-512 multi-block kernels are used when the CPU has them
+extern void keystream_chacha20_init(keystream_chacha20_t *ks, const uint8_t *key, const uint8_t *nonce);
+extern void keystream_chacha20_destroy(keystream_chacha20_t *ks);
+
+// "avx512", "avx2", "sse2" or "portable" (the one keystream_chacha20_init picks)
+extern const char *keystream_chacha20_engine_name(void);
+
+#endif // __KEYSTREAM_CHACHA20_H
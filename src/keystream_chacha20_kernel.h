@@ -0,0 +1,102 @@
+//
+//  ChaCha20 multi-block kernel template (no include guard: it is included by
+//  keystream_chacha20.c once per vector width)
+//
+//  the state is word-major: a vector holds the same word of adjacent blocks
+//  (one block per 32-bit lane), so the rounds run on all blocks at once with
+//  plain adds/xors/rotates and no shuffles; the result is transposed into
+//  block-major keystream on the way out
+//
+//  expects to be defined:
+//    __CK_NAME(name)               decorates the generated function names
+//    __CK_TARGET                   function attributes (target ISA) or empty
+//    __CK_SCALAR_T                 vector type
+//    __CK_LOAD_ALIGNED(ptr)        aligned load
+//    __CK_STORE_ALIGNED(ptr, val)  aligned store
+//    __CK_XOR(a, b), __CK_ADD32(a, b), __CK_ROTL32(a, n)
+//    __CK_SET1_32(v)               broadcast to all lanes
+//  and optionally:
+//    __CK_ROTL32_16(a), __CK_ROTL32_8(a)   byte-granular rotates (shuffles)
+//
+
+#define __CK_LANES              (sizeof(__CK_SCALAR_T) / sizeof(uint32_t))
+#ifndef __CK_ROTL32_16
+# define __CK_ROTL32_16(a)      __CK_ROTL32(a, 16)
+# define __CK_ROTL32_8(a)       __CK_ROTL32(a, 8)
+#endif
+#define __CK_QR(a, b, c, d) \
+    a = __CK_ADD32(a, b); d = __CK_XOR(d, a); d = __CK_ROTL32_16(d); \
+    c = __CK_ADD32(c, d); b = __CK_XOR(b, c); b = __CK_ROTL32(b, 12); \
+    a = __CK_ADD32(a, b); d = __CK_XOR(d, a); d = __CK_ROTL32_8(d);  \
+    c = __CK_ADD32(c, d); b = __CK_XOR(b, c); b = __CK_ROTL32(b, 7);
+
+// __CK_LANES blocks starting at the counter in input[12..13] into out
+// (__CK_LANES * 64 bytes); the caller advances the counter
+__CK_TARGET
+void __CK_NAME(__keystream_chacha20_blocks)(const uint32_t *input, uint8_t *out)
+{
+    alignas(64) uint32_t counter_low[__CK_LANES], counter_high[__CK_LANES];
+    alignas(64) uint32_t words[16][__CK_LANES];
+    uint64_t counter = (uint64_t)input[12] | ((uint64_t)input[13] << 32);
+    __CK_SCALAR_T x[16];
+
+    for (size_t l = 0; l < __CK_LANES; ++l) {
+        counter_low[l] = (uint32_t)(counter + l);
+        counter_high[l] = (uint32_t)((counter + l) >> 32);
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        x[i] = __CK_SET1_32(input[i]);
+    }
+    x[12] = __CK_LOAD_ALIGNED(counter_low);
+    x[13] = __CK_LOAD_ALIGNED(counter_high);
+
+    for (int i = 0; i < 10; ++i) {
+        __CK_QR(x[0], x[4], x[8],  x[12]);
+        __CK_QR(x[1], x[5], x[9],  x[13]);
+        __CK_QR(x[2], x[6], x[10], x[14]);
+        __CK_QR(x[3], x[7], x[11], x[15]);
+        __CK_QR(x[0], x[5], x[10], x[15]);
+        __CK_QR(x[1], x[6], x[11], x[12]);
+        __CK_QR(x[2], x[7], x[8],  x[13]);
+        __CK_QR(x[3], x[4], x[9],  x[14]);
+    }
+
+    // feed-forward (counters per lane), then word-major -> block-major
+    for (int i = 0; i < 16; ++i) {
+        __CK_SCALAR_T in;
+
+        if (i == 12) {
+            in = __CK_LOAD_ALIGNED(counter_low);
+        } else if (i == 13) {
+            in = __CK_LOAD_ALIGNED(counter_high);
+        } else {
+            in = __CK_SET1_32(input[i]);
+        }
+        __CK_STORE_ALIGNED(words[i], __CK_ADD32(x[i], in));
+    }
+
+    // little-endian output (host order on supported targets)
+    for (size_t l = 0; l < __CK_LANES; ++l) {
+        uint32_t *block = (uint32_t*)(out + l * KEYSTREAM_CHACHA20_BLOCK_SIZE);
+
+        for (int i = 0; i < 16; ++i) {
+            block[i] = words[i][l];
+        }
+    }
+}
+
+#undef __CK_QR
+#undef __CK_LANES
+
+#undef __CK_NAME
+#undef __CK_TARGET
+#undef __CK_SCALAR_T
+#undef __CK_LOAD_ALIGNED
+#undef __CK_STORE_ALIGNED
+#undef __CK_XOR
+#undef __CK_ADD32
+#undef __CK_ROTL32
+#undef __CK_SET1_32
+#undef __CK_ROTL32_16
+#undef __CK_ROTL32_8
@@ -3,15 +3,56 @@
 
 
 //
-//  AVX2
+//  x86: all vector types are declared regardless of compiler flags, so the
+//  wider ones are usable in functions marked with SCALAR*_TARGET (picked at
+//  runtime, see cpu_features.h)
 //
 
-#if defined(__AVX2__)
+#if defined(__x86_64__) || defined(__i386__)
 
-# define MAX_SCALAR_SIZE                        256
+# define SCALAR_X86
 
 # include <immintrin.h>
 
+#endif // __x86_64__ || __i386__
+
+
+//
+//  AVX-512
+//
+
+#if defined(SCALAR_X86)
+
+# define SCALAR512_TARGET                       __attribute__((target("avx512f")))
+
+typedef __m512i scalar512_t;
+
+# define SCALAR512_LOAD(ptr)                    _mm512_loadu_si512((void*)(ptr))
+# define SCALAR512_LOAD_ALIGNED(ptr)            _mm512_load_si512((void*)(ptr))
+# define SCALAR512_STORE(ptr, val)              _mm512_storeu_si512((void*)(ptr), (val))
+# define SCALAR512_STORE_ALIGNED(ptr, val)      _mm512_store_si512((void*)(ptr), (val))
+# define SCALAR512_XOR(a, b)                    _mm512_xor_si512((a), (b))
+# define SCALAR512_OR(a, b)                     _mm512_or_si512((a), (b))
+# define SCALAR512_ADD64(a, b)                  _mm512_add_epi64((a), (b))
+# define SCALAR512_SHL64(a, n)                  _mm512_slli_epi64((a), (n))
+# define SCALAR512_SHR64(a, n)                  _mm512_srli_epi64((a), (n))
+# define SCALAR512_ADD32(a, b)                  _mm512_add_epi32((a), (b))
+# define SCALAR512_SHL32(a, n)                  _mm512_slli_epi32((a), (n))
+# define SCALAR512_SHR32(a, n)                  _mm512_srli_epi32((a), (n))
+# define SCALAR512_SET1_32(v)                   _mm512_set1_epi32((int)(v))
+# define SCALAR512_ROTL32(a, n)                 _mm512_rol_epi32((a), (n))
+
+#endif // SCALAR_X86
+
+
+//
+//  AVX2
+//
+
+#if defined(SCALAR_X86)
+
+# define SCALAR256_TARGET                       __attribute__((target("avx2")))
+
 typedef __m256i scalar256_t;
 
 # define SCALAR256_LOAD(ptr)                    _mm256_loadu_si256((__m256i*)(ptr))
@@ -19,21 +60,36 @@ typedef __m256i scalar256_t;
 # define SCALAR256_STORE(ptr, val)              _mm256_storeu_si256((__m256i*)(ptr), (val))
 # define SCALAR256_STORE_ALIGNED(ptr, val)      _mm256_store_si256((__m256i*)(ptr), (val))
 # define SCALAR256_XOR(a, b)                    _mm256_xor_si256((a), (b))
-
-#endif // __AVX2__
+# define SCALAR256_OR(a, b)                     _mm256_or_si256((a), (b))
+# define SCALAR256_ADD64(a, b)                  _mm256_add_epi64((a), (b))
+# define SCALAR256_SHL64(a, n)                  _mm256_slli_epi64((a), (n))
+# define SCALAR256_SHR64(a, n)                  _mm256_srli_epi64((a), (n))
+# define SCALAR256_ADD32(a, b)                  _mm256_add_epi32((a), (b))
+# define SCALAR256_SHL32(a, n)                  _mm256_slli_epi32((a), (n))
+# define SCALAR256_SHR32(a, n)                  _mm256_srli_epi32((a), (n))
+# define SCALAR256_ROTL32(a, n) \
+    SCALAR256_OR(SCALAR256_SHL32((a), (n)), SCALAR256_SHR32((a), 32 - (n)))
+# define SCALAR256_SET1_32(v)                   _mm256_set1_epi32((int)(v))
+// rotates by whole bytes as one shuffle (instead of two shifts and an or)
+# define SCALAR256_ROTL32_16(a) \
+    _mm256_shuffle_epi8((a), _mm256_set_epi8( \
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2, \
+        13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2))
+# define SCALAR256_ROTL32_8(a) \
+    _mm256_shuffle_epi8((a), _mm256_set_epi8( \
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3, \
+        14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3))
+
+#endif // SCALAR_X86
 
 
 //
 //  SSE2
 //
 
-#if defined(__SSE2__)
+#if defined(SCALAR_X86)
 
-# ifndef MAX_SCALAR_SIZE
-#  define MAX_SCALAR_SIZE                       128
-# endif // MAX_SCALAR_SIZE
-
-# include <emmintrin.h>
+# define SCALAR128_TARGET                       __attribute__((target("sse2")))
 
 typedef __m128i scalar128_t;
 
@@ -42,15 +98,52 @@ typedef __m128i scalar128_t;
 # define SCALAR128_STORE(ptr, val)              _mm_storeu_si128((__m128i*)(ptr), (val))
 # define SCALAR128_STORE_ALIGNED(ptr, val)      _mm_storeu_si128((__m128i*)(ptr), (val))
 # define SCALAR128_XOR(a, b)                    _mm_xor_si128((a), (b))
+# define SCALAR128_OR(a, b)                     _mm_or_si128((a), (b))
+# define SCALAR128_ADD64(a, b)                  _mm_add_epi64((a), (b))
+# define SCALAR128_SHL64(a, n)                  _mm_slli_epi64((a), (n))
+# define SCALAR128_SHR64(a, n)                  _mm_srli_epi64((a), (n))
+# define SCALAR128_ADD32(a, b)                  _mm_add_epi32((a), (b))
+# define SCALAR128_SHL32(a, n)                  _mm_slli_epi32((a), (n))
+# define SCALAR128_SHR32(a, n)                  _mm_srli_epi32((a), (n))
+# define SCALAR128_ROTL32(a, n) \
+    SCALAR128_OR(SCALAR128_SHL32((a), (n)), SCALAR128_SHR32((a), 32 - (n)))
+# define SCALAR128_SET1_32(v)                   _mm_set1_epi32((int)(v))
 
-#endif // __SSE2__
+#endif // SCALAR_X86
 
 
 //
-//  MAX_SCALAR
+//  MAX_SCALAR (the widest one enabled at compile time)
 //
 
-#if (MAX_SCALAR_SIZE == 256)
+#if defined(__AVX512F__)
+# define MAX_SCALAR_SIZE                        512
+#elif defined(__AVX2__)
+# define MAX_SCALAR_SIZE                        256
+#elif defined(__SSE2__)
+# define MAX_SCALAR_SIZE                        128
+#endif
+
+#if (MAX_SCALAR_SIZE == 512)
+
+typedef __m512i max_scalar_t;
+
+# define MAX_SCALAR_LOAD(ptr)                   SCALAR512_LOAD(ptr)
+# define MAX_SCALAR_LOAD_ALIGNED(ptr)           SCALAR512_LOAD_ALIGNED(ptr)
+# define MAX_SCALAR_STORE(ptr, val)             SCALAR512_STORE(ptr, val)
+# define MAX_SCALAR_STORE_ALIGNED(ptr, val)     SCALAR512_STORE_ALIGNED(ptr, val)
+# define MAX_SCALAR_XOR(a, b)                   SCALAR512_XOR(a, b)
+# define MAX_SCALAR_OR(a, b)                    SCALAR512_OR(a, b)
+# define MAX_SCALAR_ADD64(a, b)                 SCALAR512_ADD64(a, b)
+# define MAX_SCALAR_SHL64(a, n)                 SCALAR512_SHL64(a, n)
+# define MAX_SCALAR_SHR64(a, n)                 SCALAR512_SHR64(a, n)
+# define MAX_SCALAR_ADD32(a, b)                 SCALAR512_ADD32(a, b)
+# define MAX_SCALAR_SHL32(a, n)                 SCALAR512_SHL32(a, n)
+# define MAX_SCALAR_SHR32(a, n)                 SCALAR512_SHR32(a, n)
+# define MAX_SCALAR_SET1_32(v)                  SCALAR512_SET1_32(v)
+# define MAX_SCALAR_ROTL32(a, n)                SCALAR512_ROTL32(a, n)
+
+#elif (MAX_SCALAR_SIZE == 256)
 
 typedef __m256i max_scalar_t;
 
@@ -59,6 +152,15 @@ typedef __m256i max_scalar_t;
 # define MAX_SCALAR_STORE(ptr, val)             SCALAR256_STORE(ptr, val)
 # define MAX_SCALAR_STORE_ALIGNED(ptr, val)     SCALAR256_STORE_ALIGNED(ptr, val)
 # define MAX_SCALAR_XOR(a, b)                   SCALAR256_XOR(a, b)
+# define MAX_SCALAR_OR(a, b)                    SCALAR256_OR(a, b)
+# define MAX_SCALAR_ADD64(a, b)                 SCALAR256_ADD64(a, b)
+# define MAX_SCALAR_SHL64(a, n)                 SCALAR256_SHL64(a, n)
+# define MAX_SCALAR_SHR64(a, n)                 SCALAR256_SHR64(a, n)
+# define MAX_SCALAR_ADD32(a, b)                 SCALAR256_ADD32(a, b)
+# define MAX_SCALAR_SHL32(a, n)                 SCALAR256_SHL32(a, n)
+# define MAX_SCALAR_SHR32(a, n)                 SCALAR256_SHR32(a, n)
+# define MAX_SCALAR_SET1_32(v)                  SCALAR256_SET1_32(v)
+# define MAX_SCALAR_ROTL32(a, n)                SCALAR256_ROTL32(a, n)
 
 #elif (MAX_SCALAR_SIZE == 128)
 
@@ -69,6 +171,15 @@ typedef __m128i max_scalar_t;
 # define MAX_SCALAR_STORE(ptr, val)             SCALAR128_STORE(ptr, val)
 # define MAX_SCALAR_STORE_ALIGNED(ptr, val)     SCALAR128_STORE_ALIGNED(ptr, val)
 # define MAX_SCALAR_XOR(a, b)                   SCALAR128_XOR(a, b)
+# define MAX_SCALAR_OR(a, b)                    SCALAR128_OR(a, b)
+# define MAX_SCALAR_ADD64(a, b)                 SCALAR128_ADD64(a, b)
+# define MAX_SCALAR_SHL64(a, n)                 SCALAR128_SHL64(a, n)
+# define MAX_SCALAR_SHR64(a, n)                 SCALAR128_SHR64(a, n)
+# define MAX_SCALAR_ADD32(a, b)                 SCALAR128_ADD32(a, b)
+# define MAX_SCALAR_SHL32(a, n)                 SCALAR128_SHL32(a, n)
+# define MAX_SCALAR_SHR32(a, n)                 SCALAR128_SHR32(a, n)
+# define MAX_SCALAR_SET1_32(v)                  SCALAR128_SET1_32(v)
+# define MAX_SCALAR_ROTL32(a, n)                SCALAR128_ROTL32(a, n)
 
 #else
 
@@ -86,7 +197,7 @@ typedef uint32_t max_scalar_t;
 # define MAX_SCALAR_XOR(a, b)                   ((a) ^ (b))
 # define MAX_SCALAR_STORE(ptr, val)             (*(max_scalar_t*)(ptr) = (val))
 
-#endif // MAX_SCALAR_SIZE 256/128/(64/32)
+#endif // MAX_SCALAR_SIZE 512/256/128/(64/32)
 
 #define MAX_SCALAR_BYTES                        ((MAX_SCALAR_SIZE) >> 3)
 #define MAX_SCALAR_ALIGN_MASK                   (~((MAX_SCALAR_BYTES) - 1))
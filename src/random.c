@@ -1,67 +1,307 @@
 #include "random.h"
+#include "cpu_features.h"
+#include "keystream_chacha20.h"
+#include "max_scalar.h"
 
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include <pthread.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/random.h>
-#include <sys/time.h>
 
-bool do_use_prng = false;
+typedef struct __random_pool {
+    uint32_t key[8];                    // KEYSTREAM_CHACHA20_KEY_SIZE
+    uint8_t data[RANDOM_POOL_SIZE];
+    size_t available;                   // unused bytes at the end of data
+    size_t served;                      // since the last reseed
+    unsigned fork_generation;
+    bool seeded;
+} random_pool_t;
+
+static _Thread_local random_pool_t random_pool;
+
+// bumped in the child after fork(): pools copied from the parent reseed
+static atomic_uint random_fork_generation = 0;
+static pthread_once_t random_atfork_once = PTHREAD_ONCE_INIT;
+
+void __random_on_fork_child(void) {
+    atomic_fetch_add(&random_fork_generation, 1);
+}
 
-void set_use_prng(bool use) {
-    do_use_prng = use;
+void __random_atfork_init(void) {
+    pthread_atfork(NULL, NULL, __random_on_fork_child);
 }
 
-uint32_t xoshiro128plus(uint32_t *state) {
-    uint32_t result = state[0] + state[3];
+//
+//  Filler data: xoshiro256++ in RANDOM_PRNG_LANES lanes, persistent per thread
+//  (seeded once from getrandom(); its state can be recovered from the output,
+//  so it is never used by fill_random())
+//
 
-    uint32_t t = state[1] << 9;
+typedef struct __random_prng {
+    alignas(64) uint64_t state[4][RANDOM_PRNG_LANES];
+    unsigned fork_generation;
+    bool seeded;
+} random_prng_t;
 
-    state[2] ^= state[0];
-    state[3] ^= state[1];
-    state[1] ^= state[2];
-    state[0] ^= state[3];
+static _Thread_local random_prng_t random_prng;
 
-    state[2] ^= t;
+void __random_xoshiro_fill_simple(uint64_t (*state)[RANDOM_PRNG_LANES], uint8_t *buf, size_t blocks)
+{
+    for (; blocks > 0; --blocks, buf += RANDOM_PRNG_BLOCK) {
+        for (int l = 0; l < RANDOM_PRNG_LANES; ++l) {
+            uint64_t s0 = state[0][l], s1 = state[1][l], s2 = state[2][l], s3 = state[3][l];
+            uint64_t result = ((s0 + s3) << 23 | (s0 + s3) >> 41) + s0;
+            uint64_t t = s1 << 17;
 
-    state[3] = (state[3] << 11) | (state[3] >> (32 - 11));
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+            s2 ^= t;
+            s3 = (s3 << 45) | (s3 >> 19);
 
-    return result;
+            state[0][l] = s0; state[1][l] = s1; state[2][l] = s2; state[3][l] = s3;
+            memcpy(buf + l * sizeof(uint64_t), &result, sizeof(result));
+        }
+    }
 }
 
-#include <stdio.h>
+#if (MAX_SCALAR_SIZE > 64)
+
+// generic: the widest scalar enabled at compile time
+# define __PK_NAME(name)                name ## _generic
+# define __PK_TARGET
+# define __PK_SCALAR_T                  max_scalar_t
+# define __PK_LOAD_ALIGNED(ptr)         MAX_SCALAR_LOAD_ALIGNED(ptr)
+# define __PK_STORE(ptr, val)           MAX_SCALAR_STORE(ptr, val)
+# define __PK_STORE_ALIGNED(ptr, val)   MAX_SCALAR_STORE_ALIGNED(ptr, val)
+# define __PK_XOR(a, b)                 MAX_SCALAR_XOR(a, b)
+# define __PK_OR(a, b)                  MAX_SCALAR_OR(a, b)
+# define __PK_ADD64(a, b)               MAX_SCALAR_ADD64(a, b)
+# define __PK_SHL64(a, n)               MAX_SCALAR_SHL64(a, n)
+# define __PK_SHR64(a, n)               MAX_SCALAR_SHR64(a, n)
+# include "random_xoshiro.h"
+
+#else
+
+void __random_xoshiro_fill_generic(uint64_t (*state)[RANDOM_PRNG_LANES], uint8_t *buf, size_t blocks)
+{
+    __random_xoshiro_fill_simple(state, buf, blocks);
+}
+
+#endif // (MAX_SCALAR_SIZE > 64)
+
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 256)
+
+// AVX2 (picked at runtime)
+# define __PK_NAME(name)                name ## _avx2
+# define __PK_TARGET                    SCALAR256_TARGET
+# define __PK_SCALAR_T                  scalar256_t
+# define __PK_LOAD_ALIGNED(ptr)         SCALAR256_LOAD_ALIGNED(ptr)
+# define __PK_STORE(ptr, val)           SCALAR256_STORE(ptr, val)
+# define __PK_STORE_ALIGNED(ptr, val)   SCALAR256_STORE_ALIGNED(ptr, val)
+# define __PK_XOR(a, b)                 SCALAR256_XOR(a, b)
+# define __PK_OR(a, b)                  SCALAR256_OR(a, b)
+# define __PK_ADD64(a, b)               SCALAR256_ADD64(a, b)
+# define __PK_SHL64(a, n)               SCALAR256_SHL64(a, n)
+# define __PK_SHR64(a, n)               SCALAR256_SHR64(a, n)
+# include "random_xoshiro.h"
+
+#endif // SCALAR_X86 && (MAX_SCALAR_SIZE < 256)
+
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 512)
+
+// AVX-512 (picked at runtime)
+# define __PK_NAME(name)                name ## _avx512
+# define __PK_TARGET                    SCALAR512_TARGET
+# define __PK_SCALAR_T                  scalar512_t
+# define __PK_LOAD_ALIGNED(ptr)         SCALAR512_LOAD_ALIGNED(ptr)
+# define __PK_STORE(ptr, val)           SCALAR512_STORE(ptr, val)
+# define __PK_STORE_ALIGNED(ptr, val)   SCALAR512_STORE_ALIGNED(ptr, val)
+# define __PK_XOR(a, b)                 SCALAR512_XOR(a, b)
+# define __PK_OR(a, b)                  SCALAR512_OR(a, b)
+# define __PK_ADD64(a, b)               SCALAR512_ADD64(a, b)
+# define __PK_SHL64(a, n)               SCALAR512_SHL64(a, n)
+# define __PK_SHR64(a, n)               SCALAR512_SHR64(a, n)
+# include "random_xoshiro.h"
+
+#endif // SCALAR_X86 && (MAX_SCALAR_SIZE < 512)
+
+typedef void (*random_xoshiro_fill_func_t)(
+    uint64_t (*state)[RANDOM_PRNG_LANES], uint8_t *buf, size_t blocks);
+
+static random_xoshiro_fill_func_t random_xoshiro_fill_func = __random_xoshiro_fill_generic;
+static const char *random_xoshiro_name = "generic";
+
+__attribute__((constructor))
+void __random_xoshiro_select(void)
+{
+    __attribute__((unused)) const cpu_features_t *features = cpu_features();
+
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 512)
+    if (features->avx512f) {
+        random_xoshiro_fill_func = __random_xoshiro_fill_avx512;
+        random_xoshiro_name = "avx512";
+        return;
+    }
+#endif
+
+#if defined(SCALAR_X86) && (MAX_SCALAR_SIZE < 256)
+    if (features->avx2) {
+        random_xoshiro_fill_func = __random_xoshiro_fill_avx2;
+        random_xoshiro_name = "avx2";
+        return;
+    }
+#endif
+
+#if (MAX_SCALAR_SIZE <= 64)
+    random_xoshiro_fill_func = __random_xoshiro_fill_simple;
+    random_xoshiro_name = "simple";
+#endif
+}
+
+const char *prng_kernel_name(void)
+{
+    return random_xoshiro_name;
+}
+
+void prng_seed(uint64_t seed) {
+    random_prng_t *prng = &random_prng;
+
+    // splitmix64 expands the seed (as recommended for xoshiro), lane by lane
+    for (int l = 0; l < RANDOM_PRNG_LANES; ++l) {
+        for (int w = 0; w < 4; ++w) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            prng->state[w][l] = z ^ (z >> 31);
+        }
+    }
+
+    prng->fork_generation = atomic_load(&random_fork_generation);
+    prng->seeded = true;
+}
 
 ssize_t fill_prng_random(uint8_t *buf, size_t max) {
-    uint32_t state[4];
-    struct timeval tm;
-
-    // fill state using time and pid as a seed
-    gettimeofday(&tm, NULL);
-    uint32_t seed = ((uint32_t)tm.tv_sec + (uint32_t)getpid()) ^ (uint32_t)tm.tv_usec;
-    for (int i = 0; i < 4; i++) {
-        seed = state[i] = (seed * 0x1b1 + i);
+    random_prng_t *prng = &random_prng;
+    uint8_t tail[RANDOM_PRNG_BLOCK];
+
+    // seed once per thread (and again in a forked child: no shared sequences)
+    if (!prng->seeded || (prng->fork_generation != atomic_load(&random_fork_generation))) {
+        pthread_once(&random_atfork_once, __random_atfork_init);
+
+        if (getrandom(prng->state, sizeof(prng->state), 0) != sizeof(prng->state)) {
+            perror("failed to seed prng");
+            return -1;
+        }
+
+        // an all-zero lane would stay zero
+        for (int l = 0; l < RANDOM_PRNG_LANES; ++l) {
+            prng->state[0][l] |= 1;
+        }
+
+        prng->fork_generation = atomic_load(&random_fork_generation);
+        prng->seeded = true;
     }
 
-    // fill data
-    ssize_t filled = 0;
-    size_t max_ = (max / sizeof(uint32_t)) * sizeof(uint32_t);
-    for (; filled < max_; filled += sizeof(uint32_t)) {
-        uint32_t next = xoshiro128plus(state);
-        *((uint32_t*)(buf + filled)) = next;
+    size_t blocks = max / RANDOM_PRNG_BLOCK;
+    if (blocks > 0) {
+        random_xoshiro_fill_func(prng->state, buf, blocks);
+    }
+
+    size_t rest = max - blocks * RANDOM_PRNG_BLOCK;
+    if (rest > 0) {
+        random_xoshiro_fill_func(prng->state, tail, 1);
+        memcpy(buf + blocks * RANDOM_PRNG_BLOCK, tail, rest);
     }
-    if (filled < max) {
-        uint32_t next = xoshiro128plus(state);
-        for (; filled < max; ++filled) {
-            *(buf+filled) = (uint8_t)next;
-            next >>= 8;
+
+    return (ssize_t)max;
+}
+
+void prng_fill(uint8_t *buf, size_t size) {
+    if (fill_prng_random(buf, size) < 0) {
+        abort();
+    }
+}
+
+
+bool __random_pool_seed(random_pool_t *pool) {
+    uint8_t seed[sizeof(pool->key)];
+    size_t filled = 0;
+
+    pthread_once(&random_atfork_once, __random_atfork_init);
+
+    while (filled < sizeof(seed)) {
+        ssize_t n = getrandom(seed + filled, sizeof(seed) - filled, 0);
+        if (n < 0) {
+            return false;
         }
+        filled += n;
     }
 
-    return filled;
+    memcpy(pool->key, seed, sizeof(pool->key));
+    explicit_bzero(seed, sizeof(seed));
+
+    pool->available = 0;
+    pool->served = 0;
+    pool->fork_generation = atomic_load(&random_fork_generation);
+    pool->seeded = true;
+
+    return true;
+}
+
+void __random_pool_refill(random_pool_t *pool) {
+    static const uint8_t nonce[KEYSTREAM_CHACHA20_NONCE_SIZE] = {0};
+    keystream_chacha20_t ks;
+
+    // the keystream engine's blocks 0.. of the current key (its SIMD kernel
+    // generates the whole pool in a few passes)
+    keystream_chacha20_init(&ks, (const uint8_t*)pool->key, nonce);
+    memset(pool->data, 0, RANDOM_POOL_SIZE);
+    ks.base.xor_func(&(ks.base), pool->data, RANDOM_POOL_SIZE);
+    keystream_chacha20_destroy(&ks);
+
+    // fast key erasure: the first 32 bytes are the next key (never served)
+    memcpy(pool->key, pool->data, sizeof(pool->key));
+    explicit_bzero(pool->data, sizeof(pool->key));
+    pool->available = RANDOM_POOL_SIZE - sizeof(pool->key);
+}
+
+ssize_t fill_pool_random(uint8_t *buf, size_t max) {
+    random_pool_t *pool = &random_pool;
+
+    if (!pool->seeded
+        || (pool->served >= RANDOM_POOL_RESEED_BYTES)
+        || (pool->fork_generation != atomic_load(&random_fork_generation))) {
+        if (!__random_pool_seed(pool)) {
+            return -1;
+        }
+    }
+
+    if (pool->available == 0) {
+        __random_pool_refill(pool);
+    }
+
+    // served bytes are wiped from the pool (no backtracking)
+    size_t n = (max < pool->available) ? max : pool->available;
+    uint8_t *src = pool->data + RANDOM_POOL_SIZE - pool->available;
+
+    memcpy(buf, src, n);
+    explicit_bzero(src, n);
+
+    pool->available -= n;
+    pool->served += n;
+
+    return (ssize_t)n;
 }
 
 ssize_t fill_random_next(uint8_t *buf, size_t max) {
-    return do_use_prng
-        ? fill_prng_random(buf, max)
-        : getrandom(buf, max, 0);
+    // key material, entropy and nonces: the ChaCha20 pool only
+    return fill_pool_random(buf, max);
 }
 
 ssize_t fill_random(uint8_t *buf, size_t max) {
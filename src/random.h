@@ -4,9 +4,45 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
-extern void set_use_prng(bool use);
+// per-thread pool: ChaCha20 keystream (fast key erasure), served from memory
+#ifndef RANDOM_POOL_SIZE
+# define RANDOM_POOL_SIZE           1024
+#endif
+
+// reseed from getrandom() after this many bytes served by a thread
+#ifndef RANDOM_POOL_RESEED_BYTES
+# define RANDOM_POOL_RESEED_BYTES   (1 << 20)
+#endif
+
+#if (RANDOM_POOL_SIZE < 128) || ((RANDOM_POOL_SIZE & 63) != 0)
+# error "RANDOM_POOL_SIZE must be a multiple of 64 (ChaCha20 block), at least 128"
+#endif
+
+// filler PRNG: xoshiro256++ lanes, one block is one step of all lanes
+#ifndef RANDOM_PRNG_LANES
+# define RANDOM_PRNG_LANES          8
+#endif
+
+#define RANDOM_PRNG_BLOCK           (RANDOM_PRNG_LANES * 8)
+
+#if (RANDOM_PRNG_LANES != 8) && (RANDOM_PRNG_LANES != 16)
+# error "RANDOM_PRNG_LANES must be 8 or 16 (a whole number of 512-bit vectors)"
+#endif
+
+// cryptographic (ChaCha20 pool), for keys, entropy and nonces
 extern ssize_t fill_random_next(uint8_t *buf, size_t max);
 extern ssize_t fill_random(uint8_t *buf, size_t max);
 
+// non-cryptographic filler data at memory bandwidth (never for key material)
+extern ssize_t fill_prng_random(uint8_t *buf, size_t max);
+extern void prng_fill(uint8_t *buf, size_t size);
+
+// reproducible filler data of this thread from now on (instead of getrandom())
+extern void prng_seed(uint64_t seed);
+
+// "avx512", "avx2", "generic" or "simple" (all produce the same stream)
+extern const char *prng_kernel_name(void);
+
 #endif // __RANDOM_H
@@ -0,0 +1,83 @@
+//
+//  xoshiro256++ kernel template (no include guard: it is included by
+//  random.c once per vector width)
+//
+//  RANDOM_PRNG_LANES independent generators, the state is word-major
+//  (state[word][lane]), so a vector holds the same word of adjacent lanes
+//  and one step of all lanes gives one block of RANDOM_PRNG_BLOCK bytes
+//
+//  expects to be defined:
+//    __PK_NAME(name)               decorates the generated function names
+//    __PK_TARGET                   function attributes (target ISA) or empty
+//    __PK_SCALAR_T                 vector type
+//    __PK_LOAD_ALIGNED(ptr)        aligned load
+//    __PK_STORE(ptr, val)          unaligned store
+//    __PK_STORE_ALIGNED(ptr, val)  aligned store
+//    __PK_XOR(a, b), __PK_OR(a, b), __PK_ADD64(a, b)
+//    __PK_SHL64(a, n), __PK_SHR64(a, n)
+//
+
+#define __PK_LANES_PER_VEC      (sizeof(__PK_SCALAR_T) / sizeof(uint64_t))
+#define __PK_VECS               (RANDOM_PRNG_LANES / __PK_LANES_PER_VEC)
+#define __PK_CHUNK_BLOCKS       64
+#define __PK_ROTL64(x, k) \
+    __PK_OR(__PK_SHL64((x), (k)), __PK_SHR64((x), 64 - (k)))
+
+__PK_TARGET
+void __PK_NAME(__random_xoshiro_fill)(uint64_t (*state)[RANDOM_PRNG_LANES], uint8_t *buf, size_t blocks)
+{
+    // L1-sized chunks: each vector of lanes runs over the chunk with its state in
+    // registers, the next vector fills the adjacent bytes of the same (cached) lines
+    for (size_t chunk; blocks > 0; blocks -= chunk, buf += chunk * RANDOM_PRNG_BLOCK) {
+        chunk = (blocks < __PK_CHUNK_BLOCKS) ? blocks : __PK_CHUNK_BLOCKS;
+
+        for (size_t v = 0; v < __PK_VECS; ++v) {
+            uint64_t *sptr0 = &state[0][0] + v * __PK_LANES_PER_VEC;
+            uint64_t *sptr1 = &state[1][0] + v * __PK_LANES_PER_VEC;
+            uint64_t *sptr2 = &state[2][0] + v * __PK_LANES_PER_VEC;
+            uint64_t *sptr3 = &state[3][0] + v * __PK_LANES_PER_VEC;
+            register __PK_SCALAR_T s0 = __PK_LOAD_ALIGNED(sptr0);
+            register __PK_SCALAR_T s1 = __PK_LOAD_ALIGNED(sptr1);
+            register __PK_SCALAR_T s2 = __PK_LOAD_ALIGNED(sptr2);
+            register __PK_SCALAR_T s3 = __PK_LOAD_ALIGNED(sptr3);
+            uint8_t *dptr = buf + v * sizeof(__PK_SCALAR_T);
+
+            for (size_t i = 0; i < chunk; ++i) {
+                __PK_SCALAR_T result = __PK_ADD64(__PK_ROTL64(__PK_ADD64(s0, s3), 23), s0);
+                __PK_SCALAR_T t = __PK_SHL64(s1, 17);
+
+                s2 = __PK_XOR(s2, s0);
+                s3 = __PK_XOR(s3, s1);
+                s1 = __PK_XOR(s1, s2);
+                s0 = __PK_XOR(s0, s3);
+                s2 = __PK_XOR(s2, t);
+                s3 = __PK_ROTL64(s3, 45);
+
+                __PK_STORE(dptr, result);
+                dptr += RANDOM_PRNG_BLOCK;
+            }
+
+            __PK_STORE_ALIGNED(sptr0, s0);
+            __PK_STORE_ALIGNED(sptr1, s1);
+            __PK_STORE_ALIGNED(sptr2, s2);
+            __PK_STORE_ALIGNED(sptr3, s3);
+        }
+    }
+}
+
+#undef __PK_ROTL64
+#undef __PK_CHUNK_BLOCKS
+#undef __PK_VECS
+#undef __PK_LANES_PER_VEC
+
+#undef __PK_NAME
+#undef __PK_TARGET
+#undef __PK_SCALAR_T
+#undef __PK_LOAD_ALIGNED
+#undef __PK_STORE
+#undef __PK_STORE_ALIGNED
+#undef __PK_XOR
+#undef __PK_OR
+#undef __PK_ADD64
+#undef __PK_SHL64
+#undef __PK_SHR64
@@ -5,17 +5,20 @@
 
 int run_server(cryptochan_config_t *config)
 {
-    cryptochan_dispatcher_context_t cntx;
+    cryptochan_dispatcher_workers_t workers;
 
-    // init context
-    if (!dispatcher_init(&cntx, &(config->server.listen))) {
+    // init workers
+    if (!dispatcher_workers_init(&workers, config, CSR_SERVER)) {
         fprintf(stderr, "Could not init dispatcher. Exiting.\n");
         return EXIT_FAILURE;
     }
 
-    // destroy context
-    dispatcher_destroy_context(&cntx);
+    // serve until stopped
+    bool result = dispatcher_workers_run(&workers);
+
+    // destroy workers
+    dispatcher_workers_destroy(&workers);
 
     // all done
-    return EXIT_SUCCESS;
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
 }
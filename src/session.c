@@ -1,4 +1,1005 @@
 #include "common.h"
 #include "session.h"
+#include "random.h"
+#include "cpu_features.h"
 
+#include <pthread.h>
+#include <time.h>
 
+#define __TAG_SHARED_SECRET         "cryptochan/shared-secret"
+#define __TAG_SERVER_SIGNATURE      "cryptochan/server-signature"
+#define __TAG_CLIENT_SIGNATURE      "cryptochan/client-signature"
+#define __TAG_RESUMPTION_SECRET     "cryptochan/resumption-secret"
+#define __TAG_RESUMED_SECRET        "cryptochan/resumed-secret"
+#define __TAG_SERVER_CONFIRM        "cryptochan/server-confirm"
+#define __TAG_CLIENT_CONFIRM        "cryptochan/client-confirm"
+
+// client: the latest ticket from the server (shared by all workers)
+typedef struct __session_ticket_cache {
+    pthread_mutex_t lock;
+    bool valid;
+    time_t expires;
+    uint8_t ticket[TICKET_SIZE];
+    uint8_t resumption_secret[TICKET_SECRET_SIZE];
+} session_ticket_cache_t;
+
+static session_ticket_cache_t session_ticket_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+bool session_init(
+    cryptochan_session_t *session, cryptochan_session_role_t role,
+    cryptochan_config_t *config, cryptochan_config_client_set_t *client_set,
+    session_pool_t *pool
+)
+{
+    memset(session, 0, sizeof(cryptochan_session_t));
+
+    session->pool = pool;
+    session->role = role;
+    session->config = config;
+    session->state = (role == CSR_SERVER) ? CSSS_WAIT_CLIENT_HELLO_FLAGS : CSCS_CONNECT_TO_SERVER;
+
+    // fill own entropy part
+    uint8_t *entropy = (role == CSR_SERVER) ? session->server_entropy : session->client_entropy;
+    if (fill_random(entropy, SESSION_ENTROPY_SIZE) != SESSION_ENTROPY_SIZE) {
+        fprintf(stderr, "session: failed to fill entropy\n");
+        return false;
+    }
+
+    // the detected client points into the set, keep it alive with the session
+    if (client_set != NULL) {
+        cryptochan_config_client_set_hold(client_set);
+        session->client_set = client_set;
+    }
+
+    // handshake rings (no data rings for half-open or scanning connections)
+    cyclic_buffer_init_with_memory(&(session->input_buffer),
+        SESSION_HANDSHAKE_BUFFER_SIZE, session->handshake_input);
+    cyclic_buffer_init_with_memory(&(session->output_buffer),
+        SESSION_HANDSHAKE_BUFFER_SIZE, session->handshake_output);
+
+    return true;
+}
+
+void __session_release_ring(cryptochan_session_t *session, cyclic_buffer_t *buf)
+{
+    // handshake rings are a part of the session
+    if ((buf->data_ptr == session->handshake_input) || (buf->data_ptr == session->handshake_output)) {
+        memset(buf, 0, sizeof(cyclic_buffer_t));
+    } else if (session->pool) {
+        session_pool_ring_put(session->pool, buf);
+    } else {
+        cyclic_buffer_destroy(buf);
+    }
+}
+
+bool __session_attach_rings(cryptochan_session_t *session)
+{
+    cyclic_buffer_t input_buffer = {0}, output_buffer = {0};
+
+    // decoded input may be spliced to the plain side (decided by the worker)
+    uint32_t input_flags = session->splice_input ? CYCLIC_BUFFER_FLAG_SPLICE : 0;
+    bool result;
+
+    if (session->pool) {
+        result = session_pool_ring_get(session->pool, &input_buffer, input_flags)
+            && session_pool_ring_get(session->pool, &output_buffer, 0);
+    } else if (input_flags) {
+        result = cyclic_buffer_init_with_flags(&input_buffer, SESSION_BUFFER_CHUNKS, input_flags)
+            && cyclic_buffer_init_elastic(&output_buffer, SESSION_BUFFER_CHUNKS, SESSION_BUFFER_MAX_CHUNKS);
+    } else {
+        result = cyclic_buffer_init_elastic(&input_buffer, SESSION_BUFFER_CHUNKS, SESSION_BUFFER_MAX_CHUNKS)
+            && cyclic_buffer_init_elastic(&output_buffer, SESSION_BUFFER_CHUNKS, SESSION_BUFFER_MAX_CHUNKS);
+    }
+
+    // what is left of the handshake rings: the unsent message, early data
+    result = result
+        && cyclic_buffer_transfer(&input_buffer, &(session->input_buffer))
+        && cyclic_buffer_transfer(&output_buffer, &(session->output_buffer));
+
+    if (!result) {
+        __session_release_ring(session, &input_buffer);
+        __session_release_ring(session, &output_buffer);
+        return false;
+    }
+
+    // handshake memory stays with the session (in-flight sends may refer to it)
+    session->input_buffer = input_buffer;
+    session->output_buffer = output_buffer;
+    return true;
+}
+
+void session_destroy(cryptochan_session_t *session)
+{
+    // not recoded with the batch anymore
+    if (session->recode_queued) {
+        cryptochan_session_recode_batch_t *batch = session->recode_batch;
+
+        for (int i = 0; i < batch->count; ++i) {
+            if (batch->sessions[i] == session) {
+                batch->sessions[i] = batch->sessions[--(batch->count)];
+                break;
+            }
+        }
+    }
+
+    __session_release_ring(session, &(session->input_buffer));
+    __session_release_ring(session, &(session->output_buffer));
+    cryptochan_config_client_set_release(session->client_set);
+
+    // wipe any key material
+    explicit_bzero(session, sizeof(cryptochan_session_t));
+}
+
+void session_connected(cryptochan_session_t *session)
+{
+    if ((session->role == CSR_CLIENT) && (session->state == CSCS_CONNECT_TO_SERVER)) {
+        session->state = CSCS_SEND_CLIENT_HELLO;
+    }
+}
+
+bool session_is_channelling(cryptochan_session_t *session)
+{
+    return (session->role == CSR_SERVER)
+        ? (session->state == CSSS_CHANNELLING)
+        : (session->state == CSCS_CHANNELLING);
+}
+
+const char *session_peer_name(cryptochan_session_t *session)
+{
+    if (session->role == CSR_CLIENT) {
+        return "server";
+    }
+
+    return session->client ? session->client->name : "(unknown client)";
+}
+
+void session_release_idle(cryptochan_session_t *session)
+{
+    // no-op for handshake and mirrored rings
+    cyclic_buffer_release_idle(&(session->input_buffer));
+    cyclic_buffer_release_idle(&(session->output_buffer));
+}
+
+
+//
+//  handshake messages
+//
+
+bool __session_send(cryptochan_session_t *session, const uint8_t *data, uint32_t size)
+{
+    // handshake messages are written as a whole (nothing else is buffered yet)
+    if (cyclic_buffer_write(&(session->output_buffer), (uint8_t*)data, size) != size) {
+        fprintf(stderr, "session: no room for handshake message (%d bytes)\n", size);
+        return false;
+    }
+
+    // handshake messages are sent as is
+    cyclic_buffer_recode_none(&(session->output_buffer));
+
+    return true;
+}
+
+bool __session_recv(cryptochan_session_t *session, uint8_t *data, uint32_t size)
+{
+    cyclic_buffer_t *buf = &(session->input_buffer);
+
+    // wait until the whole message is received
+    if (atomic_load_explicit(&(buf->available_to_recode), memory_order_acquire) < size) {
+        return false;
+    }
+
+    // pass exactly the message (the rest may be already encoded data)
+    cyclic_buffer_recode_xor(buf, NULL, size);
+    cyclic_buffer_read(buf, data, size);
+
+    return true;
+}
+
+bool __session_generate_ephemeral_key(cryptochan_session_t *session, uint8_t *serialized_key)
+{
+    secp256k1_pubkey public_key_data;
+
+    if (!generate_keypair(session->ephemeral_private_key, &public_key_data)
+        || !pubkey_serialize(&public_key_data, serialized_key)) {
+        fprintf(stderr, "session: failed to generate ephemeral key\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool __session_compute_fingerprint(cryptochan_session_t *session)
+{
+    cryptochan_config_t *config = session->config;
+
+    if (!cryptochan_config_static_fingerprint(&(config->client.server_public_key_data),
+            config->private_key_data, session->static_secret, session->fingerprint)) {
+        fprintf(stderr, "session: failed to compute static shared secret\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool __session_detect_client(cryptochan_session_t *session)
+{
+    // static secrets and fingerprints are precomputed at config load
+    session->client = cryptochan_config_find_client(session->client_set, session->fingerprint);
+
+    if (session->client != NULL) {
+        memcpy(session->static_secret, session->client->static_secret, EC_HASH_SIZE);
+    }
+
+    return (session->client != NULL);
+}
+
+bool __session_derive_shared_secret(cryptochan_session_t *session)
+{
+    secp256k1_pubkey peer_ephemeral_key;
+    uint8_t ephemeral_secret[EC_HASH_SIZE];
+    uint8_t msg[1 + EC_HASH_SIZE * 2 + SESSION_ENTROPY_SIZE * 2];
+    bool result = false;
+
+    uint8_t *peer_key = (session->role == CSR_SERVER)
+        ? session->client_ephemeral_key
+        : session->server_ephemeral_key;
+
+    for (;;) {
+        if (!pubkey_parse(peer_key, &peer_ephemeral_key)) {
+            fprintf(stderr, "session: bad ephemeral key of %s\n", session_peer_name(session));
+            break;
+        }
+
+        if (!ecdh_shared_secret(&peer_ephemeral_key,
+                session->ephemeral_private_key, ephemeral_secret)) {
+            fprintf(stderr, "session: failed to compute ephemeral shared secret\n");
+            break;
+        }
+
+        // counter || ECDH(ephemeral keys) || ECDH(static keys) || client entropy || server entropy
+        uint8_t *mptr = msg + 1;
+        memcpy(mptr, ephemeral_secret, EC_HASH_SIZE); mptr += EC_HASH_SIZE;
+        memcpy(mptr, session->static_secret, EC_HASH_SIZE); mptr += EC_HASH_SIZE;
+        memcpy(mptr, session->client_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+        memcpy(mptr, session->server_entropy, SESSION_ENTROPY_SIZE);
+
+        for (int i = 0; i < SESSION_SHARED_SECRET_SIZE / EC_HASH_SIZE; ++i) {
+            msg[0] = (uint8_t)i;
+            tagged_hash(__TAG_SHARED_SECRET, msg, sizeof(msg),
+                session->shared_secret + i * EC_HASH_SIZE);
+        }
+
+        // all done
+        result = true;
+        break;
+    }
+
+    // ephemeral keys are not needed anymore
+    explicit_bzero(session->ephemeral_private_key, EC_PRIVATE_KEY_SIZE);
+    explicit_bzero(ephemeral_secret, sizeof(ephemeral_secret));
+    explicit_bzero(msg, sizeof(msg));
+
+    return result;
+}
+
+void __session_signature_hash(cryptochan_session_t *session, const char *tag, uint8_t *hash)
+{
+    uint8_t msg[SESSION_SHARED_SECRET_SIZE + 2 + SESSION_ENTROPY_SIZE * 2
+        + SESSION_FINGERPRINT_SIZE + EC_PUBLIC_KEY_SIZE * 2];
+    uint8_t *mptr = msg;
+
+    // shared secret || transcript (everything sent during the handshake)
+    memcpy(mptr, session->shared_secret, SESSION_SHARED_SECRET_SIZE);
+    mptr += SESSION_SHARED_SECRET_SIZE;
+    *(mptr++) = session->ciphers;
+    *(mptr++) = session->cipher;
+    memcpy(mptr, session->server_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(mptr, session->client_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(mptr, session->fingerprint, SESSION_FINGERPRINT_SIZE); mptr += SESSION_FINGERPRINT_SIZE;
+    memcpy(mptr, session->client_ephemeral_key, EC_PUBLIC_KEY_SIZE); mptr += EC_PUBLIC_KEY_SIZE;
+    memcpy(mptr, session->server_ephemeral_key, EC_PUBLIC_KEY_SIZE);
+
+    tagged_hash(tag, msg, sizeof(msg), hash);
+
+    explicit_bzero(msg, sizeof(msg));
+}
+
+bool __session_sign(cryptochan_session_t *session, uint8_t *signature)
+{
+    uint8_t hash[EC_HASH_SIZE];
+
+    __session_signature_hash(session, (session->role == CSR_SERVER)
+        ? __TAG_SERVER_SIGNATURE : __TAG_CLIENT_SIGNATURE, hash);
+
+    if (!ecdsa_sign_hash(session->config->private_key_data, hash, signature)) {
+        fprintf(stderr, "session: failed to sign shared secret hash\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool __session_verify_signature(cryptochan_session_t *session, uint8_t *signature)
+{
+    uint8_t hash[EC_HASH_SIZE];
+
+    secp256k1_pubkey *peer_public_key = (session->role == CSR_SERVER)
+        ? &(session->client->public_key_data)
+        : &(session->config->client.server_public_key_data);
+
+    __session_signature_hash(session, (session->role == CSR_SERVER)
+        ? __TAG_CLIENT_SIGNATURE : __TAG_SERVER_SIGNATURE, hash);
+
+    if (!ecdsa_verify_hash(peer_public_key, hash, signature)) {
+        fprintf(stderr, "session: bad signature of %s\n", session_peer_name(session));
+        return false;
+    }
+
+    return true;
+}
+
+bool __session_start_channelling(cryptochan_session_t *session)
+{
+    const uint8_t *c2s_key = session->shared_secret;
+    const uint8_t *s2c_key = session->shared_secret + EC_HASH_SIZE;
+    const uint8_t *c2s_iv = session->shared_secret + EC_HASH_SIZE * 2;
+    const uint8_t *s2c_iv = session->shared_secret + EC_HASH_SIZE * 3;
+    bool server = (session->role == CSR_SERVER);
+
+    if (!__session_attach_rings(session))
+        { return false; }
+
+    // ChaCha20 per direction (nonce: the first 8 bytes of the direction's salt)
+    if (session->cipher == SESSION_HELLO_CIPHER_CHACHA20) {
+        keystream_chacha20_init(&(session->encoder_engine.chacha20),
+            server ? s2c_key : c2s_key, server ? s2c_iv : c2s_iv);
+        keystream_chacha20_init(&(session->decoder_engine.chacha20),
+            server ? c2s_key : s2c_key, server ? c2s_iv : s2c_iv);
+
+        session->encoder = &(session->encoder_engine.chacha20.base);
+        session->decoder = &(session->decoder_engine.chacha20.base);
+        return true;
+    }
+
+    // AES-256-CTR per direction (IV: the first half of the direction's salt)
+    keystream_aes_init(&(session->encoder_engine.aes),
+        server ? s2c_key : c2s_key, EC_HASH_SIZE, server ? s2c_iv : c2s_iv);
+    keystream_aes_init(&(session->decoder_engine.aes),
+        server ? c2s_key : s2c_key, EC_HASH_SIZE, server ? c2s_iv : s2c_iv);
+
+    session->encoder = &(session->encoder_engine.aes.base);
+    session->decoder = &(session->decoder_engine.aes.base);
+    return true;
+}
+
+void __session_recode(cryptochan_session_t *session)
+{
+    cryptochan_session_recode_batch_t *batch = session->recode_batch;
+
+    // AES: deferred to the batch (recoded as a whole once it runs)
+    if (batch && (session->cipher == SESSION_HELLO_CIPHER_AES)) {
+        if (session->recode_queued)
+            { return; }
+
+        if (batch->count < SESSION_RECODE_BATCH_MAX) {
+            batch->sessions[batch->count++] = session;
+            session->recode_queued = true;
+            return;
+        }
+    }
+
+    cyclic_buffer_recode_keystream(&(session->input_buffer), session->decoder, UINT32_MAX);
+    cyclic_buffer_recode_keystream(&(session->output_buffer), session->encoder, UINT32_MAX);
+}
+
+
+int session_recode_batch_run(
+    cryptochan_session_recode_batch_t *batch, cryptochan_session_t **recoded
+)
+{
+    // both directions of every session: in-place regions of the rings
+    struct {
+        cyclic_buffer_t *buf;
+        keystream_aes_t *ks;
+        struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+        int iovcnt;
+    } spans[SESSION_RECODE_BATCH_MAX * 2];
+    keystream_aes_job_t jobs[SESSION_RECODE_BATCH_MAX * 2];
+    int count = 0, n;
+
+    for (int i = 0; i < batch->count; ++i) {
+        cryptochan_session_t *session = batch->sessions[i];
+
+        spans[count].buf = &(session->input_buffer);
+        spans[count].ks = &(session->decoder_engine.aes);
+        spans[count + 1].buf = &(session->output_buffer);
+        spans[count + 1].ks = &(session->encoder_engine.aes);
+
+        for (int j = count; j < count + 2; ++j) {
+            spans[j].iovcnt = cyclic_buffer_recode_reserve(spans[j].buf, spans[j].iov, UINT32_MAX);
+        }
+        count += 2;
+
+        session->recode_queued = false;
+        recoded[i] = session;
+    }
+
+    // first regions together, then the wrapped parts (the stream continues there)
+    for (int region = 0; region < CYCLIC_BUFFER_IOV_MAX; ++region) {
+        n = 0;
+        for (int i = 0; i < count; ++i) {
+            if (spans[i].iovcnt > region) {
+                jobs[n].ks = spans[i].ks;
+                jobs[n].dptr = spans[i].iov[region].iov_base;
+                jobs[n].size = spans[i].iov[region].iov_len;
+                ++n;
+            }
+        }
+        keystream_aes_xor_multi(jobs, n);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        uint32_t size = 0;
+
+        for (int region = 0; region < spans[i].iovcnt; ++region) {
+            size += spans[i].iov[region].iov_len;
+        }
+        if (size > 0) {
+            cyclic_buffer_recode_commit(spans[i].buf, size);
+        }
+    }
+
+    n = batch->count;
+    batch->count = 0;
+    return n;
+}
+
+
+//
+//  resumption
+//
+
+void __session_derive_resumed_secret(cryptochan_session_t *session)
+{
+    uint8_t msg[1 + TICKET_SECRET_SIZE + SESSION_ENTROPY_SIZE * 2];
+    uint8_t *mptr = msg + 1;
+
+    // counter || resumption secret || client entropy || server entropy
+    memcpy(mptr, session->resumption_secret, TICKET_SECRET_SIZE); mptr += TICKET_SECRET_SIZE;
+    memcpy(mptr, session->client_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(mptr, session->server_entropy, SESSION_ENTROPY_SIZE);
+
+    for (int i = 0; i < SESSION_SHARED_SECRET_SIZE / EC_HASH_SIZE; ++i) {
+        msg[0] = (uint8_t)i;
+        tagged_hash(__TAG_RESUMED_SECRET, msg, sizeof(msg),
+            session->shared_secret + i * EC_HASH_SIZE);
+    }
+
+    session->resumed = true;
+
+    explicit_bzero(msg, sizeof(msg));
+}
+
+void __session_confirm(cryptochan_session_t *session, const char *tag, uint8_t *confirm)
+{
+    uint8_t msg[SESSION_SHARED_SECRET_SIZE + 2 + TICKET_SIZE + SESSION_ENTROPY_SIZE * 2];
+    uint8_t *mptr = msg;
+
+    // shared secret || transcript
+    memcpy(mptr, session->shared_secret, SESSION_SHARED_SECRET_SIZE);
+    mptr += SESSION_SHARED_SECRET_SIZE;
+    *(mptr++) = session->ciphers;
+    *(mptr++) = session->cipher;
+    memcpy(mptr, session->ticket, TICKET_SIZE); mptr += TICKET_SIZE;
+    memcpy(mptr, session->client_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(mptr, session->server_entropy, SESSION_ENTROPY_SIZE);
+
+    tagged_hash(tag, msg, sizeof(msg), confirm);
+
+    explicit_bzero(msg, sizeof(msg));
+}
+
+bool __session_check_confirm(cryptochan_session_t *session, const char *tag, uint8_t *confirm)
+{
+    uint8_t expected[SESSION_CONFIRM_SIZE];
+    uint8_t diff = 0;
+
+    __session_confirm(session, tag, expected);
+
+    // constant time
+    for (int i = 0; i < SESSION_CONFIRM_SIZE; ++i) {
+        diff |= expected[i] ^ confirm[i];
+    }
+
+    if (diff != 0) {
+        fprintf(stderr, "session: bad resumption confirm of %s\n", session_peer_name(session));
+        return false;
+    }
+
+    return true;
+}
+
+bool __session_ticket_message(cryptochan_session_t *session, uint8_t *msg)
+{
+    uint32_t lifetime = session->config->server.ticket_lifetime;
+    uint8_t resumption_secret[TICKET_SECRET_SIZE];
+
+    // a new ticket for the next reconnect (bound to the client's public key)
+    tagged_hash(__TAG_RESUMPTION_SECRET, session->shared_secret, SESSION_SHARED_SECRET_SIZE,
+        resumption_secret);
+
+    for (int i = 0; i < 4; ++i) {
+        msg[i] = (uint8_t)(lifetime >> (i * 8));
+    }
+
+    bool result = ticket_issue(session->client->fingerprint, resumption_secret,
+        lifetime, msg + 4);
+
+    explicit_bzero(resumption_secret, sizeof(resumption_secret));
+
+    return result;
+}
+
+bool __session_ticket_cache_get(cryptochan_session_t *session)
+{
+    session_ticket_cache_t *cache = &session_ticket_cache;
+    bool result = false;
+
+    pthread_mutex_lock(&(cache->lock));
+    if (cache->valid && (time(NULL) < cache->expires)) {
+        memcpy(session->ticket, cache->ticket, TICKET_SIZE);
+        memcpy(session->resumption_secret, cache->resumption_secret, TICKET_SECRET_SIZE);
+        result = true;
+    }
+    pthread_mutex_unlock(&(cache->lock));
+
+    return result;
+}
+
+void __session_ticket_cache_put(cryptochan_session_t *session, const uint8_t *msg)
+{
+    session_ticket_cache_t *cache = &session_ticket_cache;
+    uint32_t lifetime = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        lifetime |= (uint32_t)msg[i] << (i * 8);
+    }
+
+    pthread_mutex_lock(&(cache->lock));
+    cache->valid = true;
+    cache->expires = time(NULL) + lifetime;
+    memcpy(cache->ticket, msg + 4, TICKET_SIZE);
+    tagged_hash(__TAG_RESUMPTION_SECRET, session->shared_secret, SESSION_SHARED_SECRET_SIZE,
+        cache->resumption_secret);
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+void __session_ticket_cache_drop(cryptochan_session_t *session)
+{
+    session_ticket_cache_t *cache = &session_ticket_cache;
+
+    // keep a newer ticket (got by another session meanwhile)
+    pthread_mutex_lock(&(cache->lock));
+    if (cache->valid && (memcmp(cache->ticket, session->ticket, TICKET_SIZE) == 0)) {
+        cache->valid = false;
+        explicit_bzero(cache->resumption_secret, TICKET_SECRET_SIZE);
+    }
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+bool __session_open_ticket(cryptochan_session_t *session)
+{
+    if (session->config->server.ticket_lifetime == 0)
+        { return false; }
+
+    if (!ticket_open(session->ticket, session->fingerprint, session->resumption_secret))
+        { return false; }
+
+    // the client must still be allowed
+    session->client = cryptochan_config_find_client(session->client_set, session->fingerprint);
+
+    return (session->client != NULL);
+}
+
+
+//
+//  cipher negotiation
+//
+
+uint8_t __session_cipher_flag(cryptochan_config_cipher_t cipher)
+{
+    switch (cipher) {
+        case CCC_AES_256_CTR:
+            return SESSION_HELLO_CIPHER_AES;
+        case CCC_CHACHA20:
+            return SESSION_HELLO_CIPHER_CHACHA20;
+        default:
+            return 0;
+    }
+}
+
+uint8_t __session_offered_ciphers(cryptochan_session_t *session)
+{
+    uint8_t cipher = __session_cipher_flag(session->config->client.cipher);
+
+    if (cipher != 0) {
+        return cipher;
+    }
+
+    // auto: software AES is far slower than ChaCha20, offer it with AES-NI only
+    return SESSION_HELLO_CIPHER_CHACHA20
+        | (cpu_features()->aesni ? SESSION_HELLO_CIPHER_AES : 0);
+}
+
+bool __session_choose_cipher(cryptochan_session_t *session)
+{
+    uint8_t cipher = __session_cipher_flag(session->config->server.cipher);
+
+    if (cipher == 0) {
+        // auto: any offered one, AES-256-CTR when both ends have AES-NI
+        // (the client offers it only then)
+        if ((session->ciphers & SESSION_HELLO_CIPHER_AES) && cpu_features()->aesni) {
+            cipher = SESSION_HELLO_CIPHER_AES;
+        } else if (session->ciphers & SESSION_HELLO_CIPHER_CHACHA20) {
+            cipher = SESSION_HELLO_CIPHER_CHACHA20;
+        } else {
+            cipher = SESSION_HELLO_CIPHER_AES;
+        }
+    }
+
+    if (!(session->ciphers & cipher)) {
+        fprintf(stderr, "session: no common cipher (client offered 0x%02x)\n", session->ciphers);
+        return false;
+    }
+
+    session->cipher = cipher;
+    return true;
+}
+
+bool __session_check_cipher(cryptochan_session_t *session)
+{
+    uint8_t cipher = session->hello_flags & SESSION_HELLO_CIPHERS;
+
+    // exactly one of the offered ones
+    if (!(cipher & session->ciphers) || (cipher & (cipher - 1))) {
+        fprintf(stderr, "session: server chose a cipher not offered (0x%02x)\n", cipher);
+        return false;
+    }
+
+    session->cipher = cipher;
+    return true;
+}
+
+
+//
+//  handshake flights
+//
+
+bool __session_send_client_hello(cryptochan_session_t *session)
+{
+    uint8_t msg[1 + MAX(SESSION_CLIENT_HELLO_SIZE, SESSION_CLIENT_RESUME_HELLO_SIZE)];
+    uint8_t *mptr = msg + 1;
+
+    session->ciphers = __session_offered_ciphers(session);
+
+    // resumption: entropy || ticket (no EC operations)
+    if (!session->resume_rejected && __session_ticket_cache_get(session)) {
+        msg[0] = SESSION_HELLO_RESUME | session->ciphers;
+        memcpy(mptr, session->client_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+        memcpy(mptr, session->ticket, TICKET_SIZE);
+
+        return __session_send(session, msg, 1 + SESSION_CLIENT_RESUME_HELLO_SIZE);
+    }
+
+    if (!__session_compute_fingerprint(session)
+        || !__session_generate_ephemeral_key(session, session->client_ephemeral_key))
+        { return false; }
+
+    msg[0] = session->ciphers;
+    memcpy(mptr, session->client_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(mptr, session->fingerprint, SESSION_FINGERPRINT_SIZE); mptr += SESSION_FINGERPRINT_SIZE;
+    memcpy(mptr, session->client_ephemeral_key, EC_PUBLIC_KEY_SIZE);
+
+    return __session_send(session, msg, 1 + SESSION_CLIENT_HELLO_SIZE);
+}
+
+bool __session_recv_client_hello(cryptochan_session_t *session)
+{
+    uint8_t msg[SESSION_CLIENT_HELLO_SIZE];
+    uint8_t *mptr = msg;
+
+    if (!__session_recv(session, msg, sizeof(msg)))
+        { return false; }
+
+    memcpy(session->client_entropy, mptr, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(session->fingerprint, mptr, SESSION_FINGERPRINT_SIZE); mptr += SESSION_FINGERPRINT_SIZE;
+    memcpy(session->client_ephemeral_key, mptr, EC_PUBLIC_KEY_SIZE);
+
+    return true;
+}
+
+bool __session_recv_client_resume_hello(cryptochan_session_t *session)
+{
+    uint8_t msg[SESSION_CLIENT_RESUME_HELLO_SIZE];
+
+    if (!__session_recv(session, msg, sizeof(msg)))
+        { return false; }
+
+    memcpy(session->client_entropy, msg, SESSION_ENTROPY_SIZE);
+    memcpy(session->ticket, msg + SESSION_ENTROPY_SIZE, TICKET_SIZE);
+
+    return true;
+}
+
+bool __session_send_server_hello(cryptochan_session_t *session)
+{
+    uint8_t msg[1 + SESSION_SERVER_HELLO_SIZE + SESSION_TICKET_MESSAGE_SIZE];
+    uint8_t *mptr = msg + 1;
+    uint32_t size = 1 + SESSION_SERVER_HELLO_SIZE;
+
+    // ephemeral key first: the signature covers the shared secret and both keys
+    if (!__session_generate_ephemeral_key(session, session->server_ephemeral_key)
+        || !__session_derive_shared_secret(session))
+        { return false; }
+
+    msg[0] = session->cipher;
+    memcpy(mptr, session->server_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(mptr, session->server_ephemeral_key, EC_PUBLIC_KEY_SIZE); mptr += EC_PUBLIC_KEY_SIZE;
+
+    if (!__session_sign(session, mptr))
+        { return false; }
+    mptr += EC_SIGNATURE_SIZE;
+
+    // ticket (if enabled)
+    if (session->config->server.ticket_lifetime > 0) {
+        if (__session_ticket_message(session, mptr)) {
+            msg[0] |= SESSION_HELLO_TICKET;
+            size += SESSION_TICKET_MESSAGE_SIZE;
+        }
+    }
+
+    return __session_send(session, msg, size);
+}
+
+bool __session_send_server_resume_hello(cryptochan_session_t *session)
+{
+    uint8_t msg[1 + SESSION_SERVER_RESUME_HELLO_SIZE + SESSION_TICKET_MESSAGE_SIZE];
+    uint8_t *mptr = msg + 1;
+    uint32_t size = 1 + SESSION_SERVER_RESUME_HELLO_SIZE;
+
+    __session_derive_resumed_secret(session);
+
+    msg[0] = SESSION_HELLO_RESUME | session->cipher;
+    memcpy(mptr, session->server_entropy, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    __session_confirm(session, __TAG_SERVER_CONFIRM, mptr); mptr += SESSION_CONFIRM_SIZE;
+
+    // fresh ticket (the same one may be used until it expires anyway)
+    if (__session_ticket_message(session, mptr)) {
+        msg[0] |= SESSION_HELLO_TICKET;
+        size += SESSION_TICKET_MESSAGE_SIZE;
+    }
+
+    return __session_send(session, msg, size);
+}
+
+bool __session_recv_server_hello(cryptochan_session_t *session, uint8_t *signature)
+{
+    uint8_t msg[SESSION_SERVER_HELLO_SIZE];
+    uint8_t *mptr = msg;
+
+    if (!__session_recv(session, msg, sizeof(msg)))
+        { return false; }
+
+    memcpy(session->server_entropy, mptr, SESSION_ENTROPY_SIZE); mptr += SESSION_ENTROPY_SIZE;
+    memcpy(session->server_ephemeral_key, mptr, EC_PUBLIC_KEY_SIZE); mptr += EC_PUBLIC_KEY_SIZE;
+    memcpy(signature, mptr, EC_SIGNATURE_SIZE);
+
+    return true;
+}
+
+bool __session_recv_server_resume_hello(cryptochan_session_t *session, uint8_t *confirm)
+{
+    uint8_t msg[SESSION_SERVER_RESUME_HELLO_SIZE];
+
+    if (!__session_recv(session, msg, sizeof(msg)))
+        { return false; }
+
+    memcpy(session->server_entropy, msg, SESSION_ENTROPY_SIZE);
+    memcpy(confirm, msg + SESSION_ENTROPY_SIZE, SESSION_CONFIRM_SIZE);
+
+    return true;
+}
+
+
+//
+//  state machines (return false on protocol failure)
+//
+
+bool __session_process_server(cryptochan_session_t *session)
+{
+    uint8_t signature[EC_SIGNATURE_SIZE];
+    uint8_t confirm[SESSION_CONFIRM_SIZE];
+
+    for (;;) {
+        switch (session->state) {
+            case CSSS_WAIT_CLIENT_HELLO_FLAGS:
+                if (!__session_recv(session, &(session->hello_flags), 1))
+                    { return true; }
+                session->ciphers = session->hello_flags & SESSION_HELLO_CIPHERS;
+                if (!__session_choose_cipher(session))
+                    { return false; }
+                session->state = (session->hello_flags & SESSION_HELLO_RESUME)
+                    ? CSSS_WAIT_CLIENT_RESUME_HELLO : CSSS_WAIT_CLIENT_HELLO;
+                break;
+
+            case CSSS_WAIT_CLIENT_HELLO:
+                if (!__session_recv_client_hello(session))
+                    { return true; }
+                session->state = CSSS_DETECT_CLIENT;
+                break;
+
+            case CSSS_WAIT_CLIENT_RESUME_HELLO:
+                if (!__session_recv_client_resume_hello(session))
+                    { return true; }
+                if (!__session_open_ticket(session)) {
+                    // expired or unknown ticket: ask for the full hello
+                    uint8_t reject = SESSION_HELLO_REJECT;
+                    if (!__session_send(session, &reject, 1))
+                        { return false; }
+                    session->state = CSSS_WAIT_CLIENT_HELLO_FLAGS;
+                    break;
+                }
+                session->state = CSSS_SEND_SERVER_RESUME_HELLO;
+                break;
+
+            case CSSS_DETECT_CLIENT:
+                if (!__session_detect_client(session)) {
+                    fprintf(stderr, "session: unknown client (fingerprint does not match)\n");
+                    return false;
+                }
+                session->state = CSSS_SEND_SERVER_HELLO;
+                break;
+
+            case CSSS_SEND_SERVER_HELLO:
+                if (!__session_send_server_hello(session))
+                    { return false; }
+                session->state = CSSS_WAIT_CLIENT_SIGNATURE;
+                break;
+
+            case CSSS_SEND_SERVER_RESUME_HELLO:
+                if (!__session_send_server_resume_hello(session))
+                    { return false; }
+                session->state = CSSS_WAIT_CLIENT_CONFIRM;
+                break;
+
+            case CSSS_WAIT_CLIENT_SIGNATURE:
+                if (!__session_recv(session, signature, EC_SIGNATURE_SIZE))
+                    { return true; }
+                if (!__session_verify_signature(session, signature))
+                    { return false; }
+                if (!__session_start_channelling(session))
+                    { return false; }
+                session->state = CSSS_CHANNELLING;
+                break;
+
+            case CSSS_WAIT_CLIENT_CONFIRM:
+                if (!__session_recv(session, confirm, SESSION_CONFIRM_SIZE))
+                    { return true; }
+                if (!__session_check_confirm(session, __TAG_CLIENT_CONFIRM, confirm))
+                    { return false; }
+                if (!__session_start_channelling(session))
+                    { return false; }
+                session->state = CSSS_CHANNELLING;
+                break;
+
+            case CSSS_CHANNELLING:
+                __session_recode(session);
+                return true;
+
+            default:
+                fprintf(stderr, "session: unexpected server state: %d\n", session->state);
+                return false;
+        }
+    }
+}
+
+bool __session_process_client(cryptochan_session_t *session)
+{
+    uint8_t signature[EC_SIGNATURE_SIZE];
+    uint8_t confirm[SESSION_CONFIRM_SIZE];
+    uint8_t ticket_message[SESSION_TICKET_MESSAGE_SIZE];
+
+    for (;;) {
+        switch (session->state) {
+            case CSCS_CONNECT_TO_SERVER:
+                return true;
+
+            case CSCS_SEND_CLIENT_HELLO:
+                if (!__session_send_client_hello(session))
+                    { return false; }
+                session->state = CSCS_WAIT_SERVER_HELLO_FLAGS;
+                break;
+
+            case CSCS_WAIT_SERVER_HELLO_FLAGS:
+                if (!__session_recv(session, &(session->hello_flags), 1))
+                    { return true; }
+                if (session->hello_flags & SESSION_HELLO_REJECT) {
+                    // ticket is not accepted anymore: full handshake on the same connection
+                    __session_ticket_cache_drop(session);
+                    session->resume_rejected = true;
+                    session->state = CSCS_SEND_CLIENT_HELLO;
+                    break;
+                }
+                if (!__session_check_cipher(session))
+                    { return false; }
+                session->state = (session->hello_flags & SESSION_HELLO_RESUME)
+                    ? CSCS_WAIT_SERVER_RESUME_HELLO : CSCS_WAIT_SERVER_HELLO;
+                break;
+
+            case CSCS_WAIT_SERVER_HELLO:
+                if (!__session_recv_server_hello(session, signature))
+                    { return true; }
+                if (!__session_derive_shared_secret(session)
+                    || !__session_verify_signature(session, signature))
+                    { return false; }
+                session->state = (session->hello_flags & SESSION_HELLO_TICKET)
+                    ? CSCS_WAIT_TICKET : CSCS_SEND_CLIENT_SIGNATURE;
+                break;
+
+            case CSCS_WAIT_SERVER_RESUME_HELLO:
+                if (!__session_recv_server_resume_hello(session, confirm))
+                    { return true; }
+                __session_derive_resumed_secret(session);
+                if (!__session_check_confirm(session, __TAG_SERVER_CONFIRM, confirm))
+                    { return false; }
+                session->state = (session->hello_flags & SESSION_HELLO_TICKET)
+                    ? CSCS_WAIT_TICKET : CSCS_SEND_CLIENT_CONFIRM;
+                break;
+
+            case CSCS_WAIT_TICKET:
+                if (!__session_recv(session, ticket_message, SESSION_TICKET_MESSAGE_SIZE))
+                    { return true; }
+                __session_ticket_cache_put(session, ticket_message);
+                session->state = session->resumed
+                    ? CSCS_SEND_CLIENT_CONFIRM : CSCS_SEND_CLIENT_SIGNATURE;
+                break;
+
+            case CSCS_SEND_CLIENT_SIGNATURE:
+                // app data is encoded right after the signature (same flight)
+                if (!__session_sign(session, signature)
+                    || !__session_send(session, signature, EC_SIGNATURE_SIZE))
+                    { return false; }
+                if (!__session_start_channelling(session))
+                    { return false; }
+                session->state = CSCS_CHANNELLING;
+                break;
+
+            case CSCS_SEND_CLIENT_CONFIRM:
+                __session_confirm(session, __TAG_CLIENT_CONFIRM, confirm);
+                if (!__session_send(session, confirm, SESSION_CONFIRM_SIZE))
+                    { return false; }
+                if (!__session_start_channelling(session))
+                    { return false; }
+                session->state = CSCS_CHANNELLING;
+                break;
+
+            case CSCS_CHANNELLING:
+                __session_recode(session);
+                return true;
+
+            default:
+                fprintf(stderr, "session: unexpected client state: %d\n", session->state);
+                return false;
+        }
+    }
+}
+
+bool session_process(cryptochan_session_t *session)
+{
+    return (session->role == CSR_SERVER)
+        ? __session_process_server(session)
+        : __session_process_client(session);
+}
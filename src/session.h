@@ -2,40 +2,187 @@
 #define __SESSION_H
 
 #include "cyclic_buffer.h"
+#include "keystream.h"
+#include "keystream_aes.h"
+#include "keystream_chacha20.h"
+#include "cryptochan_config.h"
+#include "ec_helper.h"
+#include "ticket.h"
+#include "session_pool.h"
+
+#ifndef SESSION_BUFFER_CHUNKS
+# define SESSION_BUFFER_CHUNKS 16
+#endif
+
+// data rings grow up to this under load and shrink back when idle (splice
+// relayed input is mirrored and rings on hugepages are carved from the pool's
+// arenas, those keep SESSION_BUFFER_CHUNKS)
+#ifndef SESSION_BUFFER_MAX_CHUNKS
+# define SESSION_BUFFER_MAX_CHUNKS 256
+#endif
+
+// handshake messages pass through small rings inside the session, the data
+// rings (SESSION_BUFFER_CHUNKS each) are attached once channelling starts
+#ifndef SESSION_HANDSHAKE_BUFFER_SIZE
+# define SESSION_HANDSHAKE_BUFFER_SIZE 512
+#endif
+
+// sessions whose recode is deferred to one multi-buffer pass (per worker)
+#ifndef SESSION_RECODE_BATCH_MAX
+# define SESSION_RECODE_BATCH_MAX 256
+#endif
+
+#define SESSION_ENTROPY_SIZE            64
+#define SESSION_FINGERPRINT_SIZE        EC_HASH_SIZE
+#define SESSION_SHARED_SECRET_SIZE      128
+#define SESSION_CONFIRM_SIZE            EC_HASH_SIZE
+
+// hello flags (first byte of the client and the server hello)
+#define SESSION_HELLO_RESUME            0x1     // resumption (ticket) instead of ECDH
+#define SESSION_HELLO_TICKET            0x2     // server: a new ticket follows
+#define SESSION_HELLO_REJECT            0x4     // server: ticket rejected, send full hello
+#define SESSION_HELLO_CIPHER_AES        0x10    // AES-256-CTR
+#define SESSION_HELLO_CIPHER_CHACHA20   0x20    // ChaCha20
+#define SESSION_HELLO_CIPHERS           (SESSION_HELLO_CIPHER_AES | SESSION_HELLO_CIPHER_CHACHA20)
+
+#define SESSION_CLIENT_HELLO_SIZE       (SESSION_ENTROPY_SIZE + SESSION_FINGERPRINT_SIZE \
+                                            + EC_PUBLIC_KEY_SIZE)
+#define SESSION_SERVER_HELLO_SIZE       (SESSION_ENTROPY_SIZE + EC_PUBLIC_KEY_SIZE \
+                                            + EC_SIGNATURE_SIZE)
+#define SESSION_CLIENT_RESUME_HELLO_SIZE    (SESSION_ENTROPY_SIZE + TICKET_SIZE)
+#define SESSION_SERVER_RESUME_HELLO_SIZE    (SESSION_ENTROPY_SIZE + SESSION_CONFIRM_SIZE)
+#define SESSION_TICKET_MESSAGE_SIZE     (4 + TICKET_SIZE)   // le32 lifetime || ticket
+
+// a handshake message is written and received as a whole
+#if (SESSION_HANDSHAKE_BUFFER_SIZE < 1 + SESSION_SERVER_HELLO_SIZE + SESSION_TICKET_MESSAGE_SIZE) \
+    || (SESSION_HANDSHAKE_BUFFER_SIZE < 1 + SESSION_CLIENT_RESUME_HELLO_SIZE)
+# error "SESSION_HANDSHAKE_BUFFER_SIZE is too small for the handshake messages"
+#endif
+
+typedef enum __cryptochan_session_role {
+    CSR_SERVER = 0,
+    CSR_CLIENT,
+} cryptochan_session_role_t;
 
 typedef enum __cryptochan_session_client_state {
     CSCS_CONNECT_TO_SERVER = 0,
-    CSCS_SEND_ENTROPY_CLIENT_PART,
-    CSCS_WAIT_ENTROPY_SERVER_PART,
-    CSCS_SEND_ECDH_FINGERPRINT,
-    CSCS_SEND_ECDH_SHARED_SECRET_CLIENT_PART,
-    CSCS_WAIT_ECDH_SHARED_SECRET_SERVER_PART,
-    CSCS_SEND_ECDH_SHARED_SECRET_HASH_CLIENT_SIGNATURE,
-    CSCS_WAIT_ECDH_SHARED_SECRET_HASH_SERVER_SIGNATURE,
+    CSCS_SEND_CLIENT_HELLO,
+    CSCS_WAIT_SERVER_HELLO_FLAGS,
+    CSCS_WAIT_SERVER_HELLO,
+    CSCS_WAIT_SERVER_RESUME_HELLO,
+    CSCS_WAIT_TICKET,
+    CSCS_SEND_CLIENT_SIGNATURE,
+    CSCS_SEND_CLIENT_CONFIRM,
     CSCS_CHANNELLING,
 } cryptochan_session_client_state_t;
 
 typedef enum __cryptochan_session_server_state {
-    CSSS_SEND_ENTROPY = 0,
-    CSSS_WAIT_ENTROPY_CLIENT_PART,
-    CSSS_WAIT_ECDH_FINGERPRINT,
+    CSSS_WAIT_CLIENT_HELLO_FLAGS = 0,
+    CSSS_WAIT_CLIENT_HELLO,
+    CSSS_WAIT_CLIENT_RESUME_HELLO,
     CSSS_DETECT_CLIENT,
-    CSSS_SEND_ECDH_SHARED_SECRET_SERVER_PART,
-    CSSS_WAIT_ECDH_SHARED_SECRET_CLIENT_PART,
-    CSSS_SEND_ECDH_SHARED_SECRET_HASH_SERVER_SIGNATURE,
-    CSSS_WAIT_ECDH_SHARED_SECRET_HASH_CLIENT_SIGNATURE,
+    CSSS_SEND_SERVER_HELLO,
+    CSSS_SEND_SERVER_RESUME_HELLO,
+    CSSS_WAIT_CLIENT_SIGNATURE,
+    CSSS_WAIT_CLIENT_CONFIRM,
     CSSS_CHANNELLING,
 } cryptochan_session_server_state_t;
 
+//
+//  Cipher negotiation: the client hello flags carry the offered ciphers
+//  (SESSION_HELLO_CIPHER_*), the server hello flags the one chosen; both are
+//  covered by the signatures (confirms when resuming), so they cannot be downgraded.
+//
+//  Handshake (1 RTT, client data follows its signature in the same flight):
+//    1. client hello:  flags || client_entropy (64) || fingerprint (32) ||
+//                      client ephemeral key (33)
+//                      fingerprint = H(ECDH(static keys)), identifies the client
+//    2. server hello:  flags || server_entropy (64) || server ephemeral key (33) ||
+//                      server signature (64) [|| ticket message]
+//    3. client signature (64), then channelling
+//
+//  The shared secret is derived from ECDH(ephemeral keys), ECDH(static keys) and both
+//  entropies, each side signs H(shared secret, transcript) with its static key.
+//
+//  Resumption (no EC operations, the ticket comes from an earlier handshake):
+//    1. client hello:  RESUME || client_entropy (64) || ticket
+//    2. server hello:  RESUME || server_entropy (64) || server confirm (32) [|| ticket message]
+//                      or REJECT (the client sends a full hello then)
+//    3. client confirm (32), then channelling
+//
+//  The shared secret is derived from the ticket's resumption secret and both entropies,
+//  confirms are H(shared secret, ticket, entropies) proving both sides hold the secret.
+//  The resumption secret of a new ticket is H(shared secret).
+//
+
+struct __cryptochan_session;
+
+// AES-256-CTR sessions queue their recode here while the worker handles its
+// events, the whole batch is then recoded in one pass (many short spans keep
+// the AES pipeline full)
+typedef struct __cryptochan_session_recode_batch {
+    struct __cryptochan_session *sessions[SESSION_RECODE_BATCH_MAX];
+    int count;
+} cryptochan_session_recode_batch_t;
+
 typedef struct __cryptochan_session {
-    uint8_t server_entropy[64];         // 16 for ECDH FP, 3 x 16 for ECDH SS
-    uint8_t client_entropy[64];         // 16 for ECDH FP, 3 x 16 for ECDH SS
-    uint8_t shared_secret[128];
-    cyclic_buffer_t input_buffer;
-    cyclic_buffer_t output_buffer;
-    cyclic_buffer_t encode_buffer;
-    cyclic_buffer_t decode_buffer;
+    uint8_t server_entropy[SESSION_ENTROPY_SIZE];
+    uint8_t client_entropy[SESSION_ENTROPY_SIZE];
+    uint8_t shared_secret[SESSION_SHARED_SECRET_SIZE];  // c2s key, s2c key, c2s/s2c salts
+    uint8_t fingerprint[SESSION_FINGERPRINT_SIZE];
+    uint8_t static_secret[EC_HASH_SIZE];                // ECDH(static keys)
+    uint8_t ephemeral_private_key[EC_PRIVATE_KEY_SIZE];
+    uint8_t client_ephemeral_key[EC_PUBLIC_KEY_SIZE];   // serialized
+    uint8_t server_ephemeral_key[EC_PUBLIC_KEY_SIZE];   // serialized
+    uint8_t resumption_secret[TICKET_SECRET_SIZE];
+    uint8_t ticket[TICKET_SIZE];                        // used for resumption
+    uint8_t hello_flags;                                // peer's hello flags
+    uint8_t ciphers;                                    // offered by the client
+    uint8_t cipher;                                     // chosen by the server
+    bool resumed;
+    bool resume_rejected;                               // client: do not retry the ticket
+    cyclic_buffer_t input_buffer;       // over handshake_input until channelling
+    cyclic_buffer_t output_buffer;      // over handshake_output until channelling
+    keystream_t *encoder;               // recodes output_buffer in place
+    keystream_t *decoder;               // recodes input_buffer in place
+    union {
+        keystream_aes_t aes;            // AES-256-CTR
+        keystream_chacha20_t chacha20;
+    } encoder_engine, decoder_engine;
+    cryptochan_config_t *config;
+    cryptochan_config_client_set_t *client_set;         // referenced (server role)
+    cryptochan_config_server_allowed_client_t *client;  // detected client, in client_set
+    cryptochan_session_recode_batch_t *recode_batch;    // NULL = recode at once
+    session_pool_t *pool;                               // rings owner (NULL = own ones)
+    bool recode_queued;
+    bool splice_input;                                  // input ring is spliced out (mirrored)
+    cryptochan_session_role_t role;
     int state;
+    uint8_t handshake_input[SESSION_HANDSHAKE_BUFFER_SIZE];
+    uint8_t handshake_output[SESSION_HANDSHAKE_BUFFER_SIZE];
 } cryptochan_session_t;
 
+// server: the session holds a reference to client_set (the set of its worker);
+// data rings come from pool (of the worker) once channelling starts and go
+// back there on destroy
+extern bool session_init(
+    cryptochan_session_t *session, cryptochan_session_role_t role,
+    cryptochan_config_t *config, cryptochan_config_client_set_t *client_set,
+    session_pool_t *pool
+);
+extern void session_destroy(cryptochan_session_t *session);
+extern void session_connected(cryptochan_session_t *session);
+extern bool session_process(cryptochan_session_t *session);
+extern bool session_is_channelling(cryptochan_session_t *session);
+extern const char *session_peer_name(cryptochan_session_t *session);
+
+// called periodically: data rings idle since the previous call shrink back
+extern void session_release_idle(cryptochan_session_t *session);
+
+// recode the queued sessions, they are moved to `recoded' (room for
+// SESSION_RECODE_BATCH_MAX) and the batch is empty again; returns their count
+extern int session_recode_batch_run(
+    cryptochan_session_recode_batch_t *batch, cryptochan_session_t **recoded
+);
+
 #endif // __SESSION_H
@@ -0,0 +1,227 @@
+#include "common.h"
+#include "session_pool.h"
+#include "cpu_features.h"
+
+#include <sys/mman.h>
+
+#define __SESSION_POOL_OBJECT_ALIGN 64
+
+void session_pool_init(
+    session_pool_t *pool, size_t object_size, int ring_chunks, int ring_max_chunks,
+    uint32_t flags
+)
+{
+    memset(pool, 0, sizeof(session_pool_t));
+
+    // objects hold the free list link while released
+    object_size = MAX(object_size, sizeof(session_pool_free_t));
+
+    pool->object_size = roundup(object_size, __SESSION_POOL_OBJECT_ALIGN);
+    pool->ring_chunks = ring_chunks;
+    pool->ring_max_chunks = MAX(ring_max_chunks, ring_chunks);
+    pool->flags = flags;
+    pool->numa_node = -1;
+}
+
+void session_pool_set_node(session_pool_t *pool, int numa_node)
+{
+    pool->numa_node = numa_node;
+}
+
+// node preference and transparent hugepages for memory about to be touched
+void __session_pool_place(session_pool_t *pool, cyclic_buffer_t *buf)
+{
+    cyclic_buffer_place(buf, pool->numa_node, pool->flags & SESSION_POOL_TRANSPARENT_HUGE_PAGES);
+}
+
+void session_pool_destroy(session_pool_t *pool)
+{
+    for (int i = 0; i < pool->mapped_count; ++i) {
+        cyclic_buffer_destroy(&(pool->mapped[i]));
+    }
+    free(pool->mapped);
+
+    while (pool->arenas) {
+        session_pool_arena_t *arena = pool->arenas;
+
+        pool->arenas = arena->next;
+        munmap(arena->base, SESSION_POOL_ARENA_SIZE);
+        free(arena);
+    }
+
+    memset(pool, 0, sizeof(session_pool_t));
+}
+
+bool __session_pool_add_arena(session_pool_t *pool)
+{
+    session_pool_arena_t *arena = malloc(sizeof(session_pool_arena_t));
+    uint8_t *base = MAP_FAILED;
+
+    if (!arena) {
+        perror("session_pool: malloc");
+        return false;
+    }
+
+    // explicit hugepages need reserved ones (vm.nr_hugepages), fall back to normal pages
+    if (pool->flags & SESSION_POOL_HUGE_PAGES) {
+        base = mmap(NULL, SESSION_POOL_ARENA_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base == MAP_FAILED) {
+            perror("session_pool: mmap(MAP_HUGETLB), using normal pages");
+            pool->flags &= ~SESSION_POOL_HUGE_PAGES;
+        }
+    }
+    if (base == MAP_FAILED) {
+        // over-map by a hugepage and trim, so the arena is 2 MiB aligned and
+        // transparent hugepages can back all of it
+        size_t map_size = SESSION_POOL_ARENA_SIZE + CYCLIC_BUFFER_HUGE_PAGE_SIZE;
+        uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (map == MAP_FAILED) {
+            perror("session_pool: mmap");
+            free(arena);
+            return false;
+        }
+
+        base = (uint8_t*)roundup((uintptr_t)map, CYCLIC_BUFFER_HUGE_PAGE_SIZE);
+        if (base > map)
+            { munmap(map, base - map); }
+        if (map + map_size > base + SESSION_POOL_ARENA_SIZE)
+            { munmap(base + SESSION_POOL_ARENA_SIZE, (map + map_size) - (base + SESSION_POOL_ARENA_SIZE)); }
+
+        if ((pool->flags & SESSION_POOL_TRANSPARENT_HUGE_PAGES)
+            && (madvise(base, SESSION_POOL_ARENA_SIZE, MADV_HUGEPAGE) == -1)) {
+            perror("session_pool: madvise(MADV_HUGEPAGE)");
+        }
+    }
+
+    // before the first touch, pages already faulted in stay where they are
+    if ((pool->numa_node != -1) && !cpu_numa_prefer_node(base, SESSION_POOL_ARENA_SIZE, pool->numa_node))
+        { perror("session_pool: mbind"); }
+
+    arena->base = base;
+    arena->used = 0;
+    arena->next = pool->arenas;
+    pool->arenas = arena;
+
+    return true;
+}
+
+void *__session_pool_carve(session_pool_t *pool, size_t size, size_t align)
+{
+    session_pool_arena_t *arena = pool->arenas;
+    size_t offset = arena ? roundup(arena->used, align) : 0;
+
+    // the rest of the current arena is left unused
+    if (!arena || (offset + size > SESSION_POOL_ARENA_SIZE)) {
+        if (!__session_pool_add_arena(pool))
+            { return NULL; }
+        arena = pool->arenas;
+        offset = 0;
+    }
+
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+void *session_pool_object_get(session_pool_t *pool)
+{
+    void *object;
+
+    if (pool->free_objects) {
+        object = pool->free_objects;
+        pool->free_objects = pool->free_objects->next;
+    } else if (!(object = __session_pool_carve(pool, pool->object_size, __SESSION_POOL_OBJECT_ALIGN))) {
+        return NULL;
+    }
+
+    memset(object, 0, pool->object_size);
+    return object;
+}
+
+void session_pool_object_put(session_pool_t *pool, void *object)
+{
+    session_pool_free_t *entry = object;
+
+    entry->next = pool->free_objects;
+    pool->free_objects = entry;
+}
+
+bool session_pool_ring_get(session_pool_t *pool, cyclic_buffer_t *buf, uint32_t flags)
+{
+    bool mirrored = flags & (CYCLIC_BUFFER_FLAG_MIRRORED | CYCLIC_BUFFER_FLAG_SPLICE);
+
+    if (mirrored || (pool->ring_max_chunks > pool->ring_chunks)) {
+        // kind of a kept mapping: splice implies mirrored
+        uint32_t kind = !mirrored ? CYCLIC_BUFFER_FLAG_ELASTIC
+            : (flags & CYCLIC_BUFFER_FLAG_SPLICE) ? (CYCLIC_BUFFER_FLAG_MIRRORED | CYCLIC_BUFFER_FLAG_SPLICE)
+            : CYCLIC_BUFFER_FLAG_MIRRORED;
+
+        // a kept mapping of the same kind (no memfd_create/mmap)
+        for (int i = pool->mapped_count - 1; i >= 0; --i) {
+            if (pool->mapped[i].flags == kind) {
+                *buf = pool->mapped[i];
+                pool->mapped[i] = pool->mapped[--(pool->mapped_count)];
+                return true;
+            }
+        }
+        bool created = mirrored
+            ? cyclic_buffer_init_with_flags(buf, pool->ring_chunks, flags)
+            : cyclic_buffer_init_elastic(buf, pool->ring_chunks, pool->ring_max_chunks);
+
+        if (created)
+            { __session_pool_place(pool, buf); }
+        return created;
+    }
+
+    // fixed ring from the arenas (recycled through free_rings)
+    size_t ring_size = (size_t)CYCLIC_BUFFER_CHUNK_SIZE * pool->ring_chunks;
+    uint8_t *mem;
+
+    if (pool->free_rings) {
+        mem = (uint8_t*)pool->free_rings;
+        pool->free_rings = pool->free_rings->next;
+    } else if (!(mem = __session_pool_carve(pool, ring_size, CYCLIC_BUFFER_CHUNK_SIZE))) {
+        return false;
+    }
+
+    return cyclic_buffer_init_with_memory(buf, ring_size, mem);
+}
+
+void session_pool_ring_put(session_pool_t *pool, cyclic_buffer_t *buf)
+{
+    uint32_t ring_size = CYCLIC_BUFFER_CHUNK_SIZE * pool->ring_chunks;
+
+    if (!buf->data_ptr)
+        { return; }
+
+    if ((buf->flags & CYCLIC_BUFFER_FLAG_EXTERNAL) && (buf->total_size == ring_size)) {
+        session_pool_free_t *entry = (session_pool_free_t*)buf->data_ptr;
+
+        entry->next = pool->free_rings;
+        pool->free_rings = entry;
+        memset(buf, 0, sizeof(cyclic_buffer_t));
+        return;
+    }
+
+    // elastic ones shrink on reset (and give their pages back)
+    uint32_t ring_max_size = CYCLIC_BUFFER_CHUNK_SIZE * pool->ring_max_chunks;
+    bool reusable = (buf->flags & CYCLIC_BUFFER_FLAG_ELASTIC)
+        ? ((buf->min_size == ring_size) && (buf->max_size == ring_max_size))
+        : ((buf->flags & CYCLIC_BUFFER_FLAG_MIRRORED) && (buf->total_size == ring_size));
+
+    if (reusable && (pool->mapped_count < SESSION_POOL_MAPPED_MAX)) {
+        if (!pool->mapped
+            && !(pool->mapped = malloc(SESSION_POOL_MAPPED_MAX * sizeof(cyclic_buffer_t)))) {
+            perror("session_pool: malloc");
+        } else {
+            cyclic_buffer_reset(buf);
+            pool->mapped[pool->mapped_count++] = *buf;
+            memset(buf, 0, sizeof(cyclic_buffer_t));
+            return;
+        }
+    }
+
+    cyclic_buffer_destroy(buf);
+}
@@ -0,0 +1,82 @@
+#ifndef __SESSION_POOL_H
+#define __SESSION_POOL_H
+
+#include "common.h"
+#include "cyclic_buffer.h"
+
+// memory is taken from the system in arenas of this size (a multiple of 2 MiB,
+// so explicit hugepages can back them)
+#ifndef SESSION_POOL_ARENA_SIZE
+# define SESSION_POOL_ARENA_SIZE 0x2000000
+#endif
+
+// mirrored (memfd) and elastic rings kept mapped for reuse
+#ifndef SESSION_POOL_MAPPED_MAX
+# define SESSION_POOL_MAPPED_MAX 1024
+#endif
+
+// session_pool_init() flags
+#define SESSION_POOL_HUGE_PAGES             0x1     // arenas on explicit hugepages (MAP_HUGETLB)
+#define SESSION_POOL_TRANSPARENT_HUGE_PAGES 0x2     // madvise(MADV_HUGEPAGE) arenas and large rings
+
+#if (SESSION_POOL_ARENA_SIZE <= 0) || ((SESSION_POOL_ARENA_SIZE & 0x1FFFFF) != 0)
+# error "SESSION_POOL_ARENA_SIZE is not a positive integer multiple of 2 MiB"
+#endif
+
+typedef struct __session_pool_arena {
+    struct __session_pool_arena *next;
+    uint8_t *base;
+    size_t used;
+} session_pool_arena_t;
+
+// released object or ring memory, the link is kept in the memory itself
+typedef struct __session_pool_free {
+    struct __session_pool_free *next;
+} session_pool_free_t;
+
+//
+//  Per worker (not thread safe) pool of session objects and their rings:
+//  objects are carved from large arenas; plain rings are either elastic
+//  (ring_max_chunks > ring_chunks) with their own mappings, or fixed ones
+//  carved from the arenas as well (ring_max_chunks == ring_chunks, so they
+//  share the arenas' hugepages); mirrored rings keep their own mappings.
+//  All are recycled on release, so accepting a connection needs no malloc()
+//  and no mmap() once the pool is warm and the heap does not fragment under
+//  connection churn; arenas are returned to the system by
+//  session_pool_destroy() only
+//
+
+typedef struct __session_pool {
+    size_t object_size;                 // rounded up to a cache line
+    int ring_chunks;                    // CYCLIC_BUFFER_CHUNK_SIZE units per ring
+    int ring_max_chunks;                // > ring_chunks: elastic rings, else fixed ones from arenas
+    uint32_t flags;                     // SESSION_POOL_*, HUGE_PAGES dropped when none are reserved
+    int numa_node;                      // preferred node of new memory, -1 for any
+    session_pool_arena_t *arenas;       // the first one is being carved
+    session_pool_free_t *free_objects;
+    session_pool_free_t *free_rings;    // plain ring memory
+    cyclic_buffer_t *mapped;            // SESSION_POOL_MAPPED_MAX, allocated on demand
+    int mapped_count;
+} session_pool_t;
+
+extern void session_pool_init(
+    session_pool_t *pool, size_t object_size, int ring_chunks, int ring_max_chunks,
+    uint32_t flags
+);
+extern void session_pool_destroy(session_pool_t *pool);
+
+// memory mapped from now on prefers the node (of the worker's CPU), -1 for any
+extern void session_pool_set_node(session_pool_t *pool, int numa_node);
+
+// zero-filled object of object_size bytes (NULL when out of memory)
+extern void *session_pool_object_get(session_pool_t *pool);
+extern void session_pool_object_put(session_pool_t *pool, void *object);
+
+// empty ring of ring_chunks (flags as for cyclic_buffer_init_with_flags;
+// elastic up to ring_max_chunks unless mirrored),
+// ring_put takes any ring back (ones it cannot reuse are destroyed; rings over
+// caller's memory are expected to be the pool's when they are of its size)
+extern bool session_pool_ring_get(session_pool_t *pool, cyclic_buffer_t *buf, uint32_t flags);
+extern void session_pool_ring_put(session_pool_t *pool, cyclic_buffer_t *buf);
+
+#endif // __SESSION_POOL_H
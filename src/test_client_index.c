@@ -0,0 +1,159 @@
+#include "common.h"
+#include "random.h"
+#include "cryptochan_config.h"
+#include "ec_helper.h"
+
+#define __CLIENTS_COUNT         5       // 16 slots (mask 15)
+#define __LAST_SLOT             15
+
+typedef struct __test_set {
+    cryptochan_config_client_set_t set;
+    cryptochan_config_server_allowed_client_t clients[__CLIENTS_COUNT];
+} test_set_t;
+
+// synthetic fingerprints: the index takes the slot from the first 4 bytes
+// (little-endian), the rest only tells fingerprints apart
+void set_fingerprint(uint8_t *fingerprint, uint32_t low, uint8_t tail)
+{
+    prng_fill(fingerprint, EC_HASH_SIZE);
+    for (int i = 0; i < 4; ++i) {
+        fingerprint[i] = (uint8_t)(low >> (i * 8));
+    }
+    fingerprint[EC_HASH_SIZE - 1] = tail;
+}
+
+void test_set_init(test_set_t *ts)
+{
+    static const char *names[__CLIENTS_COUNT] = { "c0", "c1", "c2", "c3", "c4" };
+
+    memset(ts, 0, sizeof(test_set_t));
+    ts->set.clients = ts->clients;
+    ts->set.client_count = __CLIENTS_COUNT;
+
+    for (int i = 0; i < __CLIENTS_COUNT; ++i) {
+        ts->clients[i].name = names[i];
+    }
+}
+
+void test_set_destroy(test_set_t *ts)
+{
+    free(ts->set.index.slots);
+    ts->set.index.slots = NULL;
+}
+
+// every client is found by its fingerprint (a copy, not the indexed memory)
+bool find_all(test_set_t *ts)
+{
+    uint8_t fingerprint[EC_HASH_SIZE];
+
+    for (int i = 0; i < __CLIENTS_COUNT; ++i) {
+        memcpy(fingerprint, ts->clients[i].fingerprint, EC_HASH_SIZE);
+        if (cryptochan_config_find_client(&(ts->set), fingerprint) != &(ts->clients[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int run_index_test(
+    const char *name, test_set_t *ts, const uint8_t *missing, bool (*check)(test_set_t *ts)
+)
+{
+    char *error_desc = NULL;
+    int result = EXIT_SUCCESS;
+
+    if (!cryptochan_config_build_client_index(&(ts->set), &error_desc)) {
+        printf("[%s] FAILED (build: %s)\n", name, error_desc ? error_desc : "?");
+        free(error_desc);
+        test_set_destroy(ts);
+        return EXIT_FAILURE;
+    }
+
+    if (!find_all(ts)) {
+        printf("[%s] FAILED (client not found)\n", name);
+        result = EXIT_FAILURE;
+    } else if (missing && cryptochan_config_find_client(&(ts->set), missing)) {
+        printf("[%s] FAILED (unknown fingerprint found)\n", name);
+        result = EXIT_FAILURE;
+    } else if (check && !check(ts)) {
+        printf("[%s] FAILED (layout)\n", name);
+        result = EXIT_FAILURE;
+    } else {
+        printf("[%s] ok\n", name);
+    }
+
+    test_set_destroy(ts);
+    return result;
+}
+
+// the last slot and the ones after the wrap hold the colliding clients
+bool check_wrapped(test_set_t *ts)
+{
+    cryptochan_config_client_index_t *index = &(ts->set.index);
+
+    return (index->mask == __LAST_SLOT)
+        && (index->slots[__LAST_SLOT] == &(ts->clients[0]))
+        && (index->slots[0] == &(ts->clients[1]))
+        && (index->slots[1] == &(ts->clients[2]));
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t missing[EC_HASH_SIZE];
+    test_set_t ts;
+    int result = EXIT_SUCCESS;
+
+    // same low 32 bits (one probe sequence), a miss on that sequence
+    test_set_init(&ts);
+    for (int i = 0; i < __CLIENTS_COUNT; ++i) {
+        set_fingerprint(ts.clients[i].fingerprint, 0x12345674, (uint8_t)i);
+    }
+    set_fingerprint(missing, 0x12345674, 0xFF);
+    if (run_index_test("collisions", &ts, missing, NULL) != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    // probe from the last slot wraps around to the first ones, a miss probes
+    // over the wrap up to the empty slot after it
+    test_set_init(&ts);
+    for (int i = 0; i < __CLIENTS_COUNT; ++i) {
+        set_fingerprint(ts.clients[i].fingerprint,
+            (i < 3) ? (0xABCD0000 | __LAST_SLOT) : (uint32_t)(4 + i), (uint8_t)i);
+    }
+    set_fingerprint(missing, __LAST_SLOT, 0xFF);
+    if (run_index_test("wrap", &ts, missing, check_wrapped) != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    // spread fingerprints, a miss on an empty slot
+    test_set_init(&ts);
+    for (int i = 0; i < __CLIENTS_COUNT; ++i) {
+        set_fingerprint(ts.clients[i].fingerprint, (uint32_t)i * 3, (uint8_t)i);
+    }
+    set_fingerprint(missing, 13, 0xFF);
+    if (run_index_test("miss", &ts, missing, NULL) != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    // the same key twice is rejected (naming both clients)
+    char *error_desc = NULL;
+
+    test_set_init(&ts);
+    for (int i = 0; i < __CLIENTS_COUNT; ++i) {
+        set_fingerprint(ts.clients[i].fingerprint, 0x1000 + (uint32_t)i, (uint8_t)i);
+    }
+    memcpy(ts.clients[4].fingerprint, ts.clients[1].fingerprint, EC_HASH_SIZE);
+
+    if (cryptochan_config_build_client_index(&(ts.set), &error_desc)
+        || !error_desc || !strstr(error_desc, "c4") || !strstr(error_desc, "c1")) {
+        printf("[duplicate] FAILED (%s)\n", error_desc ? error_desc : "accepted");
+        result = EXIT_FAILURE;
+    } else {
+        printf("[duplicate] ok\n");
+    }
+    free(error_desc);
+    test_set_destroy(&ts);
+
+    return result;
+}
@@ -6,6 +6,8 @@
 
 #include <pthread.h>
 #include <sched.h>
+#include <sys/socket.h>
+#include <fcntl.h>
 
 #define __DATA_SIZE     0x400000
 #define __MASK_SIZE     0x12345
@@ -19,8 +21,22 @@ typedef struct __runner_data_t {
     _Atomic int     *stage;
 } runner_data_t;
 
+typedef struct __mask_keystream {
+    keystream_t base;
+    uint8_t     *mask;
+    uint32_t    size;
+    uint32_t    idx;
+} mask_keystream_t;
+
+uint32_t buffer_flags = 0;
+
+void mask_keystream_xor(keystream_t *ks, uint8_t *dptr, size_t size);
+bool init_test_buffer(cyclic_buffer_t *buf, int chunks);
+
 int run_simple_test();
 int run_thread_test();
+int run_iovec_test();
+int run_transfer_test();
 
 void *run_writer(void *arg);
 void *run_recoder(void *arg);
@@ -29,17 +45,34 @@ void *run_reader(void *arg);
 int main(int argc, char **argv)
 {
     if (argc > 3) {
-        fprintf(stderr, "Usage: %s [thread|simple]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [thread|simple|iovec|transfer] [mirrored|splice|elastic]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     int (*run_func)() = run_simple_test;
 
-    if (argc == 2) {
+    if (argc == 3) {
+        if (!strcasecmp(argv[2], "mirrored")) {
+            buffer_flags |= CYCLIC_BUFFER_FLAG_MIRRORED;
+        } else if (!strcasecmp(argv[2], "splice")) {
+            buffer_flags |= CYCLIC_BUFFER_FLAG_SPLICE;
+        } else if (!strcasecmp(argv[2], "elastic")) {
+            buffer_flags |= CYCLIC_BUFFER_FLAG_ELASTIC;
+        } else {
+            fprintf(stderr, "Unknown buffer type: %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc >= 2) {
         if (!strcasecmp(argv[1], "thread")) {
             run_func = run_thread_test;
         } else if (!strcasecmp(argv[1], "simple")) {
             run_func = run_simple_test;
+        } else if (!strcasecmp(argv[1], "iovec")) {
+            run_func = run_iovec_test;
+        } else if (!strcasecmp(argv[1], "transfer")) {
+            run_func = run_transfer_test;
         } else {
             fprintf(stderr, "Unknown mode: %s\n", argv[1]);
             return EXIT_FAILURE;
@@ -47,6 +80,7 @@ int main(int argc, char **argv)
     }
 
     printf("max scalar size = %ld\n", sizeof(max_scalar_t));
+    printf("xor kernel = %s\n", xor_memory_region_kernel_name());
 
     return run_func();
 }
@@ -60,11 +94,12 @@ int run_thread_test()
     runner_data_t runners[3];
     _Atomic int stage = 0;
 
-    fill_random(sbuf, __DATA_SIZE);
-    fill_random(dbuf, __DATA_SIZE);
-    fill_random(xbuf, __MASK_SIZE);
+    prng_fill(sbuf, __DATA_SIZE);
+    prng_fill(dbuf, __DATA_SIZE);
+    prng_fill(xbuf, __MASK_SIZE);
 
-    cyclic_buffer_init(&buffer, 1);
+    if (!init_test_buffer(&buffer, 1))
+        { return EXIT_FAILURE; }
     memset(runners, 0, sizeof(runners));
 
 #define __INIT_RUNNER(IDX, BUF, SZ, NAME) \
@@ -159,7 +194,7 @@ void *run_recoder(void *arg)
     cyclic_buffer_t xor_buf;
 
     srand(*((unsigned int*)(info->buf)));
-    cyclic_buffer_init(&xor_buf, 1);
+    init_test_buffer(&xor_buf, 1);
 
     for (int b_idx = 0; *info->stage < 2;) {
         // wait start signal
@@ -231,18 +266,20 @@ void *run_reader(void *arg)
 int run_simple_test()
 {
     cyclic_buffer_t buffer;
-    cyclic_buffer_init(&buffer, 1);
+    if (!init_test_buffer(&buffer, 1))
+        { return EXIT_FAILURE; }
 
     uint8_t *sbuf = malloc(__DATA_SIZE);
     uint8_t *dbuf = malloc(__DATA_SIZE);
     uint8_t *xbuf = malloc(__MASK_SIZE);
 
     for (int k = 0; k < 5; ++k) {
-        fill_random(sbuf, __DATA_SIZE);
-        fill_random(dbuf, __DATA_SIZE);
-        fill_random(xbuf, __MASK_SIZE);
+        prng_fill(sbuf, __DATA_SIZE);
+        prng_fill(dbuf, __DATA_SIZE);
+        prng_fill(xbuf, __MASK_SIZE);
         srand(*((unsigned int*)sbuf));
-        for (int s_idx = 0, d_idx = 0, x_idx = 0; d_idx < __DATA_SIZE;) {
+        mask_keystream_t mks = { { mask_keystream_xor }, xbuf, __MASK_SIZE, 0 };
+        for (int s_idx = 0, d_idx = 0; d_idx < __DATA_SIZE;) {
             if (rand() % 5) {
                 int to_write = (rand() % 2) ? __DATA_SIZE : rand() & 0x3F;
                 to_write = MIN(to_write, __DATA_SIZE - s_idx);
@@ -250,15 +287,26 @@ int run_simple_test()
                 printf("wrt: k = %-3d s_idx = 0x%04x d_idx = 0x%04x n = %d/%d\n",
                     k, s_idx, d_idx, n, to_write);
                 s_idx += n;
+
+                // elastic: the writer keeps finding the ring full
+                if ((n < to_write) && cyclic_buffer_grow(&buffer)) {
+                    printf("grown: total_size = %u\n", buffer.total_size);
+                }
             }
 
             if (rand() % 3) {
                 int to_recode = (rand() % 2) ? __MASK_SIZE : rand() & 0x3F;
-                to_recode = MIN(to_recode, __MASK_SIZE - x_idx);
-                int n = cyclic_buffer_recode_xor(&buffer, &xbuf[x_idx], to_recode);
-                printf("recoded: n = %d (x_idx = %d)\n", n, x_idx);
-                x_idx += n;
-                if (x_idx == __MASK_SIZE) { x_idx = 0; }
+                if (rand() % 2) {
+                    // fused path: keystream continues from the same mask position
+                    int n = cyclic_buffer_recode_keystream(&buffer, &mks.base, to_recode);
+                    printf("recoded (keystream): n = %d (x_idx = %d)\n", n, mks.idx);
+                } else {
+                    to_recode = MIN(to_recode, __MASK_SIZE - mks.idx);
+                    int n = cyclic_buffer_recode_xor(&buffer, &xbuf[mks.idx], to_recode);
+                    printf("recoded: n = %d (x_idx = %d)\n", n, mks.idx);
+                    mks.idx += n;
+                    if (mks.idx == __MASK_SIZE) { mks.idx = 0; }
+                }
             }
 
             if (rand() % 4) {
@@ -269,6 +317,10 @@ int run_simple_test()
                     k, s_idx, d_idx, n, to_read);
                 d_idx += n;
             }
+
+            if (!(rand() % 16) && cyclic_buffer_release_idle(&buffer)) {
+                printf("released: total_size = %u\n", buffer.total_size);
+            }
         }
 
         printf("\n");
@@ -295,3 +347,200 @@ int run_simple_test()
     return EXIT_SUCCESS;
 }
 
+
+
+void mask_keystream_xor(keystream_t *ks, uint8_t *dptr, size_t size)
+{
+    mask_keystream_t *mks = (mask_keystream_t*)ks;
+
+    // cycle the mask from the current position
+    while (size > 0) {
+        uint32_t n = MIN(size, mks->size - mks->idx);
+        xor_memory_region(dptr, mks->mask + mks->idx, n);
+        dptr += n;
+        size -= n;
+        mks->idx += n;
+        if (mks->idx == mks->size) { mks->idx = 0; }
+    }
+}
+
+
+bool init_test_buffer(cyclic_buffer_t *buf, int chunks)
+{
+    // elastic: up to 16 times larger (grown by the single-threaded tests only)
+    if (buffer_flags & CYCLIC_BUFFER_FLAG_ELASTIC) {
+        return cyclic_buffer_init_elastic(buf, chunks, chunks * 16);
+    }
+
+    return cyclic_buffer_init_with_flags(buf, chunks, buffer_flags);
+}
+
+
+int run_iovec_test()
+{
+    cyclic_buffer_t buffer;
+    struct iovec iov[CYCLIC_BUFFER_IOV_MAX];
+    int in_fds[2], out_fds[2], pipe_fds[2];
+    uint32_t page_mask = cyclic_buffer_page_size() - 1;
+    uint32_t in_pipe = 0, spliced = 0;
+
+    // splice needs whole pages: give it a few
+    int chunks = (buffer_flags & CYCLIC_BUFFER_FLAG_SPLICE) ? 4 : 1;
+
+    if (!init_test_buffer(&buffer, chunks))
+        { return EXIT_FAILURE; }
+
+    if ((socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in_fds) != 0)
+        || (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out_fds) != 0))
+        { perror("socketpair"); return EXIT_FAILURE; }
+
+    if (pipe2(pipe_fds, O_NONBLOCK) != 0)
+        { perror("pipe2"); return EXIT_FAILURE; }
+
+    uint8_t *sbuf = malloc(__DATA_SIZE);
+    uint8_t *dbuf = malloc(__DATA_SIZE);
+    uint8_t *xbuf = malloc(__MASK_SIZE);
+
+    prng_fill(sbuf, __DATA_SIZE);
+    prng_fill(dbuf, __DATA_SIZE);
+    prng_fill(xbuf, __MASK_SIZE);
+    srand(*((unsigned int*)sbuf));
+
+    // sbuf -> in socket -> (readv) ring (writev) -> out socket -> dbuf
+    for (int s_idx = 0, d_idx = 0, x_idx = 0; d_idx < __DATA_SIZE;) {
+        if (rand() % 5) {
+            int to_send = (rand() % 2) ? __DATA_SIZE : rand() & 0x3F;
+            to_send = MIN(to_send, __DATA_SIZE - s_idx);
+            ssize_t n = send(in_fds[0], &sbuf[s_idx], to_send, 0);
+            if (n > 0) { s_idx += n; }
+        }
+
+        if (rand() % 3) {
+            int to_write = (rand() % 2) ? __DATA_SIZE : rand() & 0x3F;
+            int iovcnt = cyclic_buffer_write_reserve(&buffer, iov, to_write);
+            if (!iovcnt && cyclic_buffer_grow(&buffer)) {
+                printf("grown: total_size = %u\n", buffer.total_size);
+                iovcnt = cyclic_buffer_write_reserve(&buffer, iov, to_write);
+            }
+            ssize_t n = iovcnt ? readv(in_fds[1], iov, iovcnt) : 0;
+            if (n > 0) { cyclic_buffer_write_commit(&buffer, n); }
+            printf("readv: iovcnt = %d n = %ld/%d\n", iovcnt, n, to_write);
+        }
+
+        if (rand() % 3) {
+            int to_recode = (rand() % 2) ? __MASK_SIZE : rand() & 0x3F;
+            to_recode = MIN(to_recode, __MASK_SIZE - x_idx);
+            x_idx += cyclic_buffer_recode_xor(&buffer, &xbuf[x_idx], to_recode);
+            if (x_idx == __MASK_SIZE) { x_idx = 0; }
+        }
+
+        if ((rand() % 3) && (buffer_flags & CYCLIC_BUFFER_FLAG_SPLICE) && in_pipe) {
+            // pipe -> out socket, commit whole pages only
+            ssize_t n = splice(pipe_fds[0], NULL, out_fds[0], NULL, in_pipe, SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                in_pipe -= n;
+                spliced += n;
+                if (spliced & ~page_mask) {
+                    cyclic_buffer_splice_commit(&buffer, spliced & ~page_mask);
+                    spliced &= page_mask;
+                }
+            }
+            printf("splice: n = %ld/%d\n", n, in_pipe);
+        } else if ((rand() % 3) && !in_pipe) {
+            int to_read = (rand() % 2) ? __DATA_SIZE : rand() & 0x7F;
+            ssize_t n = 0;
+            int iovcnt = 0;
+
+            // ring -> pipe (whole pages), the rest is copied
+            if (buffer_flags & CYCLIC_BUFFER_FLAG_SPLICE) {
+                n = cyclic_buffer_splice_read(&buffer, pipe_fds[1], to_read);
+                if (n > 0) { in_pipe = n; }
+                printf("splice_read: n = %ld/%d\n", n, to_read);
+            }
+            if (n <= 0) {
+                // copy up to the page boundary only (next time it may splice)
+                if ((buffer_flags & CYCLIC_BUFFER_FLAG_SPLICE) && (buffer.read_idx & page_mask)) {
+                    to_read = MIN(to_read, page_mask + 1 - (buffer.read_idx & page_mask));
+                }
+                iovcnt = cyclic_buffer_read_reserve(&buffer, iov, to_read);
+                n = iovcnt ? writev(out_fds[0], iov, iovcnt) : 0;
+                if (n > 0) { cyclic_buffer_read_commit(&buffer, n); }
+                printf("writev: iovcnt = %d n = %ld/%d\n", iovcnt, n, to_read);
+            }
+        }
+
+        if (rand() % 4) {
+            ssize_t n = recv(out_fds[1], &dbuf[d_idx], __DATA_SIZE - d_idx, 0);
+            if (n > 0) { d_idx += n; }
+        }
+    }
+
+    // xor back
+    for (int d_idx = 0, x_idx = 0; d_idx < __DATA_SIZE;) {
+        dbuf[d_idx++] ^= xbuf[x_idx++];
+        if (x_idx == __MASK_SIZE) { x_idx = 0; }
+    }
+
+    if (memcmp(sbuf, dbuf, __DATA_SIZE)) {
+        int i = 0;
+        for (; i < __DATA_SIZE; ++i) {
+            if (sbuf[i] != dbuf[i]) break;
+        }
+        printf("dbuf[%d] = 0x%02x vs sbuf[%d] = 0x%02x\n", i, dbuf[i], i, sbuf[i]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+int run_transfer_test()
+{
+    cyclic_buffer_t small, large;
+    uint8_t small_mem[300], sbuf[300], dbuf[300], xbuf[300];
+
+    prng_fill(sbuf, sizeof(sbuf));
+    prng_fill(xbuf, sizeof(xbuf));
+
+    for (int round = 0; round < 1000; ++round) {
+        // wrapped content: readable (recoded) part followed by the part to recode
+        uint32_t skip = rand() % sizeof(small_mem);
+        uint32_t size = rand() % sizeof(small_mem);
+        uint32_t recoded = rand() % (size + 1);
+
+        if (!cyclic_buffer_init_with_memory(&small, sizeof(small_mem), small_mem)
+            || !init_test_buffer(&large, 1))
+            { return EXIT_FAILURE; }
+
+        cyclic_buffer_write(&small, sbuf, skip);
+        cyclic_buffer_recode_none(&small);
+        cyclic_buffer_read(&small, dbuf, skip);
+
+        cyclic_buffer_write(&small, sbuf, size);
+        cyclic_buffer_recode_xor(&small, xbuf, recoded);
+
+        if (!cyclic_buffer_transfer(&large, &small))
+            { return EXIT_FAILURE; }
+        cyclic_buffer_destroy(&small);
+
+        // the rest is recoded after the transfer
+        if ((large.available_to_read != recoded)
+            || (cyclic_buffer_recode_xor(&large, xbuf + recoded, size) != size - recoded)
+            || (cyclic_buffer_read(&large, dbuf, sizeof(dbuf)) != size)) {
+            printf("round %d: skip = %u size = %u recoded = %u\n", round, skip, size, recoded);
+            return EXIT_FAILURE;
+        }
+        cyclic_buffer_destroy(&large);
+
+        for (uint32_t i = 0; i < size; ++i) {
+            if ((dbuf[i] ^ xbuf[i]) != sbuf[i]) {
+                printf("round %d: dbuf[%u] = 0x%02x vs sbuf[%u] = 0x%02x\n",
+                    round, i, dbuf[i] ^ xbuf[i], i, sbuf[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    printf("transfer: ok\n");
+    return EXIT_SUCCESS;
+}
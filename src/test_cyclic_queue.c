@@ -8,6 +8,7 @@
 #define __PRODUCERS_COUNT       10
 #define __CONSUMERS_COUNT       ((__PRODUCERS_COUNT * 3) / 4)
 #define __TEST_VALUES_COUNT     ((CYCLIC_QUEUE_MIN_CAPACITY) * 100 * (__PRODUCERS_COUNT))
+#define __BATCH_MAX             ((CYCLIC_QUEUE_MIN_CAPACITY) * 3 / 2)
 
 typedef struct __complex_uint64 {
     uint64_t real;
@@ -27,17 +28,44 @@ typedef struct __runner_data_t {
 } runner_data_t;
 
 
+int run_queue_test(cyclic_queue_mode_t mode);
+
 void *run_producer(void *arg);
 void *run_consumer(void *arg);
 
 int main(int argc, char **argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [growable|bounded]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 2) {
+        if (!strcasecmp(argv[1], "growable")) {
+            return run_queue_test(CYCLIC_QUEUE_GROWABLE);
+        } else if (!strcasecmp(argv[1], "bounded")) {
+            return run_queue_test(CYCLIC_QUEUE_BOUNDED);
+        } else {
+            fprintf(stderr, "Unknown mode: %s\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // run both modes by default
+    if (run_queue_test(CYCLIC_QUEUE_GROWABLE) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return run_queue_test(CYCLIC_QUEUE_BOUNDED);
+}
+
+int run_queue_test(cyclic_queue_mode_t mode)
 {
     _Atomic int stage = 0;
     _Atomic int vindex = 0;
     _Atomic int consumed_count = 0;
     cyclic_queue_t queue;
     complex_uint64_t *values = malloc(__TEST_VALUES_COUNT * sizeof(complex_uint64_t));
-    fill_random((uint8_t*)values, __TEST_VALUES_COUNT * sizeof(complex_uint64_t));
+    prng_fill((uint8_t*)values, __TEST_VALUES_COUNT * sizeof(complex_uint64_t));
 
     runner_data_t producers_data[__PRODUCERS_COUNT];
     runner_data_t consumers_data[__CONSUMERS_COUNT];
@@ -45,8 +73,18 @@ int main(int argc, char **argv)
     memset(producers_data, 0, sizeof(producers_data));
     memset(consumers_data, 0, sizeof(consumers_data));
 
-    cyclic_queue_init(&queue, sizeof(complex_uint64_t), 0);
-    queue.max_capacity = 0x2000;
+    if (mode == CYCLIC_QUEUE_BOUNDED) {
+        // fixed capacity: producers have to retry when queue is full
+        if (!cyclic_queue_init(&queue, sizeof(complex_uint64_t), CYCLIC_QUEUE_MIN_CAPACITY, mode))
+            { return EXIT_FAILURE; }
+    } else {
+        if (!cyclic_queue_init(&queue, sizeof(complex_uint64_t), 0, mode))
+            { return EXIT_FAILURE; }
+        queue.max_capacity = 0x2000;
+    }
+
+    printf("[main] mode: %s, capacity: %d\n",
+        (mode == CYCLIC_QUEUE_BOUNDED) ? "bounded" : "growable", queue.capacity);
 
     for (int i = 0; i < __PRODUCERS_COUNT; ++i) {
         producers_data[i].queue = &queue;
@@ -112,6 +150,9 @@ int main(int argc, char **argv)
         abort();
     }
 
+    cyclic_queue_destroy(&queue);
+    free(values);
+
     return EXIT_SUCCESS;
 }
 
@@ -120,12 +161,11 @@ void *run_producer(void *arg)
 {
     runner_data_t *info = (runner_data_t*)arg;
     struct timespec sleep_time = {0, 0};
-    int vidx = -1;
-    bool cached = false;
+    int vidx = -1, vcount = 0;
 
     srand(*((unsigned int*)(info->values)));
 
-    while ((vidx < __TEST_VALUES_COUNT) || cached) {
+    while ((vidx < __TEST_VALUES_COUNT) || vcount) {
         // wait start signal
         if (*info->stage < 1) { sched_yield(); continue; }
 
@@ -137,26 +177,24 @@ void *run_producer(void *arg)
             }
         }
 
-        // push next value
+        // push next value(s)
 
-        // if value is not cached: get next index to read from values
-        if (!cached) {
-            do {
-                vidx = atomic_load_explicit(info->vindex, memory_order_relaxed);
-            } while (!atomic_compare_exchange_weak_explicit(
-                    info->vindex, &vidx, vidx + 1,
-                    memory_order_acquire, memory_order_relaxed
-            ));
+        // if no values are cached: get next index range to read from values
+        if (!vcount) {
+            int batch = (rand() % 2) ? (1 + (rand() % __BATCH_MAX)) : 1;
+            vidx = atomic_fetch_add_explicit(info->vindex, batch, memory_order_relaxed);
             if (vidx >= __TEST_VALUES_COUNT) { break; }
-            //printf("INFO: [%s] push #%d (%ld + %ldj)\n",
-            //    info->name, vidx, info->values[vidx].real, info->values[vidx].img);
-            cached = true;
+            vcount = MIN(batch, __TEST_VALUES_COUNT - vidx);
         }
 
-        // try to push an element at cached index
-        if (cyclic_queue_push(info->queue, &info->values[vidx])) {
-            cached = false; // success, reset cached value (index)
-            info->processed_count++;
+        // try to push element(s) at cached index range (single or batch op)
+        uint32_t n = ((vcount == 1) && (rand() % 2))
+            ? (cyclic_queue_push(info->queue, &info->values[vidx]) ? 1 : 0)
+            : cyclic_queue_push_n(info->queue, &info->values[vidx], vcount);
+        if (n) {
+            vidx += n; // success, advance cached range
+            vcount -= n;
+            info->processed_count += n;
         } else {
             //fprintf(stderr, "WARN: [%s] failed to push\n", info->name);
             sleep_time.tv_nsec = 50000;
@@ -173,7 +211,7 @@ void *run_consumer(void *arg)
 {
     runner_data_t *info = (runner_data_t*)arg;
     struct timespec sleep_time = {0, 0};
-    complex_uint64_t next_val;
+    complex_uint64_t next_vals[__BATCH_MAX];
 
     srand(*((unsigned int*)(info->values + 10)));
 
@@ -189,19 +227,19 @@ void *run_consumer(void *arg)
             }
         }
 
-        // take next value
-        if (cyclic_queue_take(info->queue, &next_val)) {
-            info->result.real += next_val.real;
-            info->result.img += next_val.img;
-            //printf("INFO: [%s] took (%ld + %ldj)\n",
-            //    info->name, next_val.real, next_val.img);
-            atomic_fetch_add_explicit(info->consumed_count, 1, memory_order_relaxed);
-            //printf("INFO: [%s] count = %d / %d\n",
-            //    info->name, *(info->consumed_count), __TEST_VALUES_COUNT);
-            info->processed_count++;
+        // take next value(s) (single or batch op)
+        uint32_t n = (rand() % 2)
+            ? (cyclic_queue_take(info->queue, &next_vals[0]) ? 1 : 0)
+            : cyclic_queue_take_n(info->queue, next_vals, 1 + (rand() % __BATCH_MAX));
+        for (uint32_t i = 0; i < n; ++i) {
+            info->result.real += next_vals[i].real;
+            info->result.img += next_vals[i].img;
+        }
+        if (n) {
+            atomic_fetch_add_explicit(info->consumed_count, n, memory_order_relaxed);
+            info->processed_count += n;
         }
     }
 
     return arg;
 }
-
@@ -0,0 +1,390 @@
+#include "common.h"
+#include "random.h"
+#include "cpu_features.h"
+#include "keystream_aes.h"
+#include "keystream_chacha20.h"
+
+#include <time.h>
+
+#define __DATA_SIZE             (64 * 1024 * 1024)
+#define __CHUNKED_SIZE          (1024 * 1024)
+#define __MULTI_STREAMS         256
+#define __MULTI_RECORD_MAX      1500
+#define __MULTI_ROUNDS          2000
+
+static const char *simd_caps[] = { "avx512", "avx2", "sse2", "none" };
+
+typedef struct __test_vector {
+    const char *name;
+    const char *key;
+    const char *iv;
+    const char *plain;
+    const char *cipher;
+} test_vector_t;
+
+// NIST SP 800-38A, F.5.1 and F.5.5
+static const test_vector_t test_vectors[] = {
+    {
+        "CTR-AES128",
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+        "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+        "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee",
+    },
+    {
+        "CTR-AES256",
+        "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+        "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+        "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+        "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+        "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6",
+    },
+};
+
+// draft-agl-tls-chacha20poly1305 TC1 (block 0) and RFC 7539 A.1 #2 (block 1):
+// zero key and nonce; block 1 crosses into the second kernel lane
+static const test_vector_t chacha20_test_vector = {
+    "ChaCha20",
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+    "da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586"
+    "9f07e7be5551387a98ba977c732d080dcb0f29a048e3656912c6533e32ee7aed"
+    "29b721769ce64e43d57133b074d839d531ed1f28510afb45ace10a1f4b794d6f",
+};
+
+
+size_t hex_decode(const char *hex, uint8_t *out)
+{
+    size_t n = strlen(hex) / 2;
+
+    for (size_t i = 0; i < n; ++i) {
+        unsigned int byte;
+        sscanf(hex + i * 2, "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+
+    return n;
+}
+
+// AES-128/256-CTR (16/32-byte key) or ChaCha20 (chacha20 set)
+typedef struct __test_engine {
+    union {
+        keystream_t base;
+        keystream_aes_t aes;
+        keystream_chacha20_t chacha20;
+    };
+    bool is_chacha20;
+} test_engine_t;
+
+void test_engine_init(test_engine_t *engine, bool chacha20, const uint8_t *key, size_t key_size, const uint8_t *iv)
+{
+    engine->is_chacha20 = chacha20;
+    if (chacha20) {
+        keystream_chacha20_init(&(engine->chacha20), key, iv);
+    } else {
+        keystream_aes_init(&(engine->aes), key, key_size, iv);
+    }
+}
+
+void test_engine_destroy(test_engine_t *engine)
+{
+    if (engine->is_chacha20) {
+        keystream_chacha20_destroy(&(engine->chacha20));
+    } else {
+        keystream_aes_destroy(&(engine->aes));
+    }
+}
+
+int run_vector_test(const test_vector_t *tv, bool chacha20)
+{
+    uint8_t key[32], iv[16], plain[256], cipher[256], data[256];
+    size_t key_size = hex_decode(tv->key, key);
+    size_t size = hex_decode(tv->plain, plain);
+    test_engine_t ks;
+
+    hex_decode(tv->iv, iv);
+    hex_decode(tv->cipher, cipher);
+
+    // in one call
+    memcpy(data, plain, size);
+    test_engine_init(&ks, chacha20, key, key_size, iv);
+    ks.base.xor_func(&(ks.base), data, size);
+    test_engine_destroy(&ks);
+
+    if (memcmp(data, cipher, size) != 0) {
+        printf("[%s] FAILED (one call)\n", tv->name);
+        return EXIT_FAILURE;
+    }
+
+    // byte by byte
+    memcpy(data, plain, size);
+    test_engine_init(&ks, chacha20, key, key_size, iv);
+    for (size_t i = 0; i < size; ++i) {
+        ks.base.xor_func(&(ks.base), data + i, 1);
+    }
+    test_engine_destroy(&ks);
+
+    if (memcmp(data, cipher, size) != 0) {
+        printf("[%s] FAILED (byte by byte)\n", tv->name);
+        return EXIT_FAILURE;
+    }
+
+    printf("[%s] ok\n", tv->name);
+    return EXIT_SUCCESS;
+}
+
+int run_chunked_test(bool chacha20)
+{
+    uint8_t key[32], iv[16];
+    uint8_t *whole = malloc(__CHUNKED_SIZE), *chunked = malloc(__CHUNKED_SIZE);
+    const char *name = chacha20 ? "ChaCha20" : "AES-256-CTR";
+    test_engine_t ks;
+    int result = EXIT_SUCCESS;
+
+    prng_fill(key, sizeof(key));
+    prng_fill(iv, sizeof(iv));
+    prng_fill(whole, __CHUNKED_SIZE);
+    memcpy(chunked, whole, __CHUNKED_SIZE);
+
+    test_engine_init(&ks, chacha20, key, sizeof(key), iv);
+    ks.base.xor_func(&(ks.base), whole, __CHUNKED_SIZE);
+    test_engine_destroy(&ks);
+
+    // random chunk sizes (partial blocks, whole groups, both)
+    test_engine_init(&ks, chacha20, key, sizeof(key), iv);
+    for (size_t offset = 0, n; offset < __CHUNKED_SIZE; offset += n) {
+        n = (size_t)(rand() % 700) + 1;
+        n = MIN(n, __CHUNKED_SIZE - offset);
+        ks.base.xor_func(&(ks.base), chunked + offset, n);
+    }
+    test_engine_destroy(&ks);
+
+    if (memcmp(whole, chunked, __CHUNKED_SIZE) != 0) {
+        printf("[chunked] %s FAILED\n", name);
+        result = EXIT_FAILURE;
+    } else {
+        printf("[chunked] %s ok\n", name);
+    }
+
+    free(whole);
+    free(chunked);
+    return result;
+}
+
+// many streams, small records: multi-buffer pass vs one stream at a time
+int run_multi_test(bool speed)
+{
+    keystream_aes_t *single = malloc(sizeof(keystream_aes_t) * __MULTI_STREAMS);
+    keystream_aes_t *multi = malloc(sizeof(keystream_aes_t) * __MULTI_STREAMS);
+    keystream_aes_job_t jobs[__MULTI_STREAMS];
+    uint8_t *whole = malloc(__MULTI_STREAMS * __MULTI_RECORD_MAX);
+    uint8_t *batched = malloc(__MULTI_STREAMS * __MULTI_RECORD_MAX);
+    size_t sizes[__MULTI_STREAMS], offsets[__MULTI_STREAMS], total = 0;
+    struct timespec start, end;
+    double seconds[2] = {0, 0};
+    int result = EXIT_SUCCESS;
+
+    for (int i = 0; i < __MULTI_STREAMS; ++i) {
+        uint8_t key[32], iv[16];
+
+        prng_fill(key, sizeof(key));
+        prng_fill(iv, sizeof(iv));
+        // mostly AES-256 (sessions), some AES-128
+        keystream_aes_init(&(single[i]), key, (i % 5 == 0) ? 16 : 32, iv);
+        keystream_aes_init(&(multi[i]), key, (i % 5 == 0) ? 16 : 32, iv);
+    }
+
+    for (int round = 0; (round < (speed ? __MULTI_ROUNDS : 64)) && (result == EXIT_SUCCESS); ++round) {
+        size_t round_size = 0;
+
+        // small records (some empty, some sub-block), an occasional long one, back to back
+        for (int i = 0; i < __MULTI_STREAMS; ++i) {
+            sizes[i] = (size_t)(rand() % ((i % 17 == 0) ? __MULTI_RECORD_MAX : 200));
+            offsets[i] = round_size;
+            round_size += sizes[i];
+        }
+        total += round_size;
+
+        prng_fill(whole, round_size);
+        memcpy(batched, whole, round_size);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < __MULTI_STREAMS; ++i) {
+            single[i].base.xor_func(&(single[i].base), whole + offsets[i], sizes[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds[0] += (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < __MULTI_STREAMS; ++i) {
+            jobs[i].ks = &(multi[i]);
+            jobs[i].dptr = batched + offsets[i];
+            jobs[i].size = sizes[i];
+        }
+        keystream_aes_xor_multi(jobs, __MULTI_STREAMS);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds[1] += (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (memcmp(whole, batched, round_size) != 0) {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (result != EXIT_SUCCESS) {
+        printf("[multi] FAILED\n");
+    } else if (!speed) {
+        printf("[multi] ok\n");
+    } else {
+        printf("[speed] AES-CTR %d streams, small records (%s): %.2f MB/s single, %.2f MB/s multi-buffer\n",
+            __MULTI_STREAMS, keystream_aes_engine_name(), total / seconds[0] / 1e6, total / seconds[1] / 1e6);
+    }
+
+    for (int i = 0; i < __MULTI_STREAMS; ++i) {
+        keystream_aes_destroy(&(single[i]));
+        keystream_aes_destroy(&(multi[i]));
+    }
+    free(single);
+    free(multi);
+    free(whole);
+    free(batched);
+    return result;
+}
+
+// key_size 0: ChaCha20
+void run_speed_test(size_t key_size)
+{
+    uint8_t key[32], iv[16];
+    uint8_t *data = malloc(__DATA_SIZE);
+    struct timespec start, end;
+    test_engine_t ks;
+
+    prng_fill(key, sizeof(key));
+    prng_fill(iv, sizeof(iv));
+    prng_fill(data, __DATA_SIZE);
+
+    test_engine_init(&ks, key_size == 0, key, key_size, iv);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ks.base.xor_func(&(ks.base), data, __DATA_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec)
+        + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    if (key_size == 0) {
+        printf("[speed] ChaCha20 (%s): %.2f MB/s\n",
+            keystream_chacha20_engine_name(), __DATA_SIZE / seconds / 1e6);
+    } else {
+        printf("[speed] AES-%zu-CTR (%s): %.2f MB/s\n", key_size * 8,
+            keystream_aes_engine_name(), __DATA_SIZE / seconds / 1e6);
+    }
+
+    test_engine_destroy(&ks);
+    free(data);
+}
+
+// vectors, chunked and multi-buffer cases with the engines picked for the cap
+// the process runs under
+int run_engine_tests(void)
+{
+    int result = EXIT_SUCCESS;
+
+    printf("[main] AES engine: %s\n", keystream_aes_engine_name());
+    printf("[main] ChaCha20 engine: %s\n", keystream_chacha20_engine_name());
+
+    for (int i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); ++i) {
+        if (run_vector_test(&test_vectors[i], false) != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (run_vector_test(&chacha20_test_vector, true) != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    if ((run_chunked_test(false) != EXIT_SUCCESS) || (run_chunked_test(true) != EXIT_SUCCESS)) {
+        result = EXIT_FAILURE;
+    }
+
+    if (run_multi_test(false) != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
+
+// every engine: the engine tests in a child per CRYPTOCHAN_SIMD cap
+int run_kernels_test(void)
+{
+    char self[256], command[512], line[256];
+    int result = EXIT_SUCCESS;
+
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        perror("readlink");
+        return EXIT_FAILURE;
+    }
+    self[n] = '\0';
+
+    for (int i = 0; i < sizeof(simd_caps) / sizeof(simd_caps[0]); ++i) {
+        snprintf(command, sizeof(command), "%s=%s '%s' engines",
+            CPU_FEATURES_ENV_CAP, simd_caps[i], self);
+
+        fflush(stdout);
+        FILE *child = popen(command, "r");
+        if (!child) {
+            perror("popen");
+            result = EXIT_FAILURE;
+            break;
+        }
+
+        while (fgets(line, sizeof(line), child)) {
+            printf("[%s=%s] %s", CPU_FEATURES_ENV_CAP, simd_caps[i], line);
+        }
+
+        if (pclose(child) != 0) {
+            printf("[kernels] %s=%s FAILED\n", CPU_FEATURES_ENV_CAP, simd_caps[i]);
+            result = EXIT_FAILURE;
+        }
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [engines]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 2) {
+        if (!strcasecmp(argv[1], "engines")) {
+            return run_engine_tests();
+        }
+        fprintf(stderr, "Unknown mode: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if (run_kernels_test() != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // speed of the engines picked for this host
+    printf("[main] AES engine: %s\n", keystream_aes_engine_name());
+    printf("[main] ChaCha20 engine: %s\n", keystream_chacha20_engine_name());
+
+    run_speed_test(16);
+    run_speed_test(32);
+    run_speed_test(0);
+    run_multi_test(true);
+
+    return EXIT_SUCCESS;
+}
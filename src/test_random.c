@@ -0,0 +1,159 @@
+#include "common.h"
+#include "random.h"
+#include "cpu_features.h"
+
+#define __SEED                  0x2545f4914f6cdd1dULL
+#define __CALLS                 200
+#define __LARGE_SIZE            (1024 * 1024 + 13)
+#define __STREAM_SIZE           (__CALLS * 1000 + __LARGE_SIZE)
+
+static const char *simd_caps[] = { "avx512", "avx2", "sse2", "none" };
+
+// odd lengths (partial blocks, whole chunks and both) then a large one
+size_t stream_call_size(int call)
+{
+    return (call < __CALLS) ? ((size_t)(call * 37) % 1000 + 1) : __LARGE_SIZE;
+}
+
+// the filler stream of prng_fill() from __SEED, returns its size
+size_t fill_stream(uint8_t *data)
+{
+    size_t offset = 0;
+
+    prng_seed(__SEED);
+    for (int call = 0; call <= __CALLS; ++call) {
+        prng_fill(data + offset, stream_call_size(call));
+        offset += stream_call_size(call);
+    }
+
+    return offset;
+}
+
+uint64_t rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// plain xoshiro256++ per lane, seeded like prng_seed(); a call takes whole
+// blocks (one step of all lanes), the rest of the last one is dropped
+size_t fill_reference_stream(uint8_t *data)
+{
+    uint64_t state[RANDOM_PRNG_LANES][4], seed = __SEED;
+    uint8_t block[RANDOM_PRNG_BLOCK];
+    size_t offset = 0;
+
+    for (int l = 0; l < RANDOM_PRNG_LANES; ++l) {
+        for (int w = 0; w < 4; ++w) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            state[l][w] = z ^ (z >> 31);
+        }
+    }
+
+    for (int call = 0; call <= __CALLS; ++call) {
+        size_t size = stream_call_size(call);
+
+        for (size_t filled = 0; filled < size; filled += RANDOM_PRNG_BLOCK) {
+            for (int l = 0; l < RANDOM_PRNG_LANES; ++l) {
+                uint64_t *s = state[l];
+                uint64_t result = rotl64(s[0] + s[3], 23) + s[0];
+                uint64_t t = s[1] << 17;
+
+                s[2] ^= s[0];
+                s[3] ^= s[1];
+                s[1] ^= s[2];
+                s[0] ^= s[3];
+                s[2] ^= t;
+                s[3] = rotl64(s[3], 45);
+
+                memcpy(block + l * sizeof(uint64_t), &result, sizeof(result));
+            }
+            memcpy(data + offset + filled, block, MIN(size - filled, RANDOM_PRNG_BLOCK));
+        }
+        offset += size;
+    }
+
+    return offset;
+}
+
+// child: the name of the kernel picked under the given cap (a line), then
+// its stream, to stdout
+int run_dump(void)
+{
+    uint8_t *data = malloc(__STREAM_SIZE);
+    size_t size = fill_stream(data);
+
+    printf("%s\n", prng_kernel_name());
+    size_t written = fwrite(data, 1, size, stdout);
+
+    free(data);
+    return (written == size) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// every kernel (a child per CRYPTOCHAN_SIMD cap) against the reference
+int run_kernels_test(void)
+{
+    char self[256], command[512], kernel[32];
+    int result = EXIT_SUCCESS;
+
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        perror("readlink");
+        return EXIT_FAILURE;
+    }
+    self[n] = '\0';
+
+    uint8_t *reference = malloc(__STREAM_SIZE), *data = malloc(__STREAM_SIZE);
+    size_t size = fill_reference_stream(reference);
+
+    for (int i = 0; i < sizeof(simd_caps) / sizeof(simd_caps[0]); ++i) {
+        snprintf(command, sizeof(command), "%s=%s '%s' dump",
+            CPU_FEATURES_ENV_CAP, simd_caps[i], self);
+
+        FILE *child = popen(command, "r");
+        if (!child) {
+            perror("popen");
+            result = EXIT_FAILURE;
+            break;
+        }
+
+        if (!fgets(kernel, sizeof(kernel), child)) {
+            kernel[0] = '\0';
+        }
+        kernel[strcspn(kernel, "\n")] = '\0';
+
+        size_t got = fread(data, 1, __STREAM_SIZE, child);
+        int status = pclose(child);
+
+        if ((status != 0) || (got != size) || (memcmp(data, reference, size) != 0)) {
+            printf("[kernels] %s=%s (%s) FAILED\n", CPU_FEATURES_ENV_CAP, simd_caps[i], kernel);
+            result = EXIT_FAILURE;
+        } else {
+            printf("[kernels] %s=%s (%s) ok\n", CPU_FEATURES_ENV_CAP, simd_caps[i], kernel);
+        }
+    }
+
+    free(reference);
+    free(data);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [dump]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 2) {
+        if (!strcasecmp(argv[1], "dump")) {
+            return run_dump();
+        }
+        fprintf(stderr, "Unknown mode: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    printf("[main] PRNG kernel: %s\n", prng_kernel_name());
+    return run_kernels_test();
+}
@@ -0,0 +1,249 @@
+#include "common.h"
+#include "random.h"
+#include "session_pool.h"
+
+#include <sys/mman.h>
+
+#define __OBJECT_SIZE           1000
+#define __RING_CHUNKS           4
+#define __RING_MAX_CHUNKS       16
+
+// pages of the range are still mapped (msync fails with ENOMEM otherwise)
+bool is_mapped(void *ptr)
+{
+    return msync(ptr, cyclic_buffer_page_size(), MS_ASYNC) == 0;
+}
+
+// nothing to read, the whole (initial) size to write
+bool is_reset(cyclic_buffer_t *buf, uint32_t size)
+{
+    return (buf->total_size == size)
+        && (atomic_load(&(buf->available_to_read)) == 0)
+        && (atomic_load(&(buf->available_to_recode)) == 0)
+        && (atomic_load(&(buf->available_to_write)) == size);
+}
+
+// dirty the ring: all of it written (elastic ones grown first)
+void fill_ring(cyclic_buffer_t *buf)
+{
+    uint8_t data[CYCLIC_BUFFER_CHUNK_SIZE];
+
+    prng_fill(data, sizeof(data));
+    for (int i = 0; i < CYCLIC_BUFFER_GROW_AFTER; ++i) {
+        cyclic_buffer_grow(buf);
+    }
+    while (cyclic_buffer_write(buf, data, sizeof(data)) > 0) {
+    }
+    cyclic_buffer_recode_none(buf);
+}
+
+int run_objects_test(void)
+{
+    session_pool_t pool;
+    uint8_t zero[__OBJECT_SIZE] = {0};
+    int result = EXIT_SUCCESS;
+
+    session_pool_init(&pool, __OBJECT_SIZE, __RING_CHUNKS, __RING_CHUNKS, 0);
+
+    uint8_t *first = session_pool_object_get(&pool);
+    uint8_t *second = session_pool_object_get(&pool);
+
+    if (!first || !second || (first == second) || memcmp(first, zero, __OBJECT_SIZE)) {
+        printf("[objects] FAILED (get)\n");
+        result = EXIT_FAILURE;
+    } else {
+        // dirty ones come back zero-filled, the last released first
+        prng_fill(first, __OBJECT_SIZE);
+        prng_fill(second, __OBJECT_SIZE);
+        session_pool_object_put(&pool, first);
+        session_pool_object_put(&pool, second);
+
+        uint8_t *again = session_pool_object_get(&pool);
+        uint8_t *again_first = session_pool_object_get(&pool);
+
+        if ((again != second) || (again_first != first)
+            || memcmp(again, zero, __OBJECT_SIZE) || memcmp(again_first, zero, __OBJECT_SIZE)) {
+            printf("[objects] FAILED (reuse)\n");
+            result = EXIT_FAILURE;
+        } else {
+            printf("[objects] ok\n");
+        }
+    }
+
+    session_pool_destroy(&pool);
+    return result;
+}
+
+int run_fixed_rings_test(void)
+{
+    session_pool_t pool;
+    cyclic_buffer_t buf;
+    uint32_t ring_size = CYCLIC_BUFFER_CHUNK_SIZE * __RING_CHUNKS;
+    int result = EXIT_FAILURE;
+
+    // not elastic: rings are carved from the arenas
+    session_pool_init(&pool, __OBJECT_SIZE, __RING_CHUNKS, __RING_CHUNKS, 0);
+
+    for (;;) {
+        if (!session_pool_ring_get(&pool, &buf, 0)
+            || !(buf.flags & CYCLIC_BUFFER_FLAG_EXTERNAL) || !is_reset(&buf, ring_size)) {
+            printf("[fixed rings] FAILED (get)\n");
+            break;
+        }
+
+        uint8_t *data_ptr = buf.data_ptr;
+
+        fill_ring(&buf);
+        session_pool_ring_put(&pool, &buf);
+
+        if (buf.data_ptr != NULL) {
+            printf("[fixed rings] FAILED (put)\n");
+            break;
+        }
+        if (!session_pool_ring_get(&pool, &buf, 0)
+            || (buf.data_ptr != data_ptr) || !is_reset(&buf, ring_size)) {
+            printf("[fixed rings] FAILED (reuse)\n");
+            break;
+        }
+
+        session_pool_ring_put(&pool, &buf);
+        printf("[fixed rings] ok\n");
+        result = EXIT_SUCCESS;
+        break;
+    }
+
+    session_pool_destroy(&pool);
+    return result;
+}
+
+int run_mapped_rings_test(void)
+{
+    static const struct {
+        const char *name;
+        uint32_t flags;
+        uint32_t kind;
+    } kinds[] = {
+        { "elastic", 0, CYCLIC_BUFFER_FLAG_ELASTIC },
+        { "mirrored", CYCLIC_BUFFER_FLAG_MIRRORED, CYCLIC_BUFFER_FLAG_MIRRORED },
+        { "splice", CYCLIC_BUFFER_FLAG_SPLICE, CYCLIC_BUFFER_FLAG_MIRRORED | CYCLIC_BUFFER_FLAG_SPLICE },
+    };
+    const int count = sizeof(kinds) / sizeof(kinds[0]);
+    session_pool_t pool;
+    cyclic_buffer_t bufs[count];
+    uint8_t *data_ptrs[count];
+    uint32_t ring_size = CYCLIC_BUFFER_CHUNK_SIZE * __RING_CHUNKS;
+    int result = EXIT_SUCCESS;
+
+    session_pool_init(&pool, __OBJECT_SIZE, __RING_CHUNKS, __RING_MAX_CHUNKS, 0);
+
+    // one of each kind, dirty, all released
+    for (int i = 0; i < count; ++i) {
+        if (!session_pool_ring_get(&pool, &(bufs[i]), kinds[i].flags)
+            || (bufs[i].flags != kinds[i].kind) || !is_reset(&(bufs[i]), ring_size)) {
+            printf("[mapped rings] %s FAILED (get)\n", kinds[i].name);
+            result = EXIT_FAILURE;
+            break;
+        }
+        data_ptrs[i] = bufs[i].data_ptr;
+        fill_ring(&(bufs[i]));
+    }
+    for (int i = 0; (i < count) && (result == EXIT_SUCCESS); ++i) {
+        session_pool_ring_put(&pool, &(bufs[i]));
+    }
+
+    // each kind gets its own mapping back (in the reverse order: no mixing up
+    // with the last released one)
+    for (int i = count - 1; (i >= 0) && (result == EXIT_SUCCESS); --i) {
+        if (!session_pool_ring_get(&pool, &(bufs[i]), kinds[i].flags)
+            || (bufs[i].data_ptr != data_ptrs[i]) || (bufs[i].flags != kinds[i].kind)
+            || !is_reset(&(bufs[i]), ring_size)) {
+            printf("[mapped rings] %s FAILED (reuse)\n", kinds[i].name);
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (result == EXIT_SUCCESS) {
+        printf("[mapped rings] ok\n");
+        for (int i = 0; i < count; ++i) {
+            session_pool_ring_put(&pool, &(bufs[i]));
+        }
+    }
+
+    session_pool_destroy(&pool);
+    return result;
+}
+
+int run_foreign_rings_test(void)
+{
+    session_pool_t pool;
+    cyclic_buffer_t buf;
+    int result = EXIT_SUCCESS;
+
+    session_pool_init(&pool, __OBJECT_SIZE, __RING_CHUNKS, __RING_MAX_CHUNKS, 0);
+
+    // rings the pool cannot reuse (other sizes): destroyed, not kept
+    if (!cyclic_buffer_init_elastic(&buf, __RING_CHUNKS * 2, __RING_MAX_CHUNKS)) {
+        printf("[foreign rings] elastic FAILED (init)\n");
+        result = EXIT_FAILURE;
+    } else {
+        uint8_t *data_ptr = buf.data_ptr;
+
+        session_pool_ring_put(&pool, &buf);
+        if ((buf.data_ptr != NULL) || (pool.mapped_count != 0) || is_mapped(data_ptr)) {
+            printf("[foreign rings] elastic FAILED\n");
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (!cyclic_buffer_init_with_flags(&buf, __RING_CHUNKS * 2, CYCLIC_BUFFER_FLAG_MIRRORED)) {
+        printf("[foreign rings] mirrored FAILED (init)\n");
+        result = EXIT_FAILURE;
+    } else {
+        uint8_t *data_ptr = buf.data_ptr;
+
+        session_pool_ring_put(&pool, &buf);
+        if ((buf.data_ptr != NULL) || (pool.mapped_count != 0) || is_mapped(data_ptr)) {
+            printf("[foreign rings] mirrored FAILED\n");
+            result = EXIT_FAILURE;
+        }
+    }
+
+    // plain (malloc'd) ring: freed, not taken as arena memory
+    if (!cyclic_buffer_init(&buf, __RING_CHUNKS)) {
+        printf("[foreign rings] plain FAILED (init)\n");
+        result = EXIT_FAILURE;
+    } else {
+        session_pool_ring_put(&pool, &buf);
+        if ((buf.data_ptr != NULL) || (pool.mapped_count != 0) || (pool.free_rings != NULL)) {
+            printf("[foreign rings] plain FAILED\n");
+            result = EXIT_FAILURE;
+        }
+    }
+
+    if (result == EXIT_SUCCESS) {
+        printf("[foreign rings] ok\n");
+    }
+
+    session_pool_destroy(&pool);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int result = EXIT_SUCCESS;
+
+    if (run_objects_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+    if (run_fixed_rings_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+    if (run_mapped_rings_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+    if (run_foreign_rings_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,124 @@
+#include "common.h"
+#include "random.h"
+#include "ticket.h"
+
+#define __LIFETIME              3600
+
+// a flipped bit in each part of the ticket (nonce, ciphertext, MAC)
+static const struct {
+    const char *name;
+    size_t offset;
+} tampered_parts[] = {
+    { "nonce", 0 },
+    { "nonce tail", TICKET_NONCE_SIZE - 1 },
+    { "expiry", TICKET_NONCE_SIZE },
+    { "fingerprint", TICKET_NONCE_SIZE + 8 },
+    { "secret", TICKET_NONCE_SIZE + 8 + EC_HASH_SIZE + 7 },
+    { "MAC", TICKET_NONCE_SIZE + TICKET_PLAIN_SIZE },
+    { "MAC tail", TICKET_SIZE - 1 },
+};
+
+int run_round_trip_test(void)
+{
+    uint8_t fingerprint[EC_HASH_SIZE], secret[TICKET_SECRET_SIZE];
+    uint8_t opened_fingerprint[EC_HASH_SIZE], opened_secret[TICKET_SECRET_SIZE];
+    uint8_t ticket[TICKET_SIZE], other[TICKET_SIZE];
+
+    prng_fill(fingerprint, sizeof(fingerprint));
+    prng_fill(secret, sizeof(secret));
+
+    if (!ticket_issue(fingerprint, secret, __LIFETIME, ticket)
+        || !ticket_issue(fingerprint, secret, __LIFETIME, other)) {
+        printf("[round trip] FAILED (issue)\n");
+        return EXIT_FAILURE;
+    }
+
+    // the secret is not in clear, tickets of the same content differ (nonce)
+    if (memmem(ticket, TICKET_SIZE, secret, sizeof(secret))
+        || !memcmp(ticket, other, TICKET_SIZE)) {
+        printf("[round trip] FAILED (not encrypted)\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!ticket_open(ticket, opened_fingerprint, opened_secret)
+        || memcmp(fingerprint, opened_fingerprint, sizeof(fingerprint))
+        || memcmp(secret, opened_secret, sizeof(secret))) {
+        printf("[round trip] FAILED (open)\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("[round trip] ok\n");
+    return EXIT_SUCCESS;
+}
+
+int run_tampered_test(void)
+{
+    uint8_t fingerprint[EC_HASH_SIZE], secret[TICKET_SECRET_SIZE];
+    uint8_t ticket[TICKET_SIZE], tampered[TICKET_SIZE];
+    int result = EXIT_SUCCESS;
+
+    prng_fill(fingerprint, sizeof(fingerprint));
+    prng_fill(secret, sizeof(secret));
+
+    if (!ticket_issue(fingerprint, secret, __LIFETIME, ticket)) {
+        printf("[tampered] FAILED (issue)\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < sizeof(tampered_parts) / sizeof(tampered_parts[0]); ++i) {
+        for (int bit = 0; bit < 8; ++bit) {
+            memcpy(tampered, ticket, TICKET_SIZE);
+            tampered[tampered_parts[i].offset] ^= (uint8_t)(1 << bit);
+
+            if (ticket_open(tampered, fingerprint, secret)) {
+                printf("[tampered] %s bit %d FAILED (accepted)\n", tampered_parts[i].name, bit);
+                result = EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (result == EXIT_SUCCESS) {
+        printf("[tampered] ok\n");
+    }
+    return result;
+}
+
+int run_expired_test(void)
+{
+    uint8_t fingerprint[EC_HASH_SIZE], secret[TICKET_SECRET_SIZE];
+    uint8_t ticket[TICKET_SIZE];
+
+    prng_fill(fingerprint, sizeof(fingerprint));
+    prng_fill(secret, sizeof(secret));
+
+    // no lifetime: expires the moment it is issued
+    if (!ticket_issue(fingerprint, secret, 0, ticket)) {
+        printf("[expired] FAILED (issue)\n");
+        return EXIT_FAILURE;
+    }
+
+    if (ticket_open(ticket, fingerprint, secret)) {
+        printf("[expired] FAILED (accepted)\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("[expired] ok\n");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    int result = EXIT_SUCCESS;
+
+    if (run_round_trip_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+    if (run_tampered_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+    if (run_expired_test() != EXIT_SUCCESS) {
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
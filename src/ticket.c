@@ -0,0 +1,144 @@
+#include "common.h"
+#include "ticket.h"
+#include "random.h"
+#include "keystream_chacha20.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#if (TICKET_NONCE_SIZE < KEYSTREAM_CHACHA20_NONCE_SIZE)
+# error "TICKET_NONCE_SIZE is shorter than the ChaCha20 nonce"
+#endif
+
+#define __TAG_TICKET_KEY            "cryptochan/ticket-key"
+#define __TAG_TICKET_MAC            "cryptochan/ticket-mac"
+
+static uint8_t ticket_enc_key[EC_HASH_SIZE];
+static uint8_t ticket_mac_key[EC_HASH_SIZE];
+static bool ticket_keys_ready = false;
+static pthread_once_t ticket_keys_once = PTHREAD_ONCE_INIT;
+
+
+void __ticket_keys_init(void)
+{
+    // tickets die with the process (no key is shared or stored)
+    ticket_keys_ready = (fill_random(ticket_enc_key, sizeof(ticket_enc_key))
+            == sizeof(ticket_enc_key))
+        && (fill_random(ticket_mac_key, sizeof(ticket_mac_key)) == sizeof(ticket_mac_key));
+
+    if (!ticket_keys_ready) {
+        fprintf(stderr, "ERROR: ticket: failed to generate ticket keys\n");
+    }
+}
+
+void __ticket_crypt(const uint8_t *nonce, uint8_t *data, size_t size)
+{
+    uint8_t msg[EC_HASH_SIZE + TICKET_NONCE_SIZE];
+    uint8_t key[KEYSTREAM_CHACHA20_KEY_SIZE];
+    keystream_chacha20_t ks;
+
+    // per-ticket key: H(enc key || nonce), ChaCha20 nonce: the head of the ticket's
+    memcpy(msg, ticket_enc_key, EC_HASH_SIZE);
+    memcpy(msg + EC_HASH_SIZE, nonce, TICKET_NONCE_SIZE);
+    tagged_hash(__TAG_TICKET_KEY, msg, sizeof(msg), key);
+
+    keystream_chacha20_init(&ks, key, nonce);
+    ks.base.xor_func(&(ks.base), data, size);
+    keystream_chacha20_destroy(&ks);
+
+    explicit_bzero(msg, sizeof(msg));
+    explicit_bzero(key, sizeof(key));
+}
+
+void __ticket_mac(const uint8_t *ticket, uint8_t *mac)
+{
+    uint8_t msg[EC_HASH_SIZE + TICKET_NONCE_SIZE + TICKET_PLAIN_SIZE];
+
+    // fixed length message: prefix MAC is not length-extendable
+    memcpy(msg, ticket_mac_key, EC_HASH_SIZE);
+    memcpy(msg + EC_HASH_SIZE, ticket, TICKET_NONCE_SIZE + TICKET_PLAIN_SIZE);
+    tagged_hash(__TAG_TICKET_MAC, msg, sizeof(msg), mac);
+
+    explicit_bzero(msg, sizeof(msg));
+}
+
+bool __ticket_equal(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    uint8_t diff = 0;
+
+    // constant time
+    for (size_t i = 0; i < size; ++i) {
+        diff |= a[i] ^ b[i];
+    }
+
+    return (diff == 0);
+}
+
+
+bool ticket_issue(
+    const uint8_t *client_fingerprint, const uint8_t *resumption_secret,
+    uint32_t lifetime, uint8_t *ticket
+)
+{
+    pthread_once(&ticket_keys_once, __ticket_keys_init);
+    if (!ticket_keys_ready)
+        { return false; }
+
+    uint8_t *nonce = ticket;
+    uint8_t *plain = ticket + TICKET_NONCE_SIZE;
+    uint64_t expiry = (uint64_t)time(NULL) + lifetime;
+
+    if (fill_random(nonce, TICKET_NONCE_SIZE) != TICKET_NONCE_SIZE) {
+        fprintf(stderr, "ERROR: ticket_issue: failed to fill nonce\n");
+        return false;
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        plain[i] = (uint8_t)(expiry >> (i * 8));
+    }
+    memcpy(plain + 8, client_fingerprint, EC_HASH_SIZE);
+    memcpy(plain + 8 + EC_HASH_SIZE, resumption_secret, TICKET_SECRET_SIZE);
+
+    // encrypt, then MAC
+    __ticket_crypt(nonce, plain, TICKET_PLAIN_SIZE);
+    __ticket_mac(ticket, plain + TICKET_PLAIN_SIZE);
+
+    return true;
+}
+
+bool ticket_open(
+    const uint8_t *ticket, uint8_t *client_fingerprint, uint8_t *resumption_secret
+)
+{
+    uint8_t mac[TICKET_MAC_SIZE];
+    uint8_t plain[TICKET_PLAIN_SIZE];
+    uint64_t expiry = 0;
+
+    pthread_once(&ticket_keys_once, __ticket_keys_init);
+    if (!ticket_keys_ready)
+        { return false; }
+
+    // check MAC first (forged or issued by another process)
+    __ticket_mac(ticket, mac);
+    if (!__ticket_equal(mac, ticket + TICKET_NONCE_SIZE + TICKET_PLAIN_SIZE, TICKET_MAC_SIZE))
+        { return false; }
+
+    memcpy(plain, ticket + TICKET_NONCE_SIZE, TICKET_PLAIN_SIZE);
+    __ticket_crypt(ticket, plain, TICKET_PLAIN_SIZE);
+
+    for (int i = 0; i < 8; ++i) {
+        expiry |= (uint64_t)plain[i] << (i * 8);
+    }
+
+    bool result = false;
+
+    if ((uint64_t)time(NULL) < expiry) {
+        memcpy(client_fingerprint, plain + 8, EC_HASH_SIZE);
+        memcpy(resumption_secret, plain + 8 + EC_HASH_SIZE, TICKET_SECRET_SIZE);
+        result = true;
+    }
+
+    explicit_bzero(plain, sizeof(plain));
+
+    return result;
+}
@@ -0,0 +1,30 @@
+#ifndef __TICKET_H
+#define __TICKET_H
+
+#include "common.h"
+#include "ec_helper.h"
+
+#define TICKET_NONCE_SIZE       16      // at least KEYSTREAM_CHACHA20_NONCE_SIZE
+#define TICKET_SECRET_SIZE      EC_HASH_SIZE
+#define TICKET_PLAIN_SIZE       (8 + EC_HASH_SIZE + TICKET_SECRET_SIZE)
+#define TICKET_MAC_SIZE         EC_HASH_SIZE
+#define TICKET_SIZE             (TICKET_NONCE_SIZE + TICKET_PLAIN_SIZE + TICKET_MAC_SIZE)
+
+//
+//  Resumption ticket (opaque to the client):
+//    nonce || E(le64 expiry || client fingerprint || resumption secret) || MAC
+//  encrypted (ChaCha20 under H(ticket key || nonce)) and authenticated with
+//  per-process random ticket keys
+//
+
+extern bool ticket_issue(
+    const uint8_t *client_fingerprint, const uint8_t *resumption_secret,
+    uint32_t lifetime, uint8_t *ticket
+);
+
+// fails on bad MAC or expired ticket
+extern bool ticket_open(
+    const uint8_t *ticket, uint8_t *client_fingerprint, uint8_t *resumption_secret
+);
+
+#endif // __TICKET_H
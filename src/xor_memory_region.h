@@ -0,0 +1,144 @@
+//
+//  xor_memory_region kernel template (no include guard: it is included by
+//  common.c once per vector width)
+//
+//  expects to be defined:
+//    __XK_NAME(name)               decorates the generated function names
+//    __XK_TARGET                   function attributes (target ISA) or empty
+//    __XK_SCALAR_T                 vector type
+//    __XK_LOAD(ptr)                unaligned load
+//    __XK_LOAD_ALIGNED(ptr)        aligned load
+//    __XK_STORE_ALIGNED(ptr, val)  aligned store
+//    __XK_XOR(a, b)                bitwise xor
+//
+
+__XK_TARGET
+void __XK_NAME(__xor_memory_region_aligned_both)(uint8_t *dptr, uint8_t *mask, size_t size)
+{
+    // unroll loop for 4 x scalars
+    while (size >= sizeof(__XK_SCALAR_T) * 4) {
+        register __XK_SCALAR_T s0 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 0);
+        register __XK_SCALAR_T s1 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 1);
+        register __XK_SCALAR_T m0 = __XK_LOAD_ALIGNED(mask + sizeof(__XK_SCALAR_T) * 0);
+        register __XK_SCALAR_T m1 = __XK_LOAD_ALIGNED(mask + sizeof(__XK_SCALAR_T) * 1);
+
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 0, __XK_XOR(s0, m0));
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 1, __XK_XOR(s1, m1));
+
+        register __XK_SCALAR_T s2 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 2);
+        register __XK_SCALAR_T s3 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 3);
+        register __XK_SCALAR_T m2 = __XK_LOAD_ALIGNED(mask + sizeof(__XK_SCALAR_T) * 2);
+        register __XK_SCALAR_T m3 = __XK_LOAD_ALIGNED(mask + sizeof(__XK_SCALAR_T) * 3);
+
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 2, __XK_XOR(s2, m2));
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 3, __XK_XOR(s3, m3));
+
+        size -= sizeof(__XK_SCALAR_T) * 4;
+        dptr += sizeof(__XK_SCALAR_T) * 4;
+        mask += sizeof(__XK_SCALAR_T) * 4;
+    }
+
+    // process remaining scalars
+    while (size >= sizeof(__XK_SCALAR_T)) {
+        register __XK_SCALAR_T s0 = __XK_LOAD_ALIGNED(dptr);
+        register __XK_SCALAR_T m0 = __XK_LOAD_ALIGNED(mask);
+
+        __XK_STORE_ALIGNED(dptr, __XK_XOR(s0, m0));
+
+        size -= sizeof(__XK_SCALAR_T);
+        dptr += sizeof(__XK_SCALAR_T);
+        mask += sizeof(__XK_SCALAR_T);
+    }
+
+    // process remaining simply
+    if (size) {
+        __xor_memory_region_simple(dptr, mask, size);
+    }
+
+    return;
+}
+
+__XK_TARGET
+void __XK_NAME(__xor_memory_region_aligned_dptr)(uint8_t *dptr, uint8_t *mask, size_t size)
+{
+    // unroll loop for 4 x scalars
+    while (size >= sizeof(__XK_SCALAR_T) * 4) {
+        register __XK_SCALAR_T s0 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 0);
+        register __XK_SCALAR_T s1 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 1);
+        register __XK_SCALAR_T m0 = __XK_LOAD(mask + sizeof(__XK_SCALAR_T) * 0);
+        register __XK_SCALAR_T m1 = __XK_LOAD(mask + sizeof(__XK_SCALAR_T) * 1);
+
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 0, __XK_XOR(s0, m0));
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 1, __XK_XOR(s1, m1));
+
+        register __XK_SCALAR_T s2 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 2);
+        register __XK_SCALAR_T s3 = __XK_LOAD_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 3);
+        register __XK_SCALAR_T m2 = __XK_LOAD(mask + sizeof(__XK_SCALAR_T) * 2);
+        register __XK_SCALAR_T m3 = __XK_LOAD(mask + sizeof(__XK_SCALAR_T) * 3);
+
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 2, __XK_XOR(s2, m2));
+        __XK_STORE_ALIGNED(dptr + sizeof(__XK_SCALAR_T) * 3, __XK_XOR(s3, m3));
+
+        size -= sizeof(__XK_SCALAR_T) * 4;
+        dptr += sizeof(__XK_SCALAR_T) * 4;
+        mask += sizeof(__XK_SCALAR_T) * 4;
+    }
+
+    // process remaining scalars
+    while (size >= sizeof(__XK_SCALAR_T)) {
+        register __XK_SCALAR_T s0 = __XK_LOAD_ALIGNED(dptr);
+        register __XK_SCALAR_T m0 = __XK_LOAD(mask);
+
+        __XK_STORE_ALIGNED(dptr, __XK_XOR(s0, m0));
+
+        size -= sizeof(__XK_SCALAR_T);
+        dptr += sizeof(__XK_SCALAR_T);
+        mask += sizeof(__XK_SCALAR_T);
+    }
+
+    // process remaining simply
+    if (size) {
+        __xor_memory_region_simple(dptr, mask, size);
+    }
+
+    return;
+}
+
+__XK_TARGET
+void __XK_NAME(__xor_memory_region)(uint8_t *dptr, uint8_t *mask, size_t size)
+{
+    size_t dptr_unaligned_tail = (size_t)dptr & (sizeof(__XK_SCALAR_T) - 1);
+
+    // do align (process) if there some portion of unaligned bytes
+    if (dptr_unaligned_tail) {
+        size_t count = sizeof(__XK_SCALAR_T) - dptr_unaligned_tail;
+
+        if (size <= count) {
+            __xor_memory_region_simple(dptr, mask, size);
+
+            return;
+        }
+
+        __xor_memory_region_simple(dptr, mask, count);
+
+        size -= count;
+        dptr += count;
+        mask += count;
+    }
+
+    if ((size_t)mask & (sizeof(__XK_SCALAR_T) - 1)) {
+        __XK_NAME(__xor_memory_region_aligned_dptr)(dptr, mask, size);
+    } else {
+        __XK_NAME(__xor_memory_region_aligned_both)(dptr, mask, size);
+    }
+
+    return;
+}
+
+#undef __XK_NAME
+#undef __XK_TARGET
+#undef __XK_SCALAR_T
+#undef __XK_LOAD
+#undef __XK_LOAD_ALIGNED
+#undef __XK_STORE_ALIGNED
+#undef __XK_XOR